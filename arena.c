@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "arena.h"
+
+// Where the data in a block starts, keeping it aligned
+#define ARENA_HEADER_SIZE ((sizeof(arena_block) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+#define ARENA_BLOCK_DATA(block) ((uint8_t*)(block) + ARENA_HEADER_SIZE)
+
+static arena_block *arena_new_block(size_t size);
+static void arena_thread_init(void);
+static void arena_thread_free(void *doomed);
+
+static pthread_key_t arena_thread_key;
+static pthread_once_t arena_thread_once = PTHREAD_ONCE_INIT;
+static __thread arena *thread_arena = NULL;
+
+arena *arena_new(size_t block_size)
+{
+    arena *new;
+
+    if (block_size == 0)
+        block_size = ARENA_BLOCK_SIZE;
+
+    new = malloc(sizeof(arena));
+    if (new == NULL)
+        return NULL;
+
+    new->first = NULL;
+    new->current = NULL;
+    new->block_size = block_size;
+
+    return new;
+}
+
+void arena_free(arena *doomed)
+{
+    arena_block *block, *next;
+
+    if (doomed == NULL)
+        return;
+
+    for (block = doomed->first; block != NULL; block = next)
+    {
+        next = block->next;
+        free(block);
+    }
+
+    free(doomed);
+}
+
+static arena_block *arena_new_block(size_t size)
+{
+    arena_block *new;
+
+    new = malloc(ARENA_HEADER_SIZE + size);
+    if (new == NULL)
+        return NULL;
+
+    new->next = NULL;
+    new->size = size;
+    new->used = 0;
+
+    return new;
+}
+
+void *arena_alloc(arena *a, size_t size)
+{
+    arena_block *block;
+    void *start;
+
+    if (a == NULL)
+        return NULL;
+
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    // Move along to the next block that has room, reusing the blocks kept by
+    // arena_reset() before allocating any more.
+    block = a->current;
+    while (block != NULL && block->size - block->used < size)
+    {
+        if (block->next == NULL || block->next->size < size)
+            break;
+
+        block = block->next;
+        block->used = 0;
+    }
+
+    if (block == NULL || block->size - block->used < size)
+    {
+        block = arena_new_block(size > a->block_size ? size : a->block_size);
+        if (block == NULL)
+            return NULL;
+
+        // Slot the new block in after the current one, so any blocks that
+        // were kept further along the chain still get reused.
+        if (a->current == NULL)
+            a->first = block;
+        else
+        {
+            block->next = a->current->next;
+            a->current->next = block;
+        }
+    }
+
+    a->current = block;
+
+    start = ARENA_BLOCK_DATA(block) + block->used;
+    block->used += size;
+
+    return start;
+}
+
+void *arena_calloc(arena *a, size_t count, size_t size)
+{
+    void *new;
+
+    if (size != 0 && count > (size_t)-1 / size)
+        return NULL;
+
+    new = arena_alloc(a, count * size);
+    if (new != NULL)
+        memset(new, 0, count * size);
+
+    return new;
+}
+
+void arena_reset(arena *a)
+{
+    if (a == NULL)
+        return;
+
+    a->current = a->first;
+    if (a->current != NULL)
+        a->current->used = 0;
+}
+
+arena *arena_thread(void)
+{
+    if (thread_arena != NULL)
+        return thread_arena;
+
+    if (pthread_once(&arena_thread_once, arena_thread_init))
+        return NULL;
+
+    thread_arena = arena_new(0);
+    if (thread_arena != NULL)
+        pthread_setspecific(arena_thread_key, thread_arena);
+
+    return thread_arena;
+}
+
+static void arena_thread_init(void)
+{
+    pthread_key_create(&arena_thread_key, arena_thread_free);
+}
+
+static void arena_thread_free(void *doomed)
+{
+    arena_free((arena*)doomed);
+}
@@ -0,0 +1,162 @@
+/* What the chunk benches share: a clock, loading every chunk named on the
+ * command line twice, and checking and timing surfaces.
+ *
+ * Each bench is built from its own source file alone, so everything here is
+ * static.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chunk.h"
+
+/** \brief The alpha given to water, ice, leaves and glass; everything else
+  *        but air is opaque */
+#define BENCH_TRANSLUCENT 128
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static chunk *bench_load(char *path, int32_t coord_x, int32_t coord_z, int flags)
+{
+    nbt_loader ctx;
+    chunk *c;
+
+    nbt_loader_init(&ctx, NULL, flags);
+    c = chunk_new_with(&ctx, path, coord_x, coord_z);
+    nbt_loader_clear(&ctx);
+
+    return c;
+}
+
+/* Reads the coordinates of a chunk out of the last part of its path */
+static int bench_coords(char *path, int32_t *coord_x, int32_t *coord_z)
+{
+    char *name = strrchr(path, '/');
+
+    return chunk_get_coords_from_filename(name == NULL ? path : name + 1, coord_x, coord_z);
+}
+
+static void bench_alpha(uint8_t *alpha)
+{
+    int i;
+
+    for (i = 0; i < 256; i++)
+        alpha[i] = 255;
+    alpha[0] = 0;
+    alpha[8] = alpha[9] = alpha[18] = alpha[20] = alpha[79] = BENCH_TRANSLUCENT;
+}
+
+/* Loads every chunk named on the command line once plain and once with
+ * flags, skipping any that fail to load or come back without what the flags
+ * asked for. Returns how many pairs were loaded, or 0 after saying why. */
+static int bench_load_pairs(int argc, char **argv, int flags, chunk ***plain, chunk ***other)
+{
+    int32_t coord_x, coord_z;
+    int i, count = 0;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s c.x.z.dat ...\n", argv[0]);
+        return 0;
+    }
+
+    *plain = calloc(argc, sizeof(chunk*));
+    *other = calloc(argc, sizeof(chunk*));
+    if (*plain == NULL || *other == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 0;
+    }
+
+    for (i = 1; i < argc; i++)
+    {
+        if (bench_coords(argv[i], &coord_x, &coord_z))
+        {
+            fprintf(stderr, "skipping %s\n", argv[i]);
+            continue;
+        }
+
+        (*plain)[count] = bench_load(argv[i], coord_x, coord_z, 0);
+        (*other)[count] = bench_load(argv[i], coord_x, coord_z, flags);
+        if ((*plain)[count] == NULL || (*other)[count] == NULL ||
+            ((flags & CHUNK_LOAD_RUNS) && (*other)[count]->runs == NULL) ||
+            ((flags & CHUNK_LOAD_PACKED) && (*other)[count]->palettes == NULL))
+        {
+            fprintf(stderr, "skipping %s\n", argv[i]);
+            chunk_free((*plain)[count]);
+            chunk_free((*other)[count]);
+            continue;
+        }
+
+        count++;
+    }
+
+    if (count == 0)
+        fprintf(stderr, "no chunks loaded\n");
+
+    return count;
+}
+
+static void bench_free_pairs(chunk **plain, chunk **other, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        chunk_free(plain[i]);
+        chunk_free(other[i]);
+    }
+    free(plain);
+    free(other);
+}
+
+/* Builds every chunk's surface rounds times and returns how long it took */
+static double bench_surface(chunk **chunks, int count, int rounds, const uint8_t *alpha)
+{
+    double start;
+    int round, i;
+
+    start = bench_now();
+
+    for (round = 0; round < rounds; round++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            chunk_drop_surface(chunks[i]);
+            chunk_get_surface(chunks[i], alpha);
+        }
+    }
+
+    return bench_now() - start;
+}
+
+static int bench_same_surface(chunk_surface *a, chunk_surface *b)
+{
+    int i;
+
+    if (a == NULL || b == NULL || a->layer_count != b->layer_count)
+        return 0;
+
+    // Column by column, since the columns have padding
+    for (i = 0; i < CHUNK_SIZE_AREA; i++)
+        if (a->columns[i].top.y != b->columns[i].top.y ||
+            a->columns[i].top.block != b->columns[i].top.block ||
+            a->columns[i].top.light != b->columns[i].top.light ||
+            a->columns[i].first != b->columns[i].first ||
+            a->columns[i].count != b->columns[i].count)
+            return 0;
+
+    return memcmp(a->layers, b->layers, a->layer_count * sizeof(chunk_surface_layer)) == 0;
+}
+
+#endif
@@ -0,0 +1,140 @@
+/* Compares how much room chunks take, and how fast they surface, with their
+ * arrays kept as they come against packed with palettes.
+ *
+ *     bench/palette_bench world/0/0/c.0.0.dat world/0/1/c.0.1.dat ...
+ *
+ * Every chunk is loaded twice, once plain and once with CHUNK_LOAD_PACKED,
+ * and every column of every array has to read back the same before
+ * anything is timed.
+ */
+#include "bench.h"
+
+/** \brief How many times each chunk is surfaced */
+#define PALETTE_BENCH_ROUNDS 200
+
+/* Checks every column of every per-block array, and a few single values */
+static int same_arrays(chunk *a, chunk *b)
+{
+    uint8_t *left, *right;
+    int array, coord_x, coord_z, coord_y, same = 1;
+
+    if (a->height != b->height)
+        return 0;
+
+    left = malloc(a->height * 2);
+    if (left == NULL)
+        return 0;
+    right = left + a->height;
+
+    for (array = 0; array < CHUNK_BLOCK_ARRAY_COUNT && same; array++)
+    {
+        for (coord_x = 0; coord_x < CHUNK_SIZE_X && same; coord_x++)
+        {
+            for (coord_z = 0; coord_z < CHUNK_SIZE_Z && same; coord_z++)
+            {
+                if (chunk_get_column(a, array, coord_x, coord_z, left) ||
+                    chunk_get_column(b, array, coord_x, coord_z, right) ||
+                    memcmp(left, right, a->height) != 0)
+                    same = 0;
+
+                for (coord_y = coord_x; coord_y < a->height && same; coord_y += 17)
+                    if (chunk_get_value(b, array, coord_x, coord_y, coord_z) != left[coord_y])
+                        same = 0;
+            }
+        }
+    }
+
+    free(left);
+    return same;
+}
+
+int main(int argc, char **argv)
+{
+    chunk **plain, **packed;
+    uint64_t plain_counts[256], packed_counts[256], plain_size = 0, packed_size = 0;
+    uint64_t widths[CHUNK_BLOCK_ARRAY_COUNT][CHUNK_PALETTE_MAX_BITS + 1];
+    uint8_t alpha[256];
+    double plain_time, packed_time, load_time;
+    int32_t coord_x, coord_z;
+    int i, array, bits, count;
+
+    count = bench_load_pairs(argc, argv, CHUNK_LOAD_PACKED, &plain, &packed);
+    if (count == 0)
+        return 1;
+
+    bench_alpha(alpha);
+    memset(widths, 0, sizeof(widths));
+    memset(plain_counts, 0, sizeof(plain_counts));
+    memset(packed_counts, 0, sizeof(packed_counts));
+
+    for (i = 0; i < count; i++)
+    {
+        plain_size += plain[i]->size;
+        packed_size += packed[i]->size;
+        for (array = 0; array < CHUNK_BLOCK_ARRAY_COUNT; array++)
+            widths[array][packed[i]->palettes[array].bits]++;
+    }
+
+    // Both representations have to agree before their speed means anything
+    for (i = 0; i < count; i++)
+    {
+        if (!same_arrays(plain[i], packed[i]))
+        {
+            fprintf(stderr, "arrays disagree on chunk %d\n", i);
+            return 1;
+        }
+
+        if (!bench_same_surface(chunk_get_surface(plain[i], alpha), chunk_get_surface(packed[i], alpha)))
+        {
+            fprintf(stderr, "surfaces disagree on chunk %d\n", i);
+            return 1;
+        }
+
+        chunk_census(plain[i], plain_counts);
+        chunk_census(packed[i], packed_counts);
+    }
+
+    if (memcmp(plain_counts, packed_counts, sizeof(plain_counts)) != 0)
+    {
+        fprintf(stderr, "census disagrees\n");
+        return 1;
+    }
+
+    printf("%d chunks\n", count);
+    printf("plain:  %8.1f KB/chunk\n", plain_size / 1024.0 / count);
+    printf("packed: %8.1f KB/chunk (%.2fx smaller)\n", packed_size / 1024.0 / count, (double)plain_size / packed_size);
+
+    for (array = 0; array < CHUNK_BLOCK_ARRAY_COUNT; array++)
+    {
+        printf("array %d widths:", array);
+        for (bits = 0; bits <= CHUNK_PALETTE_MAX_BITS; bits++)
+            if (widths[array][bits] > 0)
+                printf(" %d bits x%llu", bits, (unsigned long long)widths[array][bits]);
+        printf("\n");
+    }
+
+    // What packing costs on top of loading
+    load_time = bench_now();
+    for (i = 1; i < argc; i++)
+        if (!bench_coords(argv[i], &coord_x, &coord_z))
+            chunk_free(bench_load(argv[i], coord_x, coord_z, NBT_BUFFER_TRUSTED));
+    plain_time = bench_now() - load_time;
+
+    load_time = bench_now();
+    for (i = 1; i < argc; i++)
+        if (!bench_coords(argv[i], &coord_x, &coord_z))
+            chunk_free(bench_load(argv[i], coord_x, coord_z, NBT_BUFFER_TRUSTED | CHUNK_LOAD_PACKED));
+    packed_time = bench_now() - load_time;
+
+    printf("load    plain:  %8.3f us/chunk\n", plain_time * 1e6 / count);
+    printf("load    packed: %8.3f us/chunk\n", packed_time * 1e6 / count);
+
+    plain_time = bench_surface(plain, count, PALETTE_BENCH_ROUNDS, alpha);
+    packed_time = bench_surface(packed, count, PALETTE_BENCH_ROUNDS, alpha);
+    printf("surface plain:  %8.3f us/chunk\n", plain_time * 1e6 / ((double)count * PALETTE_BENCH_ROUNDS));
+    printf("surface packed: %8.3f us/chunk (%.2fx)\n", packed_time * 1e6 / ((double)count * PALETTE_BENCH_ROUNDS), plain_time / packed_time);
+
+    bench_free_pairs(plain, packed, count);
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+/* Compares counting and surfacing chunks block by block against doing it a
+ * run at a time.
+ *
+ *     bench/runs_bench world/0/0/c.0.0.dat world/0/1/c.0.1.dat ...
+ *
+ * Every chunk is loaded twice, once plain and once with CHUNK_LOAD_RUNS, and
+ * the two must agree on the census and the surface before anything is
+ * timed.
+ */
+#include "bench.h"
+
+/** \brief How many times each chunk is counted and surfaced */
+#define RUNS_BENCH_ROUNDS 200
+
+/* Counts every chunk rounds times and returns how long it took */
+static double census(chunk **chunks, int count, int rounds, uint64_t *counts)
+{
+    double start;
+    int round, i;
+
+    memset(counts, 0, 256 * sizeof(uint64_t));
+    start = bench_now();
+
+    for (round = 0; round < rounds; round++)
+        for (i = 0; i < count; i++)
+            chunk_census(chunks[i], counts);
+
+    return bench_now() - start;
+}
+
+int main(int argc, char **argv)
+{
+    chunk **plain, **runs;
+    uint64_t plain_counts[256], run_counts[256], run_total = 0, blocks = 0;
+    uint8_t alpha[256];
+    double plain_time, run_time, build_time;
+    int i, count;
+
+    count = bench_load_pairs(argc, argv, CHUNK_LOAD_RUNS, &plain, &runs);
+    if (count == 0)
+        return 1;
+
+    bench_alpha(alpha);
+    for (i = 0; i < count; i++)
+    {
+        blocks += CHUNK_SIZE_AREA * plain[i]->height;
+        run_total += runs[i]->runs->count;
+    }
+
+    // Both representations have to agree before their speed means anything
+    census(plain, count, 1, plain_counts);
+    census(runs, count, 1, run_counts);
+    if (memcmp(plain_counts, run_counts, sizeof(plain_counts)) != 0)
+    {
+        fprintf(stderr, "census disagrees\n");
+        return 1;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (!bench_same_surface(chunk_get_surface(plain[i], alpha), chunk_get_surface(runs[i], alpha)))
+        {
+            fprintf(stderr, "surfaces disagree on chunk %d\n", i);
+            return 1;
+        }
+    }
+
+    // What it costs to build the runs in the first place
+    build_time = bench_now();
+    for (i = 0; i < count; i++)
+    {
+        chunk_get_runs(plain[i]);
+        chunk_drop_runs(plain[i]);
+    }
+    build_time = bench_now() - build_time;
+
+    printf("%d chunks, %.1f runs per column\n", count, (double)run_total / (count * CHUNK_SIZE_AREA));
+    printf("building runs: %8.3f us/chunk\n", build_time * 1e6 / count);
+
+    plain_time = census(plain, count, RUNS_BENCH_ROUNDS, plain_counts);
+    run_time = census(runs, count, RUNS_BENCH_ROUNDS, run_counts);
+    printf("census  blocks: %8.3f ns/block\n", plain_time * 1e9 / ((double)blocks * RUNS_BENCH_ROUNDS));
+    printf("census  runs:   %8.3f ns/block (%.2fx)\n", run_time * 1e9 / ((double)blocks * RUNS_BENCH_ROUNDS), plain_time / run_time);
+
+    plain_time = bench_surface(plain, count, RUNS_BENCH_ROUNDS, alpha);
+    run_time = bench_surface(runs, count, RUNS_BENCH_ROUNDS, alpha);
+    printf("surface blocks: %8.3f us/chunk\n", plain_time * 1e6 / ((double)count * RUNS_BENCH_ROUNDS));
+    printf("surface runs:   %8.3f us/chunk (%.2fx)\n", run_time * 1e6 / ((double)count * RUNS_BENCH_ROUNDS), plain_time / run_time);
+
+    bench_free_pairs(plain, runs, count);
+
+    return 0;
+}
@@ -0,0 +1,184 @@
+/* Compares the ASCII fast path of utf8_to_wchar() against the plain decoder.
+ *
+ * The corpus is every tag name and TAG_String in the NBT files given on the
+ * command line, so it looks like what the readers actually decode:
+ *
+ *     bench/utf8_bench world/level.dat world/0/0/c.0.0.dat ...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+
+#include "nbt_buffer.h"
+#include "nbt_stream.h"
+#include "utf8.h"
+
+/** \brief How many times the corpus is decoded by each decoder */
+#define UTF8_BENCH_ROUNDS 2000
+
+/** \brief The longest entry that is kept */
+#define UTF8_BENCH_MAX_LENGTH 4096
+
+typedef struct
+{
+    char   *data;       // Every entry, one after another
+    size_t  length;     // How many bytes of data are used
+    size_t  capacity;   // How many bytes data has room for
+    size_t *ends;       // Where each entry ends in data
+    size_t  count;      // How many entries there are
+    size_t  room;       // How many entries ends has room for
+} corpus;
+
+static int corpus_add(corpus *c, const char *utf8, size_t length)
+{
+    if (length == 0 || length > UTF8_BENCH_MAX_LENGTH)
+        return 0;
+
+    while (c->length + length > c->capacity)
+    {
+        c->capacity = c->capacity == 0 ? 65536 : c->capacity * 2;
+        c->data = realloc(c->data, c->capacity);
+        if (c->data == NULL)
+            return (-1);
+    }
+
+    if (c->count == c->room)
+    {
+        c->room = c->room == 0 ? 1024 : c->room * 2;
+        c->ends = realloc(c->ends, c->room * sizeof(size_t));
+        if (c->ends == NULL)
+            return (-1);
+    }
+
+    memcpy(c->data + c->length, utf8, length);
+    c->length += length;
+    c->ends[c->count++] = c->length;
+
+    return 0;
+}
+
+static int add_name(void *user, const char *name, uint16_t name_length)
+{
+    if (name != NULL && corpus_add(user, name, name_length))
+        return NBT_STREAM_STOP;
+
+    return NBT_STREAM_CONTINUE;
+}
+
+static int add_list(void *user, const char *name, uint16_t name_length, uint8_t child_tag_type, int32_t length)
+{
+    return add_name(user, name, name_length);
+}
+
+static int add_scalar(void *user, const char *name, uint16_t name_length, uint8_t tag_type, u_tag_payload *value)
+{
+    return add_name(user, name, name_length);
+}
+
+static int add_byte_array(void *user, const char *name, uint16_t name_length, const uint8_t *data, int32_t length)
+{
+    return add_name(user, name, name_length);
+}
+
+static int add_string(void *user, const char *name, uint16_t name_length, const char *utf8, int32_t length)
+{
+    if (add_name(user, name, name_length) != NBT_STREAM_CONTINUE ||
+        corpus_add(user, utf8, length))
+        return NBT_STREAM_STOP;
+
+    return NBT_STREAM_CONTINUE;
+}
+
+static int add_scalar_array(void *user, const char *name, uint16_t name_length, uint8_t child_tag_type, const uint8_t *raw, int32_t length)
+{
+    return add_name(user, name, name_length);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Decodes the whole corpus rounds times and returns how long it took */
+static double run(corpus *c, wchar_t *out, int flags, int rounds, size_t *checksum)
+{
+    double start;
+    size_t i, begin;
+    int round;
+
+    *checksum = 0;
+    start = now();
+
+    for (round = 0; round < rounds; round++)
+    {
+        for (i = 0, begin = 0; i < c->count; begin = c->ends[i], i++)
+            *checksum += utf8_to_wchar(c->data + begin, c->ends[i] - begin, out, UTF8_BENCH_MAX_LENGTH, flags);
+        *checksum += out[0];
+    }
+
+    return now() - start;
+}
+
+int main(int argc, char **argv)
+{
+    nbt_stream_handler handler =
+    {
+        add_name, NULL, add_list, NULL, add_scalar, add_byte_array,
+        add_string, add_scalar_array,
+    };
+    wchar_t fast[UTF8_BENCH_MAX_LENGTH], slow[UTF8_BENCH_MAX_LENGTH];
+    corpus c = {NULL, 0, 0, NULL, 0, 0};
+    nbt_buffer *buf;
+    double fast_time, slow_time;
+    size_t i, begin, fast_length, slow_length, fast_sum, slow_sum;
+    int j;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s file.dat ...\n", argv[0]);
+        return 1;
+    }
+
+    for (j = 1; j < argc; j++)
+    {
+        buf = nbt_buffer_open(argv[j]);
+        if (buf == NULL || nbt_stream(buf, &handler, &c))
+            fprintf(stderr, "skipping %s\n", argv[j]);
+        nbt_buffer_free(buf);
+    }
+
+    if (c.count == 0)
+    {
+        fprintf(stderr, "no names or strings found\n");
+        return 1;
+    }
+
+    // Both decoders have to agree before their speed means anything
+    for (i = 0, begin = 0; i < c.count; begin = c.ends[i], i++)
+    {
+        fast_length = utf8_to_wchar(c.data + begin, c.ends[i] - begin, fast, UTF8_BENCH_MAX_LENGTH, 0);
+        slow_length = utf8_to_wchar(c.data + begin, c.ends[i] - begin, slow, UTF8_BENCH_MAX_LENGTH, UTF8_SCALAR);
+        if (fast_length != slow_length || memcmp(fast, slow, fast_length * sizeof(wchar_t)) != 0)
+        {
+            fprintf(stderr, "decoders disagree on entry %zu\n", i);
+            return 1;
+        }
+    }
+
+    slow_time = run(&c, slow, UTF8_SCALAR, UTF8_BENCH_ROUNDS, &slow_sum);
+    fast_time = run(&c, fast, 0, UTF8_BENCH_ROUNDS, &fast_sum);
+
+    printf("%zu entries, %zu bytes, %d rounds\n", c.count, c.length, UTF8_BENCH_ROUNDS);
+    printf("scalar: %8.3f ns/byte\n", slow_time * 1e9 / ((double)c.length * UTF8_BENCH_ROUNDS));
+    printf("ascii:  %8.3f ns/byte\n", fast_time * 1e9 / ((double)c.length * UTF8_BENCH_ROUNDS));
+    printf("speedup: %.2fx%s\n", slow_time / fast_time, fast_sum == slow_sum ? "" : " (checksums differ!)");
+
+    free(c.data);
+    free(c.ends);
+    return 0;
+}
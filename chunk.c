@@ -6,273 +6,929 @@
 #include <math.h>
 #include <stddef.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define CHUNK_SSE2
+#endif
+
 #include "chunk.h"
+#include "chunk_pool.h"
 #include "nbt.h"
 #include "read_nbt.h"
-#include "hashtable.h"
+#include "nbt_select.h"
 #include "maths.h"
 
-int chunk_errno = 0;
+__thread int chunk_errno = 0;
+int chunk_load_flags = 0;
+const uint8_t *chunk_load_alpha = NULL;
+
+// These are the only arrays we need out of the file, in the order of
+// chunk_array_index. We're gonna do some tricky pointer math here to assign
+// each payload to the appropriate member of the chunk.
+static const tag_name_addr_map chunk_level_data[CHUNK_ARRAY_COUNT] = {
+    {"Level/SkyLight", offsetof(chunk, skylight), 4},
+    {"Level/Data", offsetof(chunk, blockdata), 4},
+    {"Level/BlockLight", offsetof(chunk, blocklight), 4},
+    {"Level/Blocks", offsetof(chunk, blocks), 8},
+    {"Level/HeightMap", offsetof(chunk, heightmap), 0},
+};
+
+static int chunk_select_layout(nbt_buffer *buf, chunk_layout *layout, int *positioned);
+static int32_t chunk_surface_highest(chunk *c, uint8_t coord_x, uint8_t coord_z);
+static int32_t chunk_run_length(const uint8_t *p, int32_t length);
+static void chunk_opacity_mask(const uint8_t *alpha, uint64_t *opaque);
+static void chunk_opacity_fill(uint64_t *column, int32_t coord_y, int32_t length);
+
+// The light at a Y coordinate in a pair of expanded columns, packed the way a
+// chunk_surface_layer keeps it, or 0 above the top of the chunk
+#define CHUNK_SURFACE_LIGHT(c, sky, block, coord_y) \
+    ((coord_y) < (int32_t)(c)->height ? (sky)[coord_y] << 4 | (block)[coord_y] : 0)
+
+// Where a block sits in a per-block array, counting blocks rather than bytes
+#define CHUNK_BLOCK_INDEX(c, coord_x, coord_y, coord_z) \
+    (((size_t)(coord_x) * CHUNK_SIZE_Z + (coord_z)) * (c)->height + (coord_y))
+
+// One of a chunk's unpacked arrays, by its chunk_array_index
+#define CHUNK_RAW_ARRAY(c, array) (*(uint8_t**)((char*)(c) + chunk_level_data[array].offset))
+
+// Whether a chunk has one of its per-block arrays, packed or not
+#define CHUNK_HAS_ARRAY(c, array) ((c)->palettes != NULL || CHUNK_RAW_ARRAY(c, array) != NULL)
 
 chunk *chunk_new(char *filepath, int32_t coord_x, int32_t coord_z)
 {
-    gzFile file = Z_NULL;
+    nbt_loader ctx;
     chunk *new;
-    nbt_tag *tag;
-    int i;
-    wchar_t *tag_name;
-    struct hashtable *hash;
-    void *payload;
-    int64_t height = -1;
-    tag_name_addr_map *map;
-
-    // We don't need these any more, but I'll keep them here in case we do
-    /*
-    static wchar_t *expected_tags[] = {
-        L"SkyLight",
-        L"LastUpdate",
-        L"TerrainPopulated",
-        L"Data",
-        L"Blocks",
-        L"Entities",
-        L"HeightMap",
-        L"TileEntities",
-        L"xPos",
-        L"zPos",
-        L"BlockLight",
-        NULL,
-    };
-    */
-    
-    // We're gonna do some tricky pointer math here to save us some unnecessary
-    // hash lookups.
-    static tag_name_addr_map tags_4bit_level_data[] = {
-        {L"SkyLight", offsetof(chunk, skylight)},
-        {L"Data", offsetof(chunk, blockdata)},
-        {L"BlockLight", offsetof(chunk, blocklight)},
-        {NULL, 0},
-    };
-
-    static tag_name_addr_map tags_8bit_level_data[] = {
-        {L"Blocks", offsetof(chunk, blocks)},
-        {NULL, 0},
-    };
-
-    extern int chunk_errno, nbt_read_error;
-
-    // Allocate memory for the chunk
-    new = calloc(1, sizeof(chunk));
-    if (new == NULL)
+
+    nbt_loader_init(&ctx, NULL, chunk_load_flags);
+    ctx.alpha = chunk_load_alpha;
+    new = chunk_new_with(&ctx, filepath, coord_x, coord_z);
+    chunk_errno = ctx.chunk_error;
+    nbt_loader_clear(&ctx);
+
+    return new;
+}
+
+chunk *chunk_new_with(nbt_loader *ctx, char *filepath, int32_t coord_x, int32_t coord_z)
+{
+    chunk *new;
+    chunk_pool *pool;
+    nbt_buffer *buffer;
+    uint8_t *payload;
+    int i, found, positioned = 1, packed;
+    int64_t height = -1, chunk_height = -1;
+    size_t size, lengths[CHUNK_ARRAY_COUNT];
+    const tag_name_addr_map *map;
+    chunk_layout layout;
+    chunk_palette palettes[CHUNK_BLOCK_ARRAY_COUNT];
+
+    extern __thread int nbt_read_error;
+
+    ctx->error = NBT_READ_OK;
+
+    // Inflate the whole file in one go, into the buffer this thread keeps
+    // for the purpose. It's sized from the gzip trailer, so it only grows
+    // when a file is larger than any before it.
+    pool = chunk_pool_thread();
+    buffer = chunk_pool_buffer(pool);
+    if (buffer == NULL)
     {
-        chunk_errno = CHUNK_ERR_OOM;
+        ctx->error = NBT_READ_OUT_OF_MEM;
+        ctx->chunk_error = CHUNK_ERR_OOM;
         return NULL;
     }
 
-    // Initialize the chunk
-    new->height = -1;
-    new->coord_x = coord_x;
-    new->coord_z = coord_z;
-    new->blocks = NULL;
-    new->heightmap = NULL;
-    new->blockdata = NULL;
-    new->skylight = NULL;
-    new->blocklight = NULL;
-
-    // Open the file
-    file = gzopen(filepath, "r");
-    if (file == Z_NULL)
+    if (nbt_buffer_load(buffer, filepath, ctx->flags))
     {
-        chunk_errno = CHUNK_ERR_INPUT;
-        goto chunk_new_cleanup;
+        ctx->error = nbt_read_error;
+        ctx->chunk_error = CHUNK_ERR_INPUT;
+        return NULL;
     }
 
-    // Read the tag
-    new->data = nbt_read(file, 0);
-
-    gzclose(file);
-    file = Z_NULL;
-
-    if (new->data == NULL)
+    // Nearly every chunk is laid out the same way, and the decoder compiled
+    // from schemas/chunk.schema reads those without looking anything up. The
+    // rest go through nbt_select(), which decides what counts as an error.
+    if (chunk_layout_decode(buffer, &layout) != 0)
     {
-        chunk_errno = CHUNK_ERR_TAG;
-        goto chunk_new_cleanup;
+        buffer->position = 0;
+
+        found = chunk_select_layout(buffer, &layout, &positioned);
+        if (found < 0)
+        {
+            ctx->error = nbt_read_error;
+            ctx->chunk_error = CHUNK_ERR_TAG;
+            goto chunk_new_cleanup;
+        }
+        else if (found == 0)
+        {
+            // Not a single thing we wanted lives under Level
+            ctx->chunk_error = CHUNK_ERR_TAG_FORMAT;
+            goto chunk_new_cleanup;
+        }
     }
 
-    // Get the hash out of the tag (and make sure the tag is a TAG_Compound)
-    hash = nbt_payload(new->data, TAG_Compound);
-    if (hash == NULL)
+    if (chunk_get_coords_from_filename(filepath, &coord_x, &coord_z))
+        goto chunk_new_coord_error;
+
+    // Ensure the coordinates found in the filename and the coordinates in the
+    // level data match
+    if (!positioned || coord_x != layout.x_pos || coord_z != layout.z_pos)
     {
-        chunk_errno = CHUNK_ERR_TAG;
+        ctx->chunk_error = CHUNK_ERR_CONSIST;
         goto chunk_new_cleanup;
     }
 
-    // If the root node has a null name, grab its child
-    if (wcsncmp(new->data->name, L"(null)", 7) == 0)
+    // Derive the height of the chunk and make sure the heights are consistent
+    // between different types of data. Meanwhile, add up how much room the
+    // arrays will take once they're copied out, or packed.
+    packed = (ctx->flags & CHUNK_LOAD_PACKED) != 0;
+    size = CHUNK_ALIGN(sizeof(chunk));
+    if (packed)
+        size += CHUNK_ALIGN(sizeof(palettes));
+
+    for (i = 0; i < CHUNK_ARRAY_COUNT; i++)
     {
-        tag = hashtable_remove(hash, L"Level");
-        if (tag == NULL)
+        map = chunk_level_data + i;
+
+        if (layout.arrays[i] == NULL)
         {
-            chunk_errno = CHUNK_ERR_TAG;
+            // Only the per-block arrays are mandatory
+            if (map->bits == 0)
+                continue;
+
+            ctx->chunk_error = CHUNK_ERR_HEIGHT;
             goto chunk_new_cleanup;
         }
-        nbt_free_tag(new->data);
-        new->data = tag;
+
+        // A per-column array is read a byte per column, so one too short to
+        // have them all is left out, as if it were missing
+        if (map->bits == 0 && layout.lengths[i] < CHUNK_SIZE_AREA)
+        {
+            layout.arrays[i] = NULL;
+            continue;
+        }
+
+        if (map->bits != 0)
+        {
+            height = layout.lengths[i] / CHUNK_SIZE_AREA * 8 / map->bits;
+
+            if (chunk_height == -1)
+                chunk_height = height;
+            else if (chunk_height != height)
+            {
+                ctx->chunk_error = CHUNK_ERR_HEIGHT;
+                goto chunk_new_cleanup;
+            }
+        }
+
+        lengths[i] = layout.lengths[i];
+        if (packed && map->bits != 0)
+            lengths[i] = chunk_palette_measure(palettes + i, layout.arrays[i], CHUNK_SIZE_AREA * chunk_height, map->bits);
+
+        size += CHUNK_ALIGN(lengths[i]);
     }
 
-    // Make sure the root tag is named Level
-    if (wcsncmp(new->data->name, L"Level", 6) != 0)
+    // The chunk and its arrays share one block, each starting on a cache
+    // line, so nothing else from the file needs to be kept. Chunks are
+    // mostly the same size, so the block is usually one a chunk freed
+    // earlier.
+    new = chunk_pool_alloc(pool, size);
+    if (new == NULL)
     {
-        chunk_errno = CHUNK_ERR_TAG_FORMAT;
+        ctx->chunk_error = CHUNK_ERR_OOM;
         goto chunk_new_cleanup;
     }
 
-    if (chunk_get_coords_from_filename(filepath, &(new->coord_x), &(new->coord_z)))
-        goto chunk_new_coord_error;
+    memset(new, 0, sizeof(chunk));
+    new->coord_x = coord_x;
+    new->coord_z = coord_z;
+    new->height = chunk_height;
+    new->size = size;
 
-    // Ensure the coordinates found in the filename and the coordinates in the
-    // level data match
+    payload = (uint8_t*)new + CHUNK_ALIGN(sizeof(chunk));
+    if (packed)
+    {
+        new->palettes = (chunk_palette*)payload;
+        memcpy(new->palettes, palettes, sizeof(palettes));
+        payload += CHUNK_ALIGN(sizeof(palettes));
+    }
 
-    // Check X coordinate.
-    tag = nbt_hash_search(new->data, L"xPos");
-    payload = nbt_payload(tag, TAG_Int);
-    if (payload == NULL || new->coord_x != *(int32_t*)payload)
+    for (i = 0; i < CHUNK_ARRAY_COUNT; i++)
     {
-        chunk_errno = CHUNK_ERR_CONSIST;
-        goto chunk_new_cleanup;
+        if (layout.arrays[i] == NULL)
+            continue;
+
+        if (packed && chunk_level_data[i].bits != 0)
+        {
+            chunk_palette_pack(new->palettes + i, layout.arrays[i], CHUNK_SIZE_AREA * chunk_height, chunk_level_data[i].bits, payload);
+            payload += CHUNK_ALIGN(lengths[i]);
+            continue;
+        }
+
+        memcpy(payload, layout.arrays[i], layout.lengths[i]);
+
+        // Assigns the payload to the appropriate member of the struct
+        *(uint8_t**)((char*)new + chunk_level_data[i].offset) = payload;
+        payload += CHUNK_ALIGN(layout.lengths[i]);
     }
 
-    // Check Z coordinate. 
-    tag = nbt_hash_search(new->data, L"zPos");
-    payload = nbt_payload(tag, TAG_Int);
-    if (payload == NULL || new->coord_z != *(int32_t*)payload)
+    // If they can't be built now, they can still be built later. The runs
+    // go first, since the opacity is quicker to build from them.
+    if (ctx->flags & CHUNK_LOAD_RUNS)
+        chunk_get_runs(new);
+
+    if ((ctx->flags & CHUNK_LOAD_OPACITY) && ctx->alpha != NULL)
+        chunk_get_opacity(new, ctx->alpha);
+
+    ctx->chunk_error = CHUNK_ERR_OK;
+    return new;
+
+chunk_new_coord_error:
+    ctx->chunk_error = CHUNK_ERR_COORDS;
+    // XXX FALLTHROUGH
+
+chunk_new_cleanup:
+    return NULL;
+}
+
+/* Fills in a chunk_layout with nbt_select(), for chunks the compiled decoder
+ * gave up on. Returns what nbt_select() did; positioned is cleared if xPos or
+ * zPos is missing. */
+static int chunk_select_layout(nbt_buffer *buf, chunk_layout *layout, int *positioned)
+{
+    nbt_selection wanted[CHUNK_SELECT_COUNT];
+    int i, found;
+
+    memset(layout, 0, sizeof(*layout));
+
+    wanted[CHUNK_SELECT_X_POS].path = "Level/xPos";
+    wanted[CHUNK_SELECT_X_POS].type = TAG_Int;
+    wanted[CHUNK_SELECT_Z_POS].path = "Level/zPos";
+    wanted[CHUNK_SELECT_Z_POS].type = TAG_Int;
+    for (i = 0; i < CHUNK_ARRAY_COUNT; i++)
     {
-        chunk_errno = CHUNK_ERR_CONSIST;
-        goto chunk_new_cleanup;
+        wanted[CHUNK_SELECT_LEVEL_DATA + i].path = chunk_level_data[i].path;
+        wanted[CHUNK_SELECT_LEVEL_DATA + i].type = TAG_Byte_Array;
     }
 
-    // Derive the height of the chunk and make sure the heights are consistent
-    // between different types of data
+    found = nbt_select(buf, wanted, CHUNK_SELECT_COUNT);
+    if (found <= 0)
+        return found;
 
-    // 4-bit data types
-    i = 0;
-    for (;;)
+    for (i = 0; i < CHUNK_ARRAY_COUNT; i++)
     {
-        map = tags_4bit_level_data + i++;
-        if (map->key == NULL)
-            break;
+        layout->arrays[i] = nbt_selection_payload(buf, wanted + CHUNK_SELECT_LEVEL_DATA + i);
+        layout->lengths[i] = wanted[CHUNK_SELECT_LEVEL_DATA + i].length;
+    }
 
-        tag = nbt_hash_search(new->data, map->key);
-        if (tag->meta == NULL)
-        {
-            chunk_errno = CHUNK_ERR_HEIGHT;
-            goto chunk_new_cleanup;
-        }
+    *positioned = wanted[CHUNK_SELECT_X_POS].found && wanted[CHUNK_SELECT_Z_POS].found;
+    layout->x_pos = wanted[CHUNK_SELECT_X_POS].value.int_payload;
+    layout->z_pos = wanted[CHUNK_SELECT_Z_POS].value.int_payload;
+
+    return found;
+}
+
+void chunk_free(void *doomed)
+{
+    chunk *c = (chunk*)doomed;
+    if (doomed == NULL)
+        return;
+
+    if (c->surface != NULL)
+        free(c->surface);
+
+    if (c->runs != NULL)
+        free(c->runs);
+
+    if (c->opacity != NULL)
+        free(c->opacity);
+
+    // Everything else a chunk holds lives in the same block, which goes back
+    // to the pool of the thread freeing it
+    chunk_pool_release(chunk_pool_thread(), c, c->size);
+}
+
+chunk_surface *chunk_get_surface(chunk *c, const uint8_t *alpha)
+{
+    chunk_surface_column columns[CHUNK_SIZE_AREA], *column;
+    uint32_t tops[CHUNK_SIZE_AREA];
+    chunk_surface_layer *layer;
+    chunk_surface *surface;
+    const chunk_run *run, *end, *below;
+    const uint8_t *slice;
+    uint8_t *sky, *block, *scratch, coord_x, coord_z;
+    int32_t coord_y, highest, bottom;
+    uint32_t count = 0;
+
+    if (c == NULL || alpha == NULL)
+        return NULL;
+
+    if (c->surface != NULL)
+        return c->surface;
+
+    if (c->heightmap == NULL || !CHUNK_HAS_ARRAY(c, CHUNK_ARRAY_BLOCKS) ||
+        !CHUNK_HAS_ARRAY(c, CHUNK_ARRAY_SKYLIGHT) ||
+        !CHUNK_HAS_ARRAY(c, CHUNK_ARRAY_BLOCKLIGHT) || c->height == 0)
+        return NULL;
 
-        payload = nbt_payload(tag, TAG_Byte_Array);
-        if (payload == NULL)
+    // Room for a column of sky light, a column of block light and a column
+    // of blocks from a packed chunk, a byte per block
+    sky = malloc(c->height * 3);
+    if (sky == NULL)
+        return NULL;
+    block = sky + c->height;
+    scratch = block + c->height;
+
+    // Drill down into each column until we hit a block with no transparency,
+    // and count the translucent blocks above it. A column with nothing
+    // opaque ends at Y 0 showing the block at Y 1, as the renderers always
+    // have.
+    for (coord_z = 0; coord_z < CHUNK_SIZE_Z; coord_z++)
+    {
+        for (coord_x = 0; coord_x < CHUNK_SIZE_X; coord_x++)
         {
-            chunk_errno = CHUNK_ERR_HEIGHT;
-            goto chunk_new_cleanup;
+            column = columns + coord_z * CHUNK_SIZE_X + coord_x;
+            highest = chunk_surface_highest(c, coord_x, coord_z);
+            column->first = count;
+            column->count = 0;
+
+            if (c->runs != NULL)
+            {
+                // Step down a run at a time, counting the visible blocks of
+                // every run above the top
+                run = chunk_column_runs(c, coord_x, coord_z, &end);
+                for (below = end - 1; below->y > highest; below--)
+                    ;
+
+                column->top.y = 0;
+                for (;; below--)
+                {
+                    coord_y = CHUNK_RUN_TOP(below) < highest ? CHUNK_RUN_TOP(below) : highest;
+                    if (coord_y == 0)
+                        break;
+
+                    if (alpha[below->block] == 255)
+                    {
+                        column->top.y = coord_y;
+                        column->top.block = below->block;
+                        break;
+                    }
+
+                    if (alpha[below->block] > 0)
+                        column->count += coord_y - (below->y > 0 ? below->y : 1) + 1;
+
+                    if (below == run)
+                        break;
+                }
+
+                // Without anything opaque, the block at Y 1 shows
+                if (column->top.y == 0)
+                    column->top.block = highest > 0 && run->length == 1 ? run[1].block : run->block;
+
+                tops[coord_z * CHUNK_SIZE_X + coord_x] = below - c->runs->runs;
+                count += column->count;
+                continue;
+            }
+
+            slice = chunk_column_blocks(c, coord_x, coord_z, scratch);
+
+            column->top.block = slice[0];
+            for (coord_y = highest; coord_y > 0; coord_y--)
+            {
+                column->top.block = slice[coord_y];
+                if (alpha[slice[coord_y]] == 255)
+                    break;
+            }
+
+            column->top.y = coord_y;
+
+            for (coord_y++; coord_y <= highest; coord_y++)
+                if (alpha[slice[coord_y]] > 0)
+                    column->count++;
+
+            count += column->count;
         }
+    }
 
-        height = tag->meta->length / CHUNK_SIZE_AREA * 2;
+    surface = malloc(sizeof(chunk_surface) + count * sizeof(chunk_surface_layer));
+    if (surface == NULL)
+    {
+        free(sky);
+        return NULL;
+    }
 
-        if (new->height == -1)
-            new->height = height;
-        else if (new->height != height)
+    memcpy(surface->columns, columns, sizeof(columns));
+    surface->layers = (chunk_surface_layer*)(surface + 1);
+    surface->layer_count = count;
+
+    // Now go back up, recording the light above the top and each
+    // translucent block above it
+    for (coord_z = 0; coord_z < CHUNK_SIZE_Z; coord_z++)
+    {
+        for (coord_x = 0; coord_x < CHUNK_SIZE_X; coord_x++)
         {
-            chunk_errno = CHUNK_ERR_HEIGHT;
-            goto chunk_new_cleanup;
+            column = surface->columns + coord_z * CHUNK_SIZE_X + coord_x;
+            highest = chunk_surface_highest(c, coord_x, coord_z);
+            layer = surface->layers + column->first;
+
+            chunk_get_column(c, CHUNK_ARRAY_SKYLIGHT, coord_x, coord_z, sky);
+            chunk_get_column(c, CHUNK_ARRAY_BLOCKLIGHT, coord_x, coord_z, block);
+            column->top.light = CHUNK_SURFACE_LIGHT(c, sky, block, column->top.y + 1);
+
+            if (c->runs != NULL)
+            {
+                // Invisible runs, usually air, are passed over whole
+                chunk_column_runs(c, coord_x, coord_z, &end);
+                for (run = c->runs->runs + tops[coord_z * CHUNK_SIZE_X + coord_x]; run < end && run->y <= highest; run++)
+                {
+                    if (CHUNK_RUN_TOP(run) <= column->top.y)
+                        continue;
+
+                    if (alpha[run->block] == 0)
+                        continue;
+
+                    bottom = run->y > column->top.y ? run->y : column->top.y + 1;
+                    for (coord_y = bottom; coord_y <= CHUNK_RUN_TOP(run) && coord_y <= highest; coord_y++)
+                    {
+                        layer->y = coord_y;
+                        layer->block = run->block;
+                        layer->light = CHUNK_SURFACE_LIGHT(c, sky, block, coord_y + 1);
+                        layer++;
+                    }
+                }
+                continue;
+            }
+
+            slice = chunk_column_blocks(c, coord_x, coord_z, scratch);
+
+            for (coord_y = column->top.y + 1; coord_y <= highest; coord_y++)
+            {
+                if (alpha[slice[coord_y]] == 0)
+                    continue;
+
+                layer->y = coord_y;
+                layer->block = slice[coord_y];
+                layer->light = CHUNK_SURFACE_LIGHT(c, sky, block, coord_y + 1);
+                layer++;
+            }
         }
+    }
 
-        // Assigns the payload to the appropriate member of the struct
-        *(uint8_t**)((char*)new + map->offset) = payload;
+    free(sky);
+
+    c->surface = surface;
+    return surface;
+}
+
+void chunk_drop_surface(chunk *c)
+{
+    if (c == NULL || c->surface == NULL)
+        return;
+
+    free(c->surface);
+    c->surface = NULL;
+}
+
+chunk_runs *chunk_get_runs(chunk *c)
+{
+    chunk_runs *runs;
+    chunk_run *run;
+    const uint8_t *slice;
+    uint8_t *scratch = NULL;
+    uint32_t count = 0, i;
+    int32_t coord_y, length;
+
+    if (c == NULL)
+        return NULL;
+
+    if (c->runs != NULL)
+        return c->runs;
+
+    if (!CHUNK_HAS_ARRAY(c, CHUNK_ARRAY_BLOCKS) || c->height == 0 || c->height > UINT16_MAX)
+        return NULL;
+
+    if (c->palettes != NULL && (scratch = malloc(c->height)) == NULL)
+        return NULL;
+
+    // Count the runs first, so they can all go in one allocation. The
+    // columns are contiguous, so they're walked in the order they're stored.
+    for (i = 0; i < CHUNK_SIZE_AREA; i++)
+    {
+        slice = chunk_column_blocks(c, i / CHUNK_SIZE_Z, i % CHUNK_SIZE_Z, scratch);
+        for (coord_y = 0; coord_y < c->height; coord_y += chunk_run_length(slice + coord_y, c->height - coord_y))
+            count++;
     }
 
-    // 8-bit data types
-    i = 0;
-    for (;;)
+    runs = malloc(sizeof(chunk_runs) + count * sizeof(chunk_run));
+    if (runs == NULL)
     {
-        map = tags_8bit_level_data + i++;
-        if (map->key == NULL)
-            break;
+        free(scratch);
+        return NULL;
+    }
 
-        tag = nbt_hash_search(new->data, map->key);
-        if (tag == NULL)
+    runs->runs = (chunk_run*)(runs + 1);
+    runs->count = count;
+
+    run = runs->runs;
+    for (i = 0; i < CHUNK_SIZE_AREA; i++)
+    {
+        slice = chunk_column_blocks(c, i % CHUNK_SIZE_X, i / CHUNK_SIZE_X, scratch);
+        runs->first[i] = run - runs->runs;
+
+        for (coord_y = 0; coord_y < c->height; coord_y += length, run++)
         {
-            chunk_errno = CHUNK_ERR_HEIGHT;
-            goto chunk_new_cleanup;
+            length = chunk_run_length(slice + coord_y, c->height - coord_y);
+            run->y = coord_y;
+            run->length = length;
+            run->block = slice[coord_y];
         }
+    }
+    runs->first[CHUNK_SIZE_AREA] = count;
+
+    free(scratch);
 
-        if (tag->meta == NULL)
+    c->runs = runs;
+    return runs;
+}
+
+void chunk_drop_runs(chunk *c)
+{
+    if (c == NULL || c->runs == NULL)
+        return;
+
+    free(c->runs);
+    c->runs = NULL;
+}
+
+chunk_opacity *chunk_get_opacity(chunk *c, const uint8_t *alpha)
+{
+    chunk_opacity *opacity;
+    const chunk_run *run, *end;
+    const uint8_t *slice;
+    uint8_t *scratch = NULL, opaque[256];
+    uint64_t *column, word;
+    uint32_t i, w, words, bit, length;
+
+    if (c == NULL || alpha == NULL)
+        return NULL;
+
+    if (c->opacity != NULL)
+        return c->opacity;
+
+    if (!CHUNK_HAS_ARRAY(c, CHUNK_ARRAY_BLOCKS) || c->height == 0)
+        return NULL;
+
+    if (c->palettes != NULL && c->runs == NULL && (scratch = malloc(c->height)) == NULL)
+        return NULL;
+
+    words = (c->height + CHUNK_OPACITY_WORD_BITS - 1) / CHUNK_OPACITY_WORD_BITS;
+    opacity = calloc(1, sizeof(chunk_opacity) + CHUNK_SIZE_AREA * words * sizeof(uint64_t));
+    if (opacity == NULL)
+    {
+        free(scratch);
+        return NULL;
+    }
+
+    opacity->words = words;
+    opacity->columns = (uint64_t*)(opacity + 1);
+    chunk_opacity_mask(alpha, opacity->opaque);
+
+    for (i = 0; i < 256; i++)
+        opaque[i] = alpha[i] == 255;
+
+    for (i = 0; i < CHUNK_SIZE_AREA; i++)
+    {
+        column = opacity->columns + i * words;
+
+        // Runs set their bits a word at a time
+        if (c->runs != NULL)
         {
-            chunk_errno = CHUNK_ERR_HEIGHT;
-            goto chunk_new_cleanup;
+            for (run = chunk_column_runs(c, i % CHUNK_SIZE_X, i / CHUNK_SIZE_X, &end); run < end; run++)
+                if (alpha[run->block] == 255)
+                    chunk_opacity_fill(column, run->y, run->length);
+            continue;
         }
 
-        payload = nbt_payload(tag, TAG_Byte_Array);
-        if (payload == NULL)
+        // Otherwise, gather a word's worth of blocks at a time
+        slice = chunk_column_blocks(c, i % CHUNK_SIZE_X, i / CHUNK_SIZE_X, scratch);
+        for (w = 0; w < words; w++, slice += CHUNK_OPACITY_WORD_BITS)
         {
-            chunk_errno = CHUNK_ERR_HEIGHT;
-            goto chunk_new_cleanup;
+            length = c->height - w * CHUNK_OPACITY_WORD_BITS;
+            if (length > CHUNK_OPACITY_WORD_BITS)
+                length = CHUNK_OPACITY_WORD_BITS;
+
+            for (bit = 0, word = 0; bit < length; bit++)
+                word |= (uint64_t)opaque[slice[bit]] << bit;
+            column[w] = word;
         }
+    }
 
-        height = tag->meta->length / CHUNK_SIZE_AREA;
+    free(scratch);
 
-        if (new->height == -1)
-            new->height = height;
-        else if (new->height != height)
-        {
-            chunk_errno = CHUNK_ERR_HEIGHT;
-            goto chunk_new_cleanup;
-        }
+    c->opacity = opacity;
+    return opacity;
+}
 
-        // Assigns the payload to the appropriate member of the struct
-        *(uint8_t**)((char*)new + map->offset) = payload;
+int32_t chunk_opacity_top(chunk *c, uint8_t coord_x, uint8_t coord_z, int32_t coord_y)
+{
+    const uint64_t *column;
+    uint64_t word;
+    int32_t w;
+
+    if (c == NULL || c->opacity == NULL || coord_x >= CHUNK_SIZE_X || coord_z >= CHUNK_SIZE_Z || coord_y < 0)
+        return (-1);
+
+    if (coord_y >= (int32_t)c->height)
+        coord_y = c->height - 1;
+
+    column = c->opacity->columns + (coord_z * CHUNK_SIZE_X + coord_x) * c->opacity->words;
+
+    // Drop the bits above coord_y, then take the highest one left
+    w = coord_y / CHUNK_OPACITY_WORD_BITS;
+    word = column[w] & (~(uint64_t)0 >> (CHUNK_OPACITY_WORD_BITS - 1 - coord_y % CHUNK_OPACITY_WORD_BITS));
+    for (;;)
+    {
+        if (word != 0)
+            return w * CHUNK_OPACITY_WORD_BITS + CHUNK_OPACITY_WORD_BITS - 1 - __builtin_clzll(word);
+
+        if (w == 0)
+            return (-1);
+
+        word = column[--w];
     }
+}
 
-    /*
-    new->blockdata = nbt_payload(nbt_hash_search(new->data, L"Data"), TAG_Byte_Array);
-    new->skylight = nbt_payload(nbt_hash_search(new->data, L"SkyLight"), TAG_Byte_Array);
-    new->blocklight = nbt_payload(nbt_hash_search(new->data, L"BlockLight"), TAG_Byte_Array);
-    new->blocks = nbt_payload(nbt_hash_search(new->data, L"Blocks"), TAG_Byte_Array);
-    */
-    new->heightmap = nbt_payload(nbt_hash_search(new->data, L"HeightMap"), TAG_Byte_Array);
+int chunk_opacity_exposed(chunk *c, uint8_t coord_x, uint8_t coord_z, uint64_t *out)
+{
+    const uint64_t *column, *sides[4];
+    uint64_t above, below, covered;
+    uint32_t w, words;
+    int i;
 
-    chunk_errno = CHUNK_ERR_OK;
-    return new;
+    if (c == NULL || c->opacity == NULL || out == NULL ||
+        coord_x >= CHUNK_SIZE_X || coord_z >= CHUNK_SIZE_Z)
+        return (-1);
 
-chunk_new_coord_error:
-    chunk_errno = CHUNK_ERR_COORDS;
-    // XXX FALLTHROUGH
+    words = c->opacity->words;
+    column = c->opacity->columns + (coord_z * CHUNK_SIZE_X + coord_x) * words;
 
-chunk_new_cleanup:
-    if (file != Z_NULL)
-        gzclose(file);
-    
-    if (new != NULL)
-        chunk_free(new);
+    // Columns past the edge of the chunk are taken to be empty
+    sides[0] = coord_x > 0 ? column - words : NULL;
+    sides[1] = coord_x < CHUNK_SIZE_X - 1 ? column + words : NULL;
+    sides[2] = coord_z > 0 ? column - CHUNK_SIZE_X * words : NULL;
+    sides[3] = coord_z < CHUNK_SIZE_Z - 1 ? column + CHUNK_SIZE_X * words : NULL;
 
-    return NULL;
+    for (w = 0; w < words; w++)
+    {
+        // Shift the column down and up a block to line each block up with
+        // the ones above and below it, carrying across words
+        above = column[w] >> 1 | (w + 1 < words ? column[w + 1] << (CHUNK_OPACITY_WORD_BITS - 1) : 0);
+        below = column[w] << 1 | (w > 0 ? column[w - 1] >> (CHUNK_OPACITY_WORD_BITS - 1) : 1);
+
+        covered = above & below;
+        for (i = 0; i < 4; i++)
+            covered &= sides[i] != NULL ? sides[i][w] : 0;
+
+        out[w] = column[w] & ~covered;
+    }
+
+    return 0;
 }
 
-void chunk_free(void *doomed)
+const chunk_run *chunk_column_runs(chunk *c, uint8_t coord_x, uint8_t coord_z, const chunk_run **end)
 {
-    chunk *c = (chunk*)doomed;
-    if (doomed == NULL)
-        return;
+    uint32_t i;
+
+    if (c == NULL || c->runs == NULL || coord_x >= CHUNK_SIZE_X || coord_z >= CHUNK_SIZE_Z)
+        return NULL;
+
+    i = coord_z * CHUNK_SIZE_X + coord_x;
+    if (end != NULL)
+        *end = c->runs->runs + c->runs->first[i + 1];
+
+    return c->runs->runs + c->runs->first[i];
+}
+
+const chunk_run *chunk_run_find(const chunk_run *run, const chunk_run *end, int32_t coord_y)
+{
+    const chunk_run *middle;
+
+    if (run == NULL || run >= end || coord_y < 0)
+        return NULL;
+
+    // Binary search for the last run starting at or below coord_y
+    while (end - run > 1)
+    {
+        middle = run + (end - run) / 2;
+        if (middle->y <= coord_y)
+            run = middle;
+        else
+            end = middle;
+    }
+
+    return coord_y <= CHUNK_RUN_TOP(run) ? run : NULL;
+}
+
+int chunk_census(chunk *c, uint64_t *counts)
+{
+    const uint8_t *slice;
+    uint8_t *scratch;
+    uint32_t i, coord_y;
+
+    if (c == NULL || counts == NULL || !CHUNK_HAS_ARRAY(c, CHUNK_ARRAY_BLOCKS))
+        return (-1);
+
+    if (c->runs != NULL)
+    {
+        for (i = 0; i < c->runs->count; i++)
+            counts[c->runs->runs[i].block] += c->runs->runs[i].length;
+        return 0;
+    }
+
+    if (c->palettes == NULL)
+    {
+        for (i = 0; i < CHUNK_SIZE_AREA * c->height; i++)
+            counts[c->blocks[i]]++;
+        return 0;
+    }
+
+    // A packed chunk is counted a column at a time
+    scratch = malloc(c->height);
+    if (scratch == NULL)
+        return (-1);
+
+    for (i = 0; i < CHUNK_SIZE_AREA; i++)
+    {
+        slice = chunk_column_blocks(c, i / CHUNK_SIZE_Z, i % CHUNK_SIZE_Z, scratch);
+        for (coord_y = 0; coord_y < c->height; coord_y++)
+            counts[slice[coord_y]]++;
+    }
+
+    free(scratch);
+    return 0;
+}
+
+void chunk_expand_nibbles(const uint8_t *packed, size_t length, uint8_t *out)
+{
+    size_t i = 0;
+#ifdef CHUNK_SSE2
+    __m128i block, low, high, mask;
+
+    // Split 16 bytes into their low and high nibbles, then interleave the
+    // two so each nibble lands in the byte for its own block
+    mask = _mm_set1_epi8(0x0F);
+    for (; i + 16 <= length; i += 16)
+    {
+        block = _mm_loadu_si128((const __m128i*)(packed + i));
+        low = _mm_and_si128(block, mask);
+        high = _mm_and_si128(_mm_srli_epi16(block, 4), mask);
+        _mm_storeu_si128((__m128i*)(out + i * 2), _mm_unpacklo_epi8(low, high));
+        _mm_storeu_si128((__m128i*)(out + i * 2 + 16), _mm_unpackhi_epi8(low, high));
+    }
+#endif
+
+    for (; i < length; i++)
+    {
+        out[i * 2] = packed[i] & 0x0F;
+        out[i * 2 + 1] = packed[i] >> 4;
+    }
+}
+
+int chunk_get_column(chunk *c, int array, uint8_t coord_x, uint8_t coord_z, uint8_t *out)
+{
+    const uint8_t *raw;
+    size_t index;
+
+    if (c == NULL || out == NULL || array < 0 || array >= CHUNK_BLOCK_ARRAY_COUNT ||
+        c->height == 0 || coord_x >= CHUNK_SIZE_X || coord_z >= CHUNK_SIZE_Z)
+        return (-1);
+
+    index = CHUNK_BLOCK_INDEX(c, coord_x, 0, coord_z);
+
+    if (c->palettes != NULL)
+    {
+        chunk_palette_decode(c->palettes + array, index, c->height, out);
+        return 0;
+    }
+
+    raw = CHUNK_RAW_ARRAY(c, array);
+    if (raw == NULL)
+        return (-1);
 
-    if (c->data != NULL)
-        nbt_free_tag(c->data);
+    if (chunk_level_data[array].bits == 8)
+        memcpy(out, raw + index, c->height);
+    else
+        chunk_expand_nibbles(raw + index / 2, c->height / 2, out);
+
+    return 0;
+}
+
+const uint8_t *chunk_column_blocks(chunk *c, uint8_t coord_x, uint8_t coord_z, uint8_t *scratch)
+{
+    if (c == NULL || coord_x >= CHUNK_SIZE_X || coord_z >= CHUNK_SIZE_Z)
+        return NULL;
+
+    if (c->palettes == NULL)
+        return c->blocks == NULL ? NULL : c->blocks + CHUNK_BLOCK_INDEX(c, coord_x, 0, coord_z);
+
+    if (scratch == NULL)
+        return NULL;
+
+    chunk_palette_decode(c->palettes + CHUNK_ARRAY_BLOCKS, CHUNK_BLOCK_INDEX(c, coord_x, 0, coord_z), c->height, scratch);
+    return scratch;
+}
+
+int chunk_get_value(chunk *c, int array, uint8_t coord_x, int32_t coord_y, uint8_t coord_z)
+{
+    const uint8_t *raw;
+    size_t index;
+
+    if (c == NULL || array < 0 || array >= CHUNK_BLOCK_ARRAY_COUNT ||
+        coord_x >= CHUNK_SIZE_X || coord_z >= CHUNK_SIZE_Z ||
+        coord_y < 0 || coord_y >= (int32_t)c->height)
+        return (-1);
+
+    index = CHUNK_BLOCK_INDEX(c, coord_x, coord_y, coord_z);
+
+    if (c->palettes != NULL)
+        return chunk_palette_get(c->palettes + array, index);
+
+    raw = CHUNK_RAW_ARRAY(c, array);
+    if (raw == NULL)
+        return (-1);
+
+    if (chunk_level_data[array].bits == 8)
+        return raw[index];
+
+    return raw[index / 2] >> ((index & 1) << 2) & 0x0F;
+}
+
+/* How many bytes from the start of p are the same as the first, looking no
+ * further than length */
+static int32_t chunk_run_length(const uint8_t *p, int32_t length)
+{
+    int32_t i = 1;
+#ifdef CHUNK_SSE2
+    __m128i first;
+    int mask;
+
+    // Compare 16 bytes at a time against the first until one differs
+    first = _mm_set1_epi8(p[0]);
+    for (i = 0; i + 16 <= length; i += 16)
+    {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + i)), first));
+        if (mask != 0xFFFF)
+            return i + __builtin_ctz(~mask);
+    }
+#endif
+
+    for (; i < length; i++)
+        if (p[i] != p[0])
+            return i;
+
+    return length;
+}
+
+/* Sets a bit in opaque for each block type alpha makes opaque */
+static void chunk_opacity_mask(const uint8_t *alpha, uint64_t *opaque)
+{
+    int i;
+
+    memset(opaque, 0, 4 * sizeof(uint64_t));
+    for (i = 0; i < 256; i++)
+        if (alpha[i] == 255)
+            opaque[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+/* Sets length bits of a column from coord_y up, a word at a time */
+static void chunk_opacity_fill(uint64_t *column, int32_t coord_y, int32_t length)
+{
+    int32_t shift, count;
+
+    while (length > 0)
+    {
+        shift = coord_y % CHUNK_OPACITY_WORD_BITS;
+        count = CHUNK_OPACITY_WORD_BITS - shift < length ? CHUNK_OPACITY_WORD_BITS - shift : length;
+
+        column[coord_y / CHUNK_OPACITY_WORD_BITS] |= (count == CHUNK_OPACITY_WORD_BITS ? ~(uint64_t)0 : (((uint64_t)1 << count) - 1) << shift);
+        coord_y += count;
+        length -= count;
+    }
+}
+
+/* Where a column's walk down starts: its height map entry, kept inside the
+ * chunk */
+static int32_t chunk_surface_highest(chunk *c, uint8_t coord_x, uint8_t coord_z)
+{
+    int32_t highest = c->heightmap[coord_z * CHUNK_SIZE_X + coord_x];
 
-    free(c);
+    return highest < (int32_t)c->height ? highest : (int32_t)c->height - 1;
 }
 
 int chunk_get_coords_from_filename(char *filename, int32_t *x_coord, int32_t *z_coord)
 {
     char *position_start, *position_end;
     int pos_len;
-    extern int base36_errno;
+    extern __thread int base36_errno;
 
     position_start = strchr(filename, '.');
     if (position_start == NULL)
@@ -0,0 +1,183 @@
+#include <string.h>
+
+#include "chunk.h"
+#include "chunk_palette.h"
+
+// Reads the index of a block. Widths are powers of two, so an index never
+// straddles two bytes.
+#define CHUNK_PALETTE_INDEX(p, i) \
+    ((p)->data[(i) * (p)->bits >> 3] >> ((i) * (p)->bits & 7) & ((1 << (p)->bits) - 1))
+
+// How many 4-bit values chunk_palette_pack() expands at once
+#define CHUNK_PALETTE_STRIDE 256
+
+static void chunk_palette_pack_bytes(const uint8_t *index, const uint8_t *values, size_t count, uint8_t bits, uint8_t *out);
+
+size_t chunk_palette_measure(chunk_palette *p, const uint8_t *raw, size_t count, uint8_t bits)
+{
+    uint8_t seen[256];
+    uint32_t nibbles = 0;
+    size_t i;
+    int value;
+
+    memset(seen, 0, sizeof(seen));
+    if (bits == 8)
+        for (i = 0; i < count; i++)
+            seen[raw[i]] = 1;
+    else
+    {
+        // Light is usually all over the place, so stop as soon as every
+        // value has turned up
+        for (i = 0; i < count / 2 && nibbles != 0xFFFF; i++)
+            nibbles |= 1 << (raw[i] & 0x0F) | 1 << (raw[i] >> 4);
+
+        for (value = 0; value < 16; value++)
+            seen[value] = nibbles >> value & 1;
+    }
+
+    p->data = NULL;
+    p->size = 0;
+    p->identity = 1;
+    for (value = 0; value < 256; value++)
+    {
+        if (!seen[value])
+            continue;
+
+        if (value != p->size)
+            p->identity = 0;
+        p->values[p->size++] = value;
+    }
+
+    // Round the width up to a power of two, which costs a little room but
+    // lets whole bytes be decoded at once
+    for (p->bits = 0; (1 << p->bits) < p->size; p->bits = p->bits == 0 ? 1 : p->bits * 2)
+        ;
+
+    return (count * p->bits + 7) / 8;
+}
+
+void chunk_palette_pack(chunk_palette *p, const uint8_t *raw, size_t count, uint8_t bits, uint8_t *out)
+{
+    uint8_t index[256], expanded[CHUNK_PALETTE_STRIDE];
+    size_t i, length;
+
+    if (p->bits == 0)
+        return;
+
+    p->data = out;
+
+    // Nothing to do but copy when the indices are the values themselves
+    if (p->identity && p->bits == bits)
+    {
+        memcpy(out, raw, (count * bits + 7) / 8);
+        return;
+    }
+
+    for (i = 0; i < p->size; i++)
+        index[p->values[i]] = i;
+
+    if (bits == 8)
+    {
+        chunk_palette_pack_bytes(index, raw, count, p->bits, out);
+        return;
+    }
+
+    // 4-bit values are expanded a stretch at a time first. A stretch always
+    // packs to a whole number of bytes.
+    for (i = 0; i < count; i += CHUNK_PALETTE_STRIDE)
+    {
+        length = count - i < CHUNK_PALETTE_STRIDE ? count - i : CHUNK_PALETTE_STRIDE;
+        chunk_expand_nibbles(raw + i / 2, (length + 1) / 2, expanded);
+        chunk_palette_pack_bytes(index, expanded, length, p->bits, out + i * p->bits / 8);
+    }
+}
+
+void chunk_palette_decode(const chunk_palette *p, size_t first, size_t count, uint8_t *out)
+{
+    const uint8_t *data;
+    size_t i = 0;
+    int shift, per_byte, mask;
+
+    if (p->bits == 0)
+    {
+        memset(out, p->values[0], count);
+        return;
+    }
+
+    if (p->bits == 8)
+        memcpy(out, p->data + first, count);
+    else if (p->bits == 4 && first % 2 == 0 && count % 2 == 0)
+        chunk_expand_nibbles(p->data + first / 2, count / 2, out);
+    else
+    {
+        // Read off the leading indices one at a time until the rest start on
+        // a byte, then take a byte's worth at a time
+        per_byte = 8 / p->bits;
+        mask = (1 << p->bits) - 1;
+        for (; i < count && (first + i) % per_byte != 0; i++)
+            out[i] = CHUNK_PALETTE_INDEX(p, first + i);
+
+        data = p->data + (first + i) / per_byte;
+        for (; i + per_byte <= count; data++)
+            for (shift = 0; shift < 8; shift += p->bits)
+                out[i++] = *data >> shift & mask;
+
+        for (; i < count; i++)
+            out[i] = CHUNK_PALETTE_INDEX(p, first + i);
+    }
+
+    if (!p->identity)
+        for (i = 0; i < count; i++)
+            out[i] = p->values[out[i]];
+}
+
+uint8_t chunk_palette_get(const chunk_palette *p, size_t index)
+{
+    if (p->bits == 0)
+        return p->values[0];
+
+    return p->values[CHUNK_PALETTE_INDEX(p, index)];
+}
+
+/* Packs values a byte per block into indices bits wide. Each width gets a
+ * loop of its own, which fills a whole byte per turn. */
+static void chunk_palette_pack_bytes(const uint8_t *index, const uint8_t *values, size_t count, uint8_t bits, uint8_t *out)
+{
+    size_t i = 0;
+    int shift;
+
+    switch (bits)
+    {
+        case 8:
+            for (; i < count; i++)
+                *out++ = index[values[i]];
+            break;
+
+        case 4:
+            for (; i + 2 <= count; i += 2)
+                *out++ = index[values[i]] | index[values[i + 1]] << 4;
+            break;
+
+        case 2:
+            for (; i + 4 <= count; i += 4)
+                *out++ = index[values[i]] | index[values[i + 1]] << 2 |
+                         index[values[i + 2]] << 4 | index[values[i + 3]] << 6;
+            break;
+
+        case 1:
+            for (; i + 8 <= count; i += 8)
+                *out++ = index[values[i]] | index[values[i + 1]] << 1 |
+                         index[values[i + 2]] << 2 | index[values[i + 3]] << 3 |
+                         index[values[i + 4]] << 4 | index[values[i + 5]] << 5 |
+                         index[values[i + 6]] << 6 | index[values[i + 7]] << 7;
+            break;
+    }
+
+    // A last, partly filled byte
+    if (i < count)
+    {
+        *out = 0;
+        for (shift = 0; i < count; i++, shift += bits)
+            *out |= index[values[i]] << shift;
+    }
+}
@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "chunk.h"
+#include "chunk_pool.h"
+
+// Which free list a size belongs to, and how large that list's blocks are
+#define CHUNK_POOL_CLASS(size) (((size) > 0 ? (size) - 1 : 0) / CHUNK_POOL_GRANULE)
+#define CHUNK_POOL_CLASS_SIZE(class) (((size_t)(class) + 1) * CHUNK_POOL_GRANULE)
+
+static void chunk_pool_thread_init(void);
+static void chunk_pool_thread_free(void *doomed);
+
+static pthread_key_t chunk_pool_key;
+static pthread_once_t chunk_pool_once = PTHREAD_ONCE_INIT;
+static __thread chunk_pool *thread_pool = NULL;
+
+// The counts of the pools whose threads have exited
+static pthread_mutex_t chunk_pool_retired_lock = PTHREAD_MUTEX_INITIALIZER;
+static chunk_pool_stats chunk_pool_retired;
+
+chunk_pool *chunk_pool_thread(void)
+{
+    if (thread_pool != NULL)
+        return thread_pool;
+
+    if (pthread_once(&chunk_pool_once, chunk_pool_thread_init))
+        return NULL;
+
+    thread_pool = calloc(1, sizeof(chunk_pool));
+    if (thread_pool != NULL)
+        pthread_setspecific(chunk_pool_key, thread_pool);
+
+    return thread_pool;
+}
+
+void *chunk_pool_alloc(chunk_pool *pool, size_t size)
+{
+    size_t class = CHUNK_POOL_CLASS(size);
+    void *block;
+
+    if (pool == NULL)
+        return posix_memalign(&block, CHUNK_ALIGNMENT, size) == 0 ? block : NULL;
+
+    pool->allocations++;
+
+    if (class >= CHUNK_POOL_CLASSES)
+    {
+        if (posix_memalign(&block, CHUNK_ALIGNMENT, size) != 0)
+            return NULL;
+
+        pool->in_use += size;
+    }
+    else
+    {
+        block = pool->free[class];
+        if (block != NULL)
+        {
+            pool->free[class] = *(void**)block;
+            pool->pooled -= CHUNK_POOL_CLASS_SIZE(class);
+            pool->reused++;
+        }
+        else if (posix_memalign(&block, CHUNK_ALIGNMENT, CHUNK_POOL_CLASS_SIZE(class)) != 0)
+            return NULL;
+
+        pool->in_use += CHUNK_POOL_CLASS_SIZE(class);
+    }
+
+    if (pool->in_use > pool->high_water)
+        pool->high_water = pool->in_use;
+
+    return block;
+}
+
+void chunk_pool_release(chunk_pool *pool, void *block, size_t size)
+{
+    size_t class = CHUNK_POOL_CLASS(size);
+
+    if (block == NULL)
+        return;
+
+    if (pool == NULL)
+    {
+        free(block);
+        return;
+    }
+
+    if (class >= CHUNK_POOL_CLASSES)
+    {
+        pool->in_use -= size;
+        free(block);
+        return;
+    }
+
+    *(void**)block = pool->free[class];
+    pool->free[class] = block;
+    pool->in_use -= CHUNK_POOL_CLASS_SIZE(class);
+    pool->pooled += CHUNK_POOL_CLASS_SIZE(class);
+}
+
+nbt_buffer *chunk_pool_buffer(chunk_pool *pool)
+{
+    if (pool == NULL)
+        return NULL;
+
+    // Left empty, like nbt_buffer_open_flags() leaves it; nbt_buffer_load()
+    // grows it to fit each file and never shrinks it
+    if (pool->buffer == NULL)
+        pool->buffer = calloc(1, sizeof(nbt_buffer));
+
+    return pool->buffer;
+}
+
+void chunk_pool_get_stats(chunk_pool_stats *stats)
+{
+    pthread_mutex_lock(&chunk_pool_retired_lock);
+    *stats = chunk_pool_retired;
+    pthread_mutex_unlock(&chunk_pool_retired_lock);
+
+    if (thread_pool != NULL)
+    {
+        stats->threads++;
+        stats->allocations += thread_pool->allocations;
+        stats->reused += thread_pool->reused;
+        stats->high_water += thread_pool->high_water;
+        stats->pooled += thread_pool->pooled;
+    }
+}
+
+void chunk_pool_trim(chunk_pool *pool)
+{
+    void *block;
+    int i;
+
+    if (pool == NULL)
+        return;
+
+    for (i = 0; i < CHUNK_POOL_CLASSES; i++)
+    {
+        while ((block = pool->free[i]) != NULL)
+        {
+            pool->free[i] = *(void**)block;
+            free(block);
+        }
+    }
+    pool->pooled = 0;
+
+    if (pool->buffer != NULL)
+    {
+        nbt_buffer_free(pool->buffer);
+        pool->buffer = NULL;
+    }
+}
+
+static void chunk_pool_thread_init(void)
+{
+    pthread_key_create(&chunk_pool_key, chunk_pool_thread_free);
+}
+
+static void chunk_pool_thread_free(void *doomed)
+{
+    chunk_pool *pool = doomed;
+
+    // Its free lists go with it, so only what it did is kept
+    pthread_mutex_lock(&chunk_pool_retired_lock);
+    chunk_pool_retired.threads++;
+    chunk_pool_retired.allocations += pool->allocations;
+    chunk_pool_retired.reused += pool->reused;
+    chunk_pool_retired.high_water += pool->high_water;
+    pthread_mutex_unlock(&chunk_pool_retired_lock);
+
+    chunk_pool_trim(pool);
+    free(doomed);
+    thread_pool = NULL;
+}
@@ -8,8 +8,15 @@ int parse_commandline_options(int argc, char **argv, configuration *config)
 {
     static struct option long_options[] =
     {
+        {"all",     no_argument,       0, 'a'},
         {"help",    no_argument,       0, 'h'},
+        {"index",   no_argument,       0, 'i'},
+        {"threads", required_argument, 0, 'j'},
         {"output",  required_argument, 0, 'o'},
+        {"packed",  no_argument,       0, 'p'},
+        {"stats",   no_argument,       0, 's'},
+        {"tiles",   required_argument, 0, 'r'},
+        {"trusted", no_argument,       0, 't'},
         {"version", no_argument,       0, 'v'},
         {0, 0, 0, 0}
     };
@@ -18,22 +25,60 @@ int parse_commandline_options(int argc, char **argv, configuration *config)
     int            dateSize, filenameSize;
     struct timeval tv;
     struct tm      *tm;
-    int32_t tile_x, tile_z;
+    int32_t tile_x, tile_z, corners[4];
 
     // Set defaults for the configuration
     (*config).output_filename = (char*)0;
     (*config).free_output_filename = 0;
+    (*config).trusted = 0;
+    (*config).index = 0;
+    (*config).packed = 0;
+    (*config).stats = 0;
+    (*config).batch = 0;
+    (*config).threads = 0;
+    (*config).has_tile_rect = 0;
 
-    while ((c = getopt_long(argc, argv, "ho:v", long_options, &option_index)) != -1)
+    while ((c = getopt_long(argc, argv, "ahij:o:pr:stv", long_options, &option_index)) != -1)
     {
         switch (c)
         {
+            case 'a':
+                (*config).batch = 1;
+                break;
             case 'h':
                 return CONFIG_ERROR_PRINT_HELP;
                 break;
+            case 'i':
+                (*config).index = 1;
+                break;
+            case 'j':
+                if (sscanf(optarg, "%d", &(*config).threads) != 1 || (*config).threads < 0)
+                    return CONFIG_ERROR_THREADS;
+                break;
             case 'o':
                 (*config).output_filename = (char*)optarg;
                 break;
+            case 'p':
+                (*config).packed = 1;
+                break;
+            case 'r':
+                if (sscanf(optarg, "%d,%d,%d,%d", corners, corners + 1, corners + 2, corners + 3) != 4)
+                    return CONFIG_ERROR_TILE_RECT;
+
+                // Either pair of opposite corners will do
+                config->tile_rect[0] = corners[0] < corners[2] ? corners[0] : corners[2];
+                config->tile_rect[1] = corners[1] < corners[3] ? corners[1] : corners[3];
+                config->tile_rect[2] = corners[0] < corners[2] ? corners[2] : corners[0];
+                config->tile_rect[3] = corners[1] < corners[3] ? corners[3] : corners[1];
+                (*config).has_tile_rect = 1;
+                (*config).batch = 1;
+                break;
+            case 's':
+                (*config).stats = 1;
+                break;
+            case 't':
+                (*config).trusted = 1;
+                break;
             case 'v':
                 return CONFIG_ERROR_PRINT_VERSION;
                 break;
@@ -61,7 +106,12 @@ int parse_commandline_options(int argc, char **argv, configuration *config)
             config->tile_z = 0;
         }
 
-        if ((*config).output_filename == (char*)0)
+        // A batch goes into a directory rather than a single file
+        if ((*config).output_filename == (char*)0 && (*config).batch)
+        {
+            (*config).output_filename = CONFIG_BATCH_DIRECTORY;
+        }
+        else if ((*config).output_filename == (char*)0)
         {
             gettimeofday(&tv, NULL);
 
@@ -99,9 +149,11 @@ char *config_error_message(int error_code)
         "HELP",
         "VERSION",
         "Could not retrieve timestamp",
+        "The tile rectangle should be given as X1,Z1,X2,Z2.",
+        "The number of threads should be 0 or more.",
     };
 
-    if (error_code < 1 || error_code > 5)
+    if (error_code < 1 || error_code > 7)
         return (char*)0;
 
     return error_messages[error_code - 1];
@@ -30,6 +30,20 @@ create_hashtable(unsigned int minsize,
                  unsigned int (*hashf) (void*),
                  int (*eqf) (void*,void*),
                  void (*vff)(void*))
+{
+    return create_hashtable_with_allocator(minsize, hashf, eqf, vff,
+                                           NULL, NULL, NULL);
+}
+
+/*****************************************************************************/
+struct hashtable *
+create_hashtable_with_allocator(unsigned int minsize,
+                 unsigned int (*hashf) (void*),
+                 int (*eqf) (void*,void*),
+                 void (*vff)(void*),
+                 void *(*allocf)(void*,size_t),
+                 void (*deallocf)(void*,void*),
+                 void *ctx)
 {
     struct hashtable *h;
     unsigned int pindex, size = primes[0];
@@ -39,10 +53,16 @@ create_hashtable(unsigned int minsize,
     for (pindex=0; pindex < prime_table_length; pindex++) {
         if (primes[pindex] > minsize) { size = primes[pindex]; break; }
     }
-    h = (struct hashtable *)malloc(sizeof(struct hashtable));
+    if (NULL != allocf)
+        h = (struct hashtable *)allocf(ctx, sizeof(struct hashtable));
+    else
+        h = (struct hashtable *)malloc(sizeof(struct hashtable));
     if (NULL == h) return NULL; /*oom*/
-    h->table = (struct entry **)malloc(sizeof(struct entry*) * size);
-    if (NULL == h->table) { free(h); return NULL; } /*oom*/
+    h->alloc_func   = allocf;
+    h->dealloc_func = deallocf;
+    h->alloc_ctx    = ctx;
+    h->table = (struct entry **)hashtable_alloc(h, sizeof(struct entry*) * size);
+    if (NULL == h->table) { hashtable_dealloc(h, h); return NULL; } /*oom*/
     memset(h->table, 0, size * sizeof(struct entry *));
     h->tablelength  = size;
     h->primeindex   = pindex;
@@ -54,6 +74,25 @@ create_hashtable(unsigned int minsize,
     return h;
 }
 
+/*****************************************************************************/
+void *
+hashtable_alloc(struct hashtable *h, size_t size)
+{
+    if (NULL != h->alloc_func)
+        return h->alloc_func(h->alloc_ctx, size);
+    return malloc(size);
+}
+
+/*****************************************************************************/
+void
+hashtable_dealloc(struct hashtable *h, void *ptr)
+{
+    if (NULL == h->alloc_func)
+        free(ptr);
+    else if (NULL != h->dealloc_func)
+        h->dealloc_func(h->alloc_ctx, ptr);
+}
+
 /*****************************************************************************/
 unsigned int
 hash(struct hashtable *h, void *k)
@@ -81,7 +120,7 @@ hashtable_expand(struct hashtable *h)
     if (h->primeindex == (prime_table_length - 1)) return 0;
     newsize = primes[++(h->primeindex)];
 
-    newtable = (struct entry **)malloc(sizeof(struct entry*) * newsize);
+    newtable = (struct entry **)hashtable_alloc(h, sizeof(struct entry*) * newsize);
     if (NULL != newtable)
     {
         memset(newtable, 0, newsize * sizeof(struct entry *));
@@ -95,11 +134,11 @@ hashtable_expand(struct hashtable *h)
                 newtable[index] = e;
             }
         }
-        free(h->table);
+        hashtable_dealloc(h, h->table);
         h->table = newtable;
     }
-    /* Plan B: realloc instead */
-    else 
+    /* Plan B: realloc instead, which only works for malloc'd tables */
+    else if (NULL == h->alloc_func)
     {
         newtable = (struct entry **)
                    realloc(h->table, newsize * sizeof(struct entry *));
@@ -122,6 +161,7 @@ hashtable_expand(struct hashtable *h)
             }
         }
     }
+    else { (h->primeindex)--; return 0; }
     h->tablelength = newsize;
     h->loadlimit   = (unsigned int) ceil(newsize * max_load_factor);
     return -1;
@@ -149,7 +189,7 @@ hashtable_insert(struct hashtable *h, void *k, void *v)
          * element may be ok. Next time we insert, we'll try expanding again.*/
         hashtable_expand(h);
     }
-    e = (struct entry *)malloc(sizeof(struct entry));
+    e = (struct entry *)hashtable_alloc(h, sizeof(struct entry));
     if (NULL == e) { --(h->entrycount); return 0; } /*oom*/
     e->h = hash(h,k);
     index = indexFor(h->tablelength,e->h);
@@ -202,8 +242,8 @@ hashtable_remove(struct hashtable *h, void *k)
             *pE = e->next;
             h->entrycount--;
             v = e->v;
-            freekey(e->k);
-            free(e);
+            freekey(h,e->k);
+            hashtable_dealloc(h, e);
             return v;
         }
         pE = &(e->next);
@@ -230,7 +270,7 @@ hashtable_destroy(struct hashtable *h, int free_values)
                 f = e; 
                 e = e->next; 
                 if (f->k != NULL)
-                    freekey(f->k); 
+                    freekey(h,f->k); 
                 if (f->v != NULL)
                 {
                     if (h->value_free_func != NULL)
@@ -238,7 +278,7 @@ hashtable_destroy(struct hashtable *h, int free_values)
                     else
                         free(f->v); 
                 }
-                free(f); 
+                hashtable_dealloc(h, f); 
             }
         }
     }
@@ -248,11 +288,11 @@ hashtable_destroy(struct hashtable *h, int free_values)
         {
             e = table[i];
             while (NULL != e)
-            { f = e; e = e->next; freekey(f->k); free(f); }
+            { f = e; e = e->next; freekey(h,f->k); hashtable_dealloc(h, f); }
         }
     }
-    free(h->table);
-    free(h);
+    hashtable_dealloc(h, h->table);
+    hashtable_dealloc(h, h);
 }
 
 unsigned int indexFor(unsigned int tablelength, unsigned int hashvalue) {
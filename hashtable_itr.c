@@ -121,13 +121,13 @@ hashtable_iterator_remove(struct hashtable_itr *itr)
     /* itr->e is now outside the hashtable */
     remember_e = itr->e;
     itr->h->entrycount--;
-    freekey(remember_e->k);
+    freekey(itr->h,remember_e->k);
 
     /* Advance the iterator, correcting the parent */
     remember_parent = itr->parent;
     ret = hashtable_iterator_advance(itr);
     if (itr->parent == remember_e) { itr->parent = remember_parent; }
-    free(remember_e);
+    hashtable_dealloc(itr->h, remember_e);
     return ret;
 }
 
@@ -0,0 +1,91 @@
+/** \file arena.h
+  * \brief A region allocator for short-lived trees of small objects
+  *
+  * An arena hands out memory from a few large blocks by bumping a pointer.
+  * Nothing allocated from an arena is ever freed on its own; the whole arena
+  * is emptied at once with arena_reset(), which keeps its blocks around so the
+  * next tree built in it needs no calls to malloc at all.
+  */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/** \brief How many bytes each block holds when the caller doesn't care. A
+  *        whole level.dat or chunk tree fits in one or two of these. */
+#define ARENA_BLOCK_SIZE 65536
+
+/** \brief Every allocation is aligned to this many bytes. */
+#define ARENA_ALIGNMENT 16
+
+/** \brief A single block of memory owned by an arena. Its data follows the
+  *        header. */
+typedef struct arena_block_s
+{
+    struct arena_block_s *next; /**< \brief The next block in the arena */
+    size_t size;                /**< \brief How many bytes of data the block
+                                  *         holds */
+    size_t used;                /**< \brief How many bytes have been handed
+                                  *         out */
+} arena_block;
+
+/** \brief A chain of blocks that allocations are carved out of. */
+typedef struct
+{
+    arena_block *first;     /**< \brief The first block in the chain */
+    arena_block *current;   /**< \brief The block being allocated from */
+    size_t block_size;      /**< \brief How large new blocks should be */
+} arena;
+
+/** \brief Creates a new, empty arena
+  * \param block_size   How many bytes to allocate per block. Pass 0 to use
+  *                     #ARENA_BLOCK_SIZE.
+  * \return A new arena, or NULL if no memory could be allocated.
+  *
+  * No blocks are allocated until the first call to arena_alloc().
+  */
+arena *arena_new(size_t block_size);
+
+/** \brief Frees an arena, its blocks and everything allocated from it
+  * \param doomed   The arena to free
+  */
+void arena_free(arena *doomed);
+
+/** \brief Allocates memory from an arena
+  * \param a    The arena to allocate from
+  * \param size How many bytes to allocate
+  * \return A pointer aligned to #ARENA_ALIGNMENT, or NULL if no memory could
+  *         be allocated.
+  *
+  * Requests larger than the arena's block size get a block of their own.
+  */
+void *arena_alloc(arena *a, size_t size);
+
+/** \brief Allocates zeroed memory from an arena
+  * \param a        The arena to allocate from
+  * \param count    The number of elements
+  * \param size     The size of each element
+  * \return A pointer to count * size zeroed bytes, or NULL on error.
+  */
+void *arena_calloc(arena *a, size_t count, size_t size);
+
+/** \brief Empties an arena in one step
+  * \param a    The arena to empty
+  *
+  * Everything allocated from the arena becomes invalid. The blocks are kept
+  * and reused by later allocations.
+  */
+void arena_reset(arena *a);
+
+/** \brief Gets the calling thread's arena
+  * \return An arena private to the calling thread, created on first use, or
+  *         NULL if no memory could be allocated.
+  *
+  * Meant for trees that only live as long as a single chunk: build the tree
+  * in this arena, use it, then arena_reset() it before the next chunk. The
+  * arena is freed when the thread exits. Never pass it to arena_free().
+  */
+arena *arena_thread(void);
+
+#endif
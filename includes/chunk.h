@@ -7,6 +7,9 @@
 #define CHUNK_H
 
 #include "nbt.h"
+#include "nbt_buffer.h"
+#include "nbt_loader.h"
+#include "chunk_palette.h"
 #include "maths.h"
 
 /** \brief The length of a chunk along the X axis, in blocks. */
@@ -16,6 +19,13 @@
 /** \brief The area of a chunk along the XZ plane, in blocks. */
 #define CHUNK_SIZE_AREA 256
 
+/** \brief The boundary each chunk and each of its arrays is aligned to, the
+  *        size of a cache line. */
+#define CHUNK_ALIGNMENT 64
+
+/** \brief Rounds a size up to a multiple of #CHUNK_ALIGNMENT. */
+#define CHUNK_ALIGN(size) (((size_t)(size) + CHUNK_ALIGNMENT - 1) & ~(size_t)(CHUNK_ALIGNMENT - 1))
+
 /** \brief Describes error codes passed by chunk_new(). */
 enum chunk_new_error_codes
 {
@@ -34,33 +44,227 @@ enum chunk_new_error_codes
     CHUNK_ERR_TAG_FORMAT, /**<      The format of the tag was incorrect. */
 };
 
+/** \brief A block seen from above, as recorded in a chunk_surface */
+typedef struct
+{
+    uint16_t y;         /**< \brief The Y coordinate of the block */
+    uint8_t block;      /**< \brief The block type */
+    uint8_t light;      /**< \brief The sky light (high nibble) and block
+                          *         light (low nibble) just above the block */
+} chunk_surface_layer;
+
+/** \brief What a single column of a chunk looks like from above */
+typedef struct
+{
+    chunk_surface_layer top;    /**< \brief The highest opaque block at or
+                                  *         below the height map. In a column
+                                  *         without one, this is the block
+                                  *         at Y 1, recorded with Y 0. */
+    uint32_t first;             /**< \brief Where the column's translucent
+                                  *         layers start in the layers of the
+                                  *         chunk_surface */
+    uint16_t count;             /**< \brief How many translucent layers lie
+                                  *         above top, up to the height map */
+} chunk_surface_column;
+
+/** \brief A summary of the top of a chunk, which is all an overhead render
+  *        needs to look at.
+  *
+  * Which blocks are opaque depends on the colors they're drawn with, so a
+  * summary is built for a table of alpha values, one per block type. A block
+  * with an alpha of 255 is opaque and one with an alpha of 0 is invisible.
+  */
+typedef struct
+{
+    chunk_surface_column columns[CHUNK_SIZE_AREA];  /**< \brief Each column,
+                                                      *         indexed by
+                                                      *         z * 16 + x */
+    chunk_surface_layer *layers;    /**< \brief Every translucent layer, from
+                                      *         the bottom of each column up,
+                                      *         in the same allocation */
+    uint32_t layer_count;           /**< \brief How many layers there are */
+} chunk_surface;
+
+/** \brief A run of identical blocks in a column, as kept by chunk_runs */
+typedef struct
+{
+    uint16_t y;         /**< \brief The Y coordinate of the lowest block */
+    uint16_t length;    /**< \brief How many blocks the run covers */
+    uint8_t block;      /**< \brief The block type */
+} chunk_run;
+
+/** \brief The Y coordinate of the highest block in a chunk_run. */
+#define CHUNK_RUN_TOP(run) ((int32_t)(run)->y + (run)->length - 1)
+
+/** \brief A chunk's blocks, run-length encoded column by column.
+  *
+  * Columns are mostly long stretches of stone, air and water, so they
+  * collapse to a few runs each, which can be skipped, counted or composited
+  * whole instead of block by block.
+  */
+typedef struct
+{
+    uint32_t first[CHUNK_SIZE_AREA + 1];    /**< \brief Where each column's
+                                              *         runs start, indexed
+                                              *         by z * 16 + x. The
+                                              *         last entry is count.
+                                              */
+    chunk_run *runs;                        /**< \brief Every run, from the
+                                              *         bottom of each column
+                                              *         up, in the same
+                                              *         allocation */
+    uint32_t count;                         /**< \brief How many runs there
+                                              *         are */
+} chunk_runs;
+
+/** \brief How many blocks of a column each word of a chunk_opacity holds */
+#define CHUNK_OPACITY_WORD_BITS 64
+
+/** \brief Which blocks of a chunk can't be seen through, a bit per block.
+  *
+  * Each column is a string of words, the lowest block in the lowest bit of
+  * the first, so a column of a chunk 128 blocks tall is a single 128-bit
+  * word. Whether a block is hidden behind its neighbours, or where the
+  * highest opaque block under some height is, then comes down to a few
+  * ANDs and shifts, or a count of leading zeros.
+  *
+  * Like a chunk_surface, it's built for a table of alpha values; only an
+  * alpha of 255 counts as opaque.
+  */
+typedef struct
+{
+    uint32_t words;         /**< \brief How many words each column takes */
+    uint64_t opaque[4];     /**< \brief The block types counted as opaque,
+                              *         a bit each, so the table it was
+                              *         built from can be told apart */
+    uint64_t *columns;      /**< \brief Every column's words, indexed by
+                              *         (z * 16 + x) * words, in the same
+                              *         allocation */
+} chunk_opacity;
+
 /** \brief Contains data about a chunk. 
   * \note Of note here is that we are storing height data, despite the fact 
   * that the maximum height is currently the same for all chunks (128.) Notch 
   * has said that he has future plans to increase the height of chunks, so 
   * we'll calculate it for every chunk to stay future-proof.
+  *
+  * A chunk is a single allocation aligned to #CHUNK_ALIGNMENT. Its byte
+  * arrays are copied out of the chunk file right after the struct, each on a
+  * cache line of its own, and nothing else from the file is kept. The block
+  * comes from the loading thread's chunk_pool, and goes back to the pool of
+  * whichever thread frees it.
+  *
+  * A chunk loaded with #CHUNK_LOAD_PACKED keeps its per-block arrays packed
+  * with palettes instead, in the same allocation, and leaves blocks,
+  * blockdata, skylight and blocklight NULL. Either kind can be read with
+  * chunk_get_column(), chunk_column_blocks() and chunk_get_value().
   */
 typedef struct
 {
-    nbt_tag *data;      /**< \brief Holds the tag data for this chunk */
+    size_t size;        /**< \brief How many bytes the chunk and its arrays
+                          *         take up together */
     int32_t coord_x;    /**< \brief The X coordinate of this chunk */
     int32_t coord_z;    /**< \brief The Z coordinate of this chunk */
     uint64_t height;    /**< \brief How tall this chunk is, in blocks */
 
     uint8_t *blocks;        /**< \brief The block types on this chunk */
-    uint8_t *heightmap;     /**< \brief The height map of this chunk */
+    uint8_t *heightmap;     /**< \brief The height map of this chunk, or NULL if
+                              *         the file had none or one too short to
+                              *         cover every column */
     uint8_t *blockdata;     /**< \brief The block data of this chunk */
     uint8_t *skylight;      /**< \brief The skylight of this chunk */
     uint8_t *blocklight;    /**< \brief The blocklight of this chunk */
+    chunk_palette *palettes;    /**< \brief The per-block arrays, packed and
+                                  *         indexed by #chunk_array_index, or
+                                  *         NULL if the chunk isn't packed */
+
+    chunk_surface *surface; /**< \brief A summary of the top of this chunk,
+                              *         built by chunk_get_surface(), or NULL
+                              *         until it's asked for */
+    chunk_runs *runs;       /**< \brief The blocks as runs, built by
+                              *         chunk_get_runs(), or NULL */
+    chunk_opacity *opacity; /**< \brief Which blocks are opaque, built by
+                              *         chunk_get_opacity(), or NULL */
 } chunk;
 
-/** \brief Contains a map between tag names and members of a chunk */
+/** \brief Contains a map between tag paths and members of a chunk */
 typedef struct
 {
-    wchar_t *key;       /**< \brief A tag name. */
+    char *path;         /**< \brief A tag path, as passed to nbt_select(). */
     uint64_t offset;    /**< \brief An offset in a chunk. */
+    uint8_t bits;       /**< \brief How many bits each block occupies in the
+                          *         tag's payload, or 0 if the payload is not
+                          *         per-block data. */
 } tag_name_addr_map;
 
+/** \brief The byte arrays read out of a chunk file, as indices into a
+  *        chunk_layout */
+enum chunk_array_index
+{
+    CHUNK_ARRAY_SKYLIGHT,   /**< \brief Level/SkyLight, 4 bits per block */
+    CHUNK_ARRAY_DATA,       /**< \brief Level/Data, 4 bits per block */
+    CHUNK_ARRAY_BLOCKLIGHT, /**< \brief Level/BlockLight, 4 bits per block */
+    CHUNK_ARRAY_BLOCKS,     /**< \brief Level/Blocks, 8 bits per block */
+    CHUNK_ARRAY_HEIGHTMAP,  /**< \brief Level/HeightMap, 1 byte per column */
+    CHUNK_ARRAY_COUNT,      /**< \brief How many arrays there are */
+};
+
+/** \brief How many of the arrays hold a value per block, which are the ones
+  *        before #CHUNK_ARRAY_HEIGHTMAP */
+#define CHUNK_BLOCK_ARRAY_COUNT CHUNK_ARRAY_HEIGHTMAP
+
+/** \brief Where the tags chunk_new() needs were found in a chunk file */
+typedef struct
+{
+    int32_t x_pos;                          /**< \brief Level/xPos */
+    int32_t z_pos;                          /**< \brief Level/zPos */
+    uint8_t *arrays[CHUNK_ARRAY_COUNT];     /**< \brief Each byte array,
+                                              *         pointing into the
+                                              *         buffer, or NULL if it
+                                              *         wasn't found */
+    int32_t lengths[CHUNK_ARRAY_COUNT];     /**< \brief The length of each
+                                              *         byte array */
+} chunk_layout;
+
+/** \name Chunk Selections
+  * \brief Where each tag chunk_new() reads lives in its nbt_selection array
+  */
+/*@{*/
+#define CHUNK_SELECT_X_POS      0   /**< \brief Level/xPos */
+#define CHUNK_SELECT_Z_POS      1   /**< \brief Level/zPos */
+#define CHUNK_SELECT_LEVEL_DATA 2   /**< \brief The first byte array */
+#define CHUNK_SELECT_COUNT      7   /**< \brief How many tags are selected */
+/*@}*/
+
+/** \brief Why the last chunk_new() on the calling thread failed, a member of
+  *        #chunk_new_error_codes. Each thread has its own. */
+extern __thread int chunk_errno;
+
+/** \brief Flags for chunk_new() and nbt_loader.flags, which share bits
+  *        with #nbt_buffer_load_flags */
+enum chunk_load_flags
+{
+    CHUNK_LOAD_RUNS = 0x100,    /**< \brief Build each chunk's chunk_runs as
+                                  *         soon as it's loaded */
+    CHUNK_LOAD_PACKED = 0x200,  /**< \brief Pack each chunk's per-block
+                                  *         arrays with palettes */
+    CHUNK_LOAD_OPACITY = 0x400, /**< \brief Build each chunk's
+                                  *         chunk_opacity from the loader's
+                                  *         alpha as soon as it's loaded */
+};
+
+/** \brief Flags passed to chunk_new_with() by chunk_new(). Add
+  *        #NBT_BUFFER_TRUSTED to skip checking each chunk's CRC,
+  *        #CHUNK_LOAD_RUNS to run-length encode every chunk,
+  *        #CHUNK_LOAD_PACKED to keep every chunk packed, or
+  *        #CHUNK_LOAD_OPACITY with chunk_load_alpha to find the opaque blocks
+  *        of every chunk. */
+extern int chunk_load_flags;
+
+/** \brief The alpha table passed to chunk_new_with() by chunk_new(), for
+  *        #CHUNK_LOAD_OPACITY */
+extern const uint8_t *chunk_load_alpha;
+
 /** \brief Reads a chunk from a file
   * \param filepath The path to a chunk
   * \param coord_x  The X coordinate of this chunk.
@@ -69,11 +273,202 @@ typedef struct
   */
 chunk *chunk_new(char *filepath, int32_t coord_x, int32_t coord_z);
 
+/** \brief Reads a chunk from a file through a loader
+  * \param ctx      The loader, which must not be used by another thread at
+  *                 the same time. Files are opened with its flags.
+  * \param filepath The path to a chunk
+  * \param coord_x  The X coordinate of this chunk.
+  * \param coord_z  The Z coordinate of this chunk.
+  * \return A pointer to the new chunk, or NULL on error, in which case
+  *         ctx->chunk_error says why, and ctx->error too if the file could
+  *         not be read.
+  *
+  * Touches no state but the loader's, so any number of threads may load
+  * chunks at once, each with a loader of its own.
+  */
+chunk *chunk_new_with(nbt_loader *ctx, char *filepath, int32_t coord_x, int32_t coord_z);
+
+/** \brief Finds the tags of a chunk file laid out the usual way
+  * \param      buf     A complete buffer, positioned at the root tag
+  * \param[out] out     Where the tags were found
+  * \return 0 on success, -1 if the file holds anything unexpected, in which
+  *         case it should be read with nbt_select() instead.
+  *
+  * This is generated at build time from schemas/chunk.schema by
+  * tools/nbt_schemac. It recognises each tag by comparing its header with
+  * a constant and never builds or allocates anything, but it gives up on
+  * anything it doesn't expect: truncated data, a tag that appears twice, a
+  * wanted name with the wrong type, a mandatory tag that's missing, or a
+  * buffer that's still being inflated.
+  */
+int chunk_layout_decode(nbt_buffer *buf, chunk_layout *out);
+
 /** \brief Destroy a chunk, freeing its memory
   * \param doomed   The chunk to destroy
   */
 void chunk_free(void *doomed);
 
+/** \brief Summarizes what a chunk looks like from above
+  * \param c        The chunk
+  * \param alpha    The alpha value of each of the 256 block types
+  * \return The chunk's surface, or NULL if the chunk lacks the arrays needed
+  *         or no memory could be allocated.
+  *
+  * Each column is walked down from the height map to the first opaque block
+  * once, and the result is kept with the chunk until it is freed. Every call
+  * after the first returns the same summary, whatever alpha it is passed.
+  * The summary is built without locking, so a chunk must not be shared
+  * between threads until it has one.
+  */
+chunk_surface *chunk_get_surface(chunk *c, const uint8_t *alpha);
+
+/** \brief Frees a chunk's surface, so the next chunk_get_surface() builds it
+  *        again
+  * \param c    The chunk
+  *
+  * Meant for a surface built with the wrong alpha, or for timing how long
+  * one takes to build. Like chunk_get_surface(), this doesn't lock.
+  */
+void chunk_drop_surface(chunk *c);
+
+/** \brief Run-length encodes a chunk's blocks
+  * \param c    The chunk
+  * \return The chunk's runs, or NULL if it has no blocks or no memory could
+  *         be allocated.
+  *
+  * The runs are built once, either here or by chunk_new() with
+  * #CHUNK_LOAD_RUNS, and kept with the chunk until it is freed. Once a chunk
+  * has them, chunk_get_surface() and chunk_census() use them instead of the
+  * blocks. Like chunk_get_surface(), this doesn't lock.
+  */
+chunk_runs *chunk_get_runs(chunk *c);
+
+/** \brief Frees a chunk's runs, so it goes back to reading its blocks
+  * \param c    The chunk
+  *
+  * The next chunk_get_runs() builds them again. Like chunk_get_runs(), this
+  * doesn't lock.
+  */
+void chunk_drop_runs(chunk *c);
+
+/** \brief Finds the runs of a single column
+  * \param      c       A chunk that has runs
+  * \param      coord_x The X coordinate of the column (0-15)
+  * \param      coord_z The Z coordinate of the column (0-15)
+  * \param[out] end     Set to just past the column's last run, if not NULL
+  * \return The column's lowest run, or NULL if the chunk has no runs.
+  */
+const chunk_run *chunk_column_runs(chunk *c, uint8_t coord_x, uint8_t coord_z, const chunk_run **end);
+
+/** \brief Finds the run holding a block
+  * \param run      The first run of a column, from chunk_column_runs()
+  * \param end      Just past the column's last run
+  * \param coord_y  The Y coordinate of the block
+  * \return The run covering coord_y, or NULL if it's outside the column.
+  */
+const chunk_run *chunk_run_find(const chunk_run *run, const chunk_run *end, int32_t coord_y);
+
+/** \brief Finds the blocks of a chunk that can't be seen through
+  * \param c        The chunk, packed or not
+  * \param alpha    The alpha value of each of the 256 block types
+  * \return The chunk's opacity, or NULL if it has no blocks or no memory could
+  *         be allocated.
+  *
+  * Built once, here or by chunk_new() with #CHUNK_LOAD_OPACITY, and kept with
+  * the chunk until it's freed. As with chunk_get_surface(), every call after
+  * the first returns the same bitmap whatever alpha it's passed, and nothing
+  * is locked. It's quickest to build once the chunk has runs.
+  */
+chunk_opacity *chunk_get_opacity(chunk *c, const uint8_t *alpha);
+
+/** \brief Finds the highest opaque block of a column
+  * \param c        A chunk that has opacity
+  * \param coord_x  The X coordinate of the column (0-15)
+  * \param coord_z  The Z coordinate of the column (0-15)
+  * \param coord_y  The highest Y coordinate to look at
+  * \return The Y coordinate of the highest opaque block at or below coord_y,
+  *         or -1 if there isn't one or the chunk has no opacity.
+  */
+int32_t chunk_opacity_top(chunk *c, uint8_t coord_x, uint8_t coord_z, int32_t coord_y);
+
+/** \brief Finds the opaque blocks of a column that aren't hidden
+  * \param      c       A chunk that has opacity
+  * \param      coord_x The X coordinate of the column (0-15)
+  * \param      coord_z The Z coordinate of the column (0-15)
+  * \param[out] out     Where to write chunk_opacity.words words, with a bit
+  *                     set for each opaque block that has at least one face
+  *                     not covered by another opaque block
+  * \return 0 on success, -1 if the chunk has no opacity or the column is out
+  *         of range.
+  *
+  * A block is hidden when the blocks above and below it and the four next to
+  * it are all opaque. Nothing lies under the bottom of the chunk, so the
+  * blocks at Y 0 count as covered from below; the neighbouring chunks aren't
+  * looked at, so blocks along the edges of a chunk count as uncovered from
+  * that side.
+  */
+int chunk_opacity_exposed(chunk *c, uint8_t coord_x, uint8_t coord_z, uint64_t *out);
+
+/** \brief Counts the blocks of each type in a chunk
+  * \param         c       The chunk
+  * \param[in,out] counts  256 counters, one per block type, which are added
+  *                        to rather than cleared
+  * \return 0 on success, -1 if the chunk has no blocks, or is packed and no
+  *         memory could be allocated to unpack a column into.
+  *
+  * Adds up runs rather than blocks when the chunk has them.
+  */
+int chunk_census(chunk *c, uint64_t *counts);
+
+/** \brief Expands an array of 4-bit values into one byte per value
+  * \param      packed  The packed values, two to a byte with the first in
+  *                     the low nibble, as in skylight, blocklight and
+  *                     blockdata
+  * \param      length  How many bytes of packed values there are
+  * \param[out] out     Where to write the 2 * length expanded values
+  *
+  * Uses SSE2 where it's available, 16 packed bytes at a time.
+  */
+void chunk_expand_nibbles(const uint8_t *packed, size_t length, uint8_t *out);
+
+/** \brief Expands a single column of one of a chunk's per-block arrays
+  * \param      c       The chunk, packed or not
+  * \param      array   Which array, one of the first
+  *                     #CHUNK_BLOCK_ARRAY_COUNT in #chunk_array_index
+  * \param      coord_x The X coordinate of the column (0-15)
+  * \param      coord_z The Z coordinate of the column (0-15)
+  * \param[out] out     Where to write chunk.height values, indexed by Y
+  * \return 0 on success, -1 if the chunk lacks the array or the column is
+  *         out of range.
+  *
+  * Each column's values are contiguous, so for the 4-bit arrays this is a
+  * single call to chunk_expand_nibbles(), after which a value is a plain
+  * byte load. Packed arrays go through chunk_palette_decode().
+  */
+int chunk_get_column(chunk *c, int array, uint8_t coord_x, uint8_t coord_z, uint8_t *out);
+
+/** \brief Finds the block types of a single column
+  * \param c        The chunk, packed or not
+  * \param coord_x  The X coordinate of the column (0-15)
+  * \param coord_z  The Z coordinate of the column (0-15)
+  * \param scratch  Room for chunk.height bytes, used if the chunk is packed
+  * \return The column's blocks, indexed by Y, which point into the chunk
+  *         itself unless it's packed, or NULL if it has no blocks or the
+  *         column is out of range.
+  */
+const uint8_t *chunk_column_blocks(chunk *c, uint8_t coord_x, uint8_t coord_z, uint8_t *scratch);
+
+/** \brief Reads a single value out of a chunk's per-block arrays
+  * \param c        The chunk, packed or not
+  * \param array    Which array, as for chunk_get_column()
+  * \param coord_x  The X coordinate of the block (0-15)
+  * \param coord_y  The Y coordinate of the block (0-chunk.height)
+  * \param coord_z  The Z coordinate of the block (0-15)
+  * \return The value, or -1 if the chunk lacks the array or the block is out
+  *         of range.
+  */
+int chunk_get_value(chunk *c, int array, uint8_t coord_x, int32_t coord_y, uint8_t coord_z);
+
 /** \brief Parse a chunk's filename and retrieve the coordinates from it
   * \param      filename    The filename of the chunk to parse
   * \param[out] x_coord     A pointer to an integer to store the x coord
@@ -0,0 +1,77 @@
+/** \file chunk_palette.h
+  * \brief Per-block arrays packed down to as few bits as their values need
+  *
+  * A chunk rarely uses more than a handful of block types, and its light and
+  * data arrays are often just as repetitive. A palette lists the distinct
+  * values of an array once, and the array keeps only an index into it for
+  * each block, as many bits wide as the palette needs, rounded up to a power
+  * of two so that no index straddles two bytes. An array holding a single
+  * value takes no room at all.
+  */
+
+#ifndef CHUNK_PALETTE_H
+#define CHUNK_PALETTE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** \brief The largest index a palette holds, in bits */
+#define CHUNK_PALETTE_MAX_BITS 8
+
+/** \brief A per-block array, packed with a palette */
+typedef struct
+{
+    const uint8_t *data;    /**< \brief The index of each block, bits wide,
+                              *         with the first block in the lowest
+                              *         bits of the first byte. NULL when
+                              *         bits is 0. */
+    uint8_t bits;           /**< \brief How wide each index is: 0, 1, 2, 4
+                              *         or 8 */
+    uint8_t identity;       /**< \brief Set if every index is its own value,
+                              *         so decoding needn't look them up */
+    uint16_t size;          /**< \brief How many distinct values there are */
+    uint8_t values[256];    /**< \brief The value of each index, in
+                              *         ascending order */
+} chunk_palette;
+
+/** \brief Builds the palette for an array and works out its packed size
+  * \param[out] p       The palette, whose data is left NULL
+  * \param      raw     The array, one value per block
+  * \param      count   How many blocks there are
+  * \param      bits    How wide each value is in raw, 4 or 8. 4-bit values
+  *                     are two to a byte with the first in the low nibble.
+  * \return How many bytes chunk_palette_pack() will write, which is 0 if the
+  *         array holds a single value.
+  */
+size_t chunk_palette_measure(chunk_palette *p, const uint8_t *raw, size_t count, uint8_t bits);
+
+/** \brief Packs an array with a palette from chunk_palette_measure()
+  * \param[in,out] p       The palette, whose data is pointed at out
+  * \param         raw     The array it was measured from
+  * \param         count   How many blocks there are
+  * \param         bits    How wide each value is in raw, 4 or 8
+  * \param[out]    out     Room for as many bytes as were measured
+  */
+void chunk_palette_pack(chunk_palette *p, const uint8_t *raw, size_t count, uint8_t bits, uint8_t *out);
+
+/** \brief Decodes a stretch of a packed array, a byte per block
+  * \param      p       The palette
+  * \param      first   The first block to decode
+  * \param      count   How many blocks to decode
+  * \param[out] out     Where to write count values
+  *
+  * 8 and 4 bit indices take the same paths as the raw arrays, a copy and
+  * chunk_expand_nibbles(), and narrower ones are read a byte at a time.
+  * Indices are only looked up in the palette if they aren't the values
+  * already.
+  */
+void chunk_palette_decode(const chunk_palette *p, size_t first, size_t count, uint8_t *out);
+
+/** \brief Looks up a single block in a packed array
+  * \param p        The palette
+  * \param index    The block
+  * \return The block's value.
+  */
+uint8_t chunk_palette_get(const chunk_palette *p, size_t index);
+
+#endif
@@ -0,0 +1,113 @@
+/** \file chunk_pool.h
+  * \brief Recycles the memory chunks are loaded into
+  *
+  * Rendering a range of tiles loads and frees the same few sizes of chunk
+  * over and over: every chunk of a given height takes the same room, and
+  * inflating each file needs a buffer about as large. Rather than hand all of
+  * that back to malloc() each time, each thread keeps a pool of blocks,
+  * sorted into size classes and reused through free lists, along with a
+  * single inflate buffer that's kept between loads.
+  *
+  * A block only ever goes back on the free list of a pool it was taken from
+  * in size, so a pool never holds more than the most its thread had in use
+  * at once.
+  */
+
+#ifndef CHUNK_POOL_H
+#define CHUNK_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nbt_buffer.h"
+
+/** \brief Sizes are rounded up to a multiple of this many bytes */
+#define CHUNK_POOL_GRANULE 4096
+/** \brief How many size classes are kept. Larger blocks come straight from
+  *        the allocator and go straight back to it. */
+#define CHUNK_POOL_CLASSES 64
+
+/** \brief One thread's blocks, and how it has used them */
+typedef struct
+{
+    void *free[CHUNK_POOL_CLASSES]; /**< \brief The free blocks of each size
+                                      *         class, linked through their
+                                      *         first bytes */
+    nbt_buffer *buffer;             /**< \brief The buffer chunk_new_with()
+                                      *         inflates files into */
+    uint64_t allocations;           /**< \brief How many blocks were asked
+                                      *         for */
+    uint64_t reused;                /**< \brief How many of those came off a
+                                      *         free list */
+    int64_t in_use;                 /**< \brief How many bytes are handed out
+                                      *         right now */
+    int64_t high_water;             /**< \brief The most in_use has been */
+    int64_t pooled;                 /**< \brief How many bytes sit on the free
+                                      *         lists */
+} chunk_pool;
+
+/** \brief The counts of every thread's pool, added up */
+typedef struct
+{
+    uint64_t threads;               /**< \brief How many pools there were */
+    uint64_t allocations;           /**< \brief How many blocks were asked
+                                      *         for */
+    uint64_t reused;                /**< \brief How many of those came off a
+                                      *         free list */
+    int64_t high_water;             /**< \brief The sum of each pool's most in
+                                      *         use, so the most that could
+                                      *         have been in use at once */
+    int64_t pooled;                 /**< \brief How many bytes sit on the free
+                                      *         lists of pools still alive */
+} chunk_pool_stats;
+
+/** \brief Finds the calling thread's pool
+  * \return The pool, which is created on first use and freed with everything
+  *         on it when the thread exits, or NULL if no memory could be had.
+  */
+chunk_pool *chunk_pool_thread(void);
+
+/** \brief Takes a block from a pool
+  * \param pool A pool, or NULL to go straight to the allocator
+  * \param size How many bytes are needed
+  * \return A block of at least size bytes aligned to #CHUNK_ALIGNMENT, or
+  *         NULL if no memory could be had.
+  */
+void *chunk_pool_alloc(chunk_pool *pool, size_t size);
+
+/** \brief Gives a block back to a pool
+  * \param pool     A pool, or NULL to free the block outright
+  * \param block    A block from chunk_pool_alloc(), or NULL
+  * \param size     The size it was asked for with
+  *
+  * A block should be given back on the thread that took it, so that each
+  * pool's counts stay meaningful; given back anywhere else, it still joins
+  * that thread's free lists.
+  */
+void chunk_pool_release(chunk_pool *pool, void *block, size_t size);
+
+/** \brief Finds the inflate buffer kept by a pool
+  * \param pool The pool
+  * \return The buffer, which is empty until something is loaded into it, or
+  *         NULL if no memory could be had.
+  */
+nbt_buffer *chunk_pool_buffer(chunk_pool *pool);
+
+/** \brief Adds up the counts of the calling thread's pool and of every pool
+  *        whose thread has exited
+  * \param[out] stats   The counts
+  *
+  * A pool's counts are kept when its thread exits, so once the threads of a
+  * parallel render are joined, their chunks are counted too. Pools of
+  * threads still running, other than the caller's, aren't.
+  */
+void chunk_pool_get_stats(chunk_pool_stats *stats);
+
+/** \brief Frees every block on a pool's free lists, and its buffer
+  * \param pool The pool
+  *
+  * Blocks still in use are unaffected and can be given back later.
+  */
+void chunk_pool_trim(chunk_pool *pool);
+
+#endif
@@ -8,6 +8,8 @@
 #define MINEMAP_VERSION "0.0.1"
 /** \brief How large of a string should be allocated for default output filenames. */
 #define CONFIG_BUFFER_SIZE 64
+/** \brief Where a batch of tiles is written if no output is given. */
+#define CONFIG_BATCH_DIRECTORY "images"
 
 /** \brief Error codes sent by parse_commandline_options when an error is found.
  */
@@ -17,7 +19,9 @@ enum config_errors
     CONFIG_ERROR_NO_MEM, 
     CONFIG_ERROR_PRINT_HELP, 
     CONFIG_ERROR_PRINT_VERSION,
-    CONFIG_ERROR_LOCALTIME
+    CONFIG_ERROR_LOCALTIME,
+    CONFIG_ERROR_TILE_RECT,
+    CONFIG_ERROR_THREADS
 };
 
 /** \brief Contains %configuration information. 
@@ -32,6 +36,14 @@ typedef struct
     char          *input_path;            /**< Location of the directory containing the map chunks, as provided by the user. */
     int32_t       tile_x;                 /**< The X coordinate of the desired tile. */
     int32_t       tile_z;                 /**< The Z coordinate of the desired tile. */
+    unsigned char  trusted;               /**< Set by --trusted to skip checking the CRC of every chunk file. */
+    unsigned char  packed;                /**< Set by --packed to keep every chunk packed with palettes while it's cached. */
+    unsigned char  index;                 /**< Set by --index to find chunks through the index kept in the world directory. */
+    unsigned char  batch;                 /**< Set by --all or --tiles to render every tile with chunks in it, into the directory named by output_filename. */
+    unsigned char  has_tile_rect;         /**< Set by --tiles to limit a batch to tile_rect. */
+    int32_t       tile_rect[4];           /**< The smallest X, smallest Z, largest X and largest Z of the tiles in a batch, inclusive. */
+    int           threads;                /**< Set by --threads to how many threads a batch, or the bands of a single tile, are rendered on, or 0 for one per processor. */
+    unsigned char  stats;                 /**< Set by --stats to report how chunk memory was used, over every thread, once rendering is done. */
 } configuration;
 
 /** \brief Parses commandline arguments and populates config struct.
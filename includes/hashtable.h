@@ -8,6 +8,7 @@
 #ifndef __HASHTABLE_CWC22_H__
 #define __HASHTABLE_CWC22_H__
 
+#include <stddef.h>
 #include "hashtable_private.h"
 
 /* Example of use:
@@ -80,9 +81,34 @@ create_hashtable(unsigned int minsize,
                  int (*key_eq_fn) (void*,void*),
                  void (*vff)(void*));
 
+/** @brief create_hashtable_with_allocator
+ * @param   minsize         minimum initial size of hashtable
+ * @param   hashfunction    function for hashing keys
+ * @param   key_eq_fn       function for determining key equality
+ * @param   vff             function for freeing the hash value
+ * @param   allocf          function used to allocate the table and its
+ *                          entries, given ctx and a size
+ * @param   deallocf        function used to free what allocf allocated, or
+ *                          NULL if that memory is released some other way
+ *                          (e.g. an arena)
+ * @param   ctx             passed as the first argument to allocf and deallocf
+ * @return                  newly created hashtable or NULL on failure
+ *
+ */
+
+struct hashtable *
+create_hashtable_with_allocator(unsigned int minsize,
+                 unsigned int (*hashfunction) (void*),
+                 int (*key_eq_fn) (void*,void*),
+                 void (*vff)(void*),
+                 void *(*allocf)(void*,size_t),
+                 void (*deallocf)(void*,void*),
+                 void *ctx);
+
 /** @brief hashtable_insert
  * @param   h   the hashtable to insert into
- * @param   k   the key - hashtable claims ownership and will free on removal
+ * @param   k   the key - does not claim ownership (see freekey in
+ *              hashtable_private.h)
  * @param   v   the value - does not claim ownership
  * @return      non-zero for successful insertion
  *
@@ -8,6 +8,7 @@
 #ifndef __HASHTABLE_PRIVATE_CWC22_H__
 #define __HASHTABLE_PRIVATE_CWC22_H__
 
+#include <stddef.h>
 #include "hashtable.h"
 
 /*****************************************************************************/
@@ -35,6 +36,16 @@ struct hashtable {
     int (*eqfn) (void *k1, void *k2);   /**< \brief Function to use to compare 
                                           *         keys */
     void (*value_free_func)(void*);     /**< \brief Function to free values */
+    void *(*alloc_func)(void *ctx, size_t size); /**< \brief Function to 
+                                          *         allocate the table and its
+                                          *         entries, or NULL to use
+                                          *         malloc() */
+    void (*dealloc_func)(void *ctx, void *ptr); /**< \brief Function to free
+                                          *         what alloc_func allocated,
+                                          *         or NULL if it never needs
+                                          *         freeing */
+    void *alloc_ctx;                    /**< \brief Passed to alloc_func and
+                                          *         dealloc_func */
 };
 
 /*****************************************************************************/
@@ -42,6 +53,15 @@ struct hashtable {
 unsigned int
 hash(struct hashtable *h, void *k);
 
+/*****************************************************************************/
+/** \brief Allocates memory for a table with its allocator */
+void *
+hashtable_alloc(struct hashtable *h, size_t size);
+
+/** \brief Frees memory allocated by hashtable_alloc() */
+void
+hashtable_dealloc(struct hashtable *h, void *ptr);
+
 /*****************************************************************************/
 /* indexFor */
 /** \brief Returns an index for a given hash value  */
@@ -57,9 +77,10 @@ indexFor(unsigned int tablelength, unsigned int hashvalue)
 */
 
 /*****************************************************************************/
-/** \brief Macro to use for freeing keys */
-#define freekey(X) free(X)
-/*define freekey(X) ; */
+/** \brief Macro to use for freeing keys. Keys are interned tag names, which
+  *        are never freed. */
+/*define freekey(h,X) hashtable_dealloc(h,X) */
+#define freekey(h,X) ;
 
 
 /*****************************************************************************/
@@ -7,6 +7,10 @@
 
 #include "nbt.h"
 #include "chunk.h"
+#include "nbt_buffer.h"
+#include "arena.h"
+#include "level_index.h"
+#include "level_scan.h"
 
 /** \brief How large the buffers used to hold a base 36 string should be. */
 #define LEVEL_BASE_36_SIZE 16
@@ -21,6 +25,9 @@ typedef struct
                               */
     nbt_tag *data;          /**< \brief The nbt_tag holding the %level's 
                               *         metadata */
+    nbt_buffer *buffer;     /**< \brief The decompressed level.dat, which
+                              *         data points into */
+    arena *tree_arena;      /**< \brief The arena data was built in */
     int32_t smallest_x;     /**< \brief The smallest X coordinate of the level
                               */
     int32_t smallest_z;     /**< \brief The smallest Z coordinate of the level
@@ -30,6 +37,9 @@ typedef struct
     int32_t largest_z;      /**< \brief The largest Z coordinate of the level 
                               */
     uint64_t chunk_count;   /**< \brief The number of chunks in the map */
+    level_index *index;     /**< \brief Where every chunk is, once
+                              *         level_load_index() has been called, or
+                              *         NULL */
 } level;
 
 /** \brief Loads the given minecraft %level.
@@ -54,10 +64,45 @@ void level_free(level *doomed);
   */
 chunk *level_get_chunk_at(level *lvl, int coord_x, int coord_z);
 
+/** \brief Loads a chunk from the map through a loader
+  * \param lvl      The level whose chunks you wish to find
+  * \param ctx      The loader to read the chunk with, or NULL to use
+  *                 chunk_new()
+  * \param coord_x  The x Coordinate of the chunk
+  * \param coord_z  The z Coordinate of the chunk
+  * \return The chunk corresponding to the coordinates, or NULL if it does not
+  *         exist or on error.
+  */
+chunk *level_get_chunk_with(level *lvl, nbt_loader *ctx, int coord_x, int coord_z);
+
 /** \brief Scans a world folder and derives its dimensions 
   * \param[in]  lvl     The level to read
   * \return Fills parameters of the level passed.
+  *
+  * The folder is walked with level_scan_world(), on as many threads as there
+  * are processors. Once the level has an index, the dimensions come from that instead and
+  * the folder isn't touched.
   */
 void level_get_dimensions(level *lvl);
 
+/** \brief Opens the level's chunk index, bringing it up to date
+  * \param lvl  The level
+  * \return 0 on success, nonzero if the world couldn't be scanned.
+  *
+  * Fills in the dimensions and chunk count of the level. From then on,
+  * level_get_chunk_at() and level_get_chunk_with() find chunks through the
+  * index rather than by stat()ing their files. See level_index.h.
+  */
+int level_load_index(level *lvl);
+
+/** \brief Lists every chunk of the level
+  * \param lvl  The level
+  * \return The coordinates of the chunks, sorted by X then Z, or NULL on
+  *         error. Free with level_scan_free().
+  *
+  * The chunks come from the index if the level has one, and from
+  * level_scan_world() otherwise.
+  */
+level_scan *level_get_chunks(level *lvl);
+
 #endif
@@ -0,0 +1,109 @@
+/** \file level_index.h
+  * \brief A persistent index of where a %level's chunks are
+  *
+  * Finding a chunk otherwise means formatting its path and calling stat() on
+  * it, and finding every chunk means walking and stat()ing the whole tree of
+  * base 36 directories. The index keeps the coordinates, size and mtime of
+  * every chunk file in a file of its own in the world directory, along with
+  * the mtime of each of the 64x64 directories the chunks live in.
+  *
+  * Opening the index reads that file back and only scans the directories
+  * whose mtime has changed since, which is where chunks are added, removed
+  * or, since Minecraft writes them to a new file and renames it, saved. The
+  * index is written back whenever anything changed. Lookups after that go
+  * through a hash of the coordinates and never touch the disk.
+  */
+
+#ifndef LEVEL_INDEX_H
+#define LEVEL_INDEX_H
+
+#include <stdint.h>
+
+/** \brief What the index file in the world directory is called */
+#define LEVEL_INDEX_FILENAME "minemap.idx"
+
+/** \brief Identifies an index file, and the byte order it was written in */
+#define LEVEL_INDEX_MAGIC 0x5844494DU
+
+/** \brief Bumped whenever the layout of the index file changes */
+#define LEVEL_INDEX_VERSION 1
+
+/** \brief How many directories there are along each axis. A chunk lives in
+  *        the directories named by its coordinates modulo this. */
+#define LEVEL_INDEX_DIRECTORIES 64
+
+/** \brief The mtime of a directory that hasn't been scanned */
+#define LEVEL_INDEX_UNSCANNED INT64_MIN
+
+/** \brief A chunk file in the index */
+typedef struct
+{
+    int32_t coord_x;    /**< \brief The X coordinate of the chunk */
+    int32_t coord_z;    /**< \brief The Z coordinate of the chunk */
+    uint32_t size;      /**< \brief How large the file is, in bytes */
+    uint32_t reserved;  /**< \brief Unused, and always 0 */
+    int64_t mtime;      /**< \brief When the file was last modified, in
+                          *         nanoseconds since the epoch */
+} level_index_entry;
+
+/** \brief A directory of chunk files in the index */
+typedef struct
+{
+    int64_t mtime;      /**< \brief The mtime of the directory when it was
+                          *         scanned, in nanoseconds since the epoch,
+                          *         or #LEVEL_INDEX_UNSCANNED */
+    uint32_t first;     /**< \brief The first of its entries */
+    uint32_t count;     /**< \brief How many entries it has */
+} level_index_directory;
+
+/** \brief Every chunk file of a %level */
+typedef struct
+{
+    uint32_t count;             /**< \brief How many chunks there are */
+    int32_t smallest_x;         /**< \brief The smallest X coordinate of a
+                                  *         chunk, or 0 if there are none */
+    int32_t smallest_z;         /**< \brief The smallest Z coordinate */
+    int32_t largest_x;          /**< \brief The largest X coordinate */
+    int32_t largest_z;          /**< \brief The largest Z coordinate */
+    uint32_t rescanned;         /**< \brief How many directories had to be
+                                  *         scanned when it was opened */
+    level_index_entry *entries; /**< \brief The chunks, grouped by directory
+                                  *         and sorted by X then Z within
+                                  *         each */
+    uint32_t *slots;            /**< \brief The hash of the coordinates,
+                                  *         holding one more than the index of
+                                  *         an entry, or 0 if a slot is empty
+                                  */
+    uint32_t slot_mask;         /**< \brief One less than how many slots
+                                  *         there are */
+    level_index_directory directories[LEVEL_INDEX_DIRECTORIES * LEVEL_INDEX_DIRECTORIES];
+                                /**< \brief Every directory, by its X number
+                                  *         times #LEVEL_INDEX_DIRECTORIES
+                                  *         plus its Z number */
+} level_index;
+
+/** \brief Opens the index of a world, bringing it up to date
+  * \param input_path   The world directory
+  * \return The index, or NULL if the world couldn't be scanned or no memory
+  *         could be had.
+  *
+  * A missing or unreadable index file is rebuilt from scratch. Failing to
+  * write the index back, to a read-only world for instance, isn't an error;
+  * it's just scanned again next time.
+  */
+level_index *level_index_open(const char *input_path);
+
+/** \brief Frees an index
+  * \param doomed   The index to free
+  */
+void level_index_free(level_index *doomed);
+
+/** \brief Looks up a chunk in an index
+  * \param index    The index
+  * \param coord_x  The X coordinate of the chunk
+  * \param coord_z  The Z coordinate of the chunk
+  * \return The chunk's entry, or NULL if there's no such chunk.
+  */
+const level_index_entry *level_index_find(const level_index *index, int32_t coord_x, int32_t coord_z);
+
+#endif
@@ -0,0 +1,67 @@
+/** \file level_scan.h
+  * \brief Finds every chunk of a world by walking its directories in parallel
+  *
+  * A world keeps its chunks two directories deep, in up to 64x64 base 36
+  * directories. The scan splits the first level of those directories between
+  * threads, each of which walks its share relative to open directory
+  * descriptors and tells files from directories by the type readdir()
+  * reports, so that no path is formatted and nothing is stat()ed unless the
+  * filesystem doesn't report types.
+  */
+
+#ifndef LEVEL_SCAN_H
+#define LEVEL_SCAN_H
+
+#include <stdint.h>
+
+/** \brief The most threads a scan uses. There's no more work to split than
+  *        this anyway. */
+#define LEVEL_SCAN_MAX_THREADS 64
+
+/** \brief The coordinates of a chunk */
+typedef struct
+{
+    int32_t coord_x;    /**< \brief The X coordinate of the chunk */
+    int32_t coord_z;    /**< \brief The Z coordinate of the chunk */
+} level_scan_coords;
+
+/** \brief Every chunk a scan found */
+typedef struct
+{
+    uint64_t count;             /**< \brief How many chunks there are */
+    level_scan_coords *coords;  /**< \brief Their coordinates, sorted by X
+                                  *         then Z */
+    int32_t smallest_x;         /**< \brief The smallest X coordinate of a
+                                  *         chunk, or 0 if there are none */
+    int32_t smallest_z;         /**< \brief The smallest Z coordinate */
+    int32_t largest_x;          /**< \brief The largest X coordinate */
+    int32_t largest_z;          /**< \brief The largest Z coordinate */
+} level_scan;
+
+/** \brief Scans a world directory for chunks
+  * \param input_path   The world directory
+  * \param threads      How many threads to scan with, or 0 for one per
+  *                     processor. Capped at #LEVEL_SCAN_MAX_THREADS.
+  * \return What was found, or NULL if the directory couldn't be opened or no
+  *         memory could be had.
+  *
+  * Only files named for a chunk, in the directories its coordinates name,
+  * are counted, since those are the only ones level_get_chunk_at() would
+  * find.
+  */
+level_scan *level_scan_world(const char *input_path, int threads);
+
+/** \brief Sorts the coordinates of a scan by X then Z
+  * \param scan The scan
+  *
+  * Only needed for a scan put together by hand; level_scan_world() sorts
+  * what it finds already.
+  */
+void level_scan_sort(level_scan *scan);
+
+/** \brief Frees the result of a scan
+  * \param doomed   The scan to free
+  */
+void level_scan_free(level_scan *doomed);
+
+#endif
@@ -10,6 +10,9 @@
 #include "linked_list.h"
 #include "hashtable_private.h"
 #include "hashtable.h"
+#include "arena.h"
+#include "nbt_atom.h"
+#include "nbt_compound.h"
 
 /** \brief Details the different kinds of tags found in an NBT file. 
   */
@@ -30,7 +33,28 @@ enum nbt_tag_types
     TAG_List,           /**< \brief Holds an ordered, fixed-length list of 
                           *         other tags */
     TAG_Compound,       /**< \brief Holds an unordered, variable length %list of
-                          *         tags with unique names in a hashtable */
+                          *         tags with unique names in an
+                          *         nbt_compound */
+};
+
+/** \brief Flags describing how an nbt_tag's memory is owned. */
+enum nbt_tag_flags
+{
+    NBT_TAG_BORROWED = 0x01,    /**< \brief The byte array or string payload
+                                  *         points into an nbt_buffer and must
+                                  *         not be freed with the tag */
+    NBT_TAG_UTF8     = 0x02,    /**< \brief The string payload is raw UTF-8 in
+                                  *         utf8_payload rather than a wchar_t
+                                  *         string, and meta->length counts
+                                  *         bytes. It is not null-terminated. */
+    NBT_TAG_ARENA    = 0x04,    /**< \brief The tag, its name and everything
+                                  *         below it were allocated from an
+                                  *         arena, and are only freed along
+                                  *         with the arena */
+    NBT_TAG_PACKED   = 0x08,    /**< \brief The TAG_List holds simple tags,
+                                  *         stored as a host-endian array in
+                                  *         array_payload rather than as a
+                                  *         list of nbt_tags */
 };
 
 /** \brief Flags for print_hex().  */
@@ -49,7 +73,8 @@ enum hex_dump_flags
 /** \brief The largest value for a valid simple tag. */
 #define NBT_TAG_TYPE_SIMPLE_MAX TAG_Double
 
-/** \brief The inital number of hash buckets to use for TAG_Compound tags. */
+/** \brief The inital number of hash buckets to use for the index of a large
+  *        TAG_Compound. */
 #define NBT_TAG_HASH_BUCKETS 16
 
 /** \brief A void function pointer */
@@ -85,23 +110,36 @@ typedef union {
     double  double_payload;      /**< \brief Payload for TAG_Double tags. */
     uint8_t *byte_array_payload; /**< \brief Payload for TAG_Byte_Array tags. */
     wchar_t *string_payload;     /**< \brief Payload for TAG_String tags. */
+    char    *utf8_payload;       /**< \brief Payload for TAG_String tags 
+                                   *         flagged with #NBT_TAG_UTF8. */
     list    *list_payload;       /**< \brief Payload for TAG_List tags. */
-    struct hashtable *compound_payload; /**< \brief Payload for TAG_Compound tags. */
+    void    *array_payload;      /**< \brief Payload for TAG_List tags
+                                   *         flagged with #NBT_TAG_PACKED. */
+    nbt_compound *compound_payload; /**< \brief Payload for TAG_Compound tags. */
 } u_tag_payload;
 
 /** \brief Contains meta-information for an nbt_tag. */
-typedef union {
-    int32_t length;         /**< \brief The length of a TAG_Byte_Array or TAG_String tag. */
+typedef struct {
+    int32_t length;         /**< \brief The length of a TAG_Byte_Array or
+                              *         TAG_String tag, or the number of
+                              *         elements in a packed TAG_List. */
     int8_t  child_tag_type; /**< \brief The type of child tags of a TAG_List tag. */
 } u_tag_meta;
 
 /** \brief Contains a single NBT tag entry. 
   */
-typedef struct 
+typedef struct nbt_tag_s
 {
     uint8_t         type;     /**< \brief The tag type, which must be a member of #nbt_tag_types. */
-    wchar_t        *name;     /**< \brief The name of the tag. Omitted for TAG_End tags. */
+    uint8_t         flags;    /**< \brief A combination of #nbt_tag_flags. */
+    wchar_t        *name;     /**< \brief The name of the tag, shared with atom.
+                                *         Omitted for TAG_End tags and the
+                                *         members of a TAG_List. Never free
+                                *         it. */
     uint16_t        name_len; /**< \brief The length of the name in characters */
+    const nbt_atom *atom;     /**< \brief The interned name of the tag, which
+                                *         also holds its hash, or NULL if the
+                                *         tag has no name */
     u_tag_meta     *meta;     /**< \brief The meta-information for a tag. */
     u_tag_payload  *payload;  /**< \brief The payload for this tag. */
 } nbt_tag;
@@ -109,6 +147,7 @@ typedef struct
 /** \brief Create a new nbt_tag. Do not call.
   * \param[in] tag_type       The type for the new tag. Must be a member of #nbt_tag_types. 
   * \param[in] name           The name of the tag. TAG_End types must pass null.
+  *                           It is interned and then freed.
   * \param[in] name_len       The length of the name in characters
   * \param[in] meta           The meta-information for the tag.
   * \param[in] payload        Payload for the tag.
@@ -118,9 +157,44 @@ typedef struct
   */
 nbt_tag *nbt_new_tag(uint8_t tag_type, wchar_t *name, uint16_t name_len, u_tag_meta *meta, u_tag_payload *payload);
 
+/** \brief Create a new nbt_tag inside an arena.
+  * \param[in] a        The arena to allocate from
+  * \param[in] tag_type The type for the new tag. Must be a member of
+  *                     #nbt_tag_types.
+  * \param[in] atom     The interned name of the tag, or NULL
+  * \return A new nbt_tag flagged #NBT_TAG_ARENA, or NULL if the arena ran out
+  *         of memory.
+  *
+  * The tag, its meta-information and its payload are carved out of a single
+  * allocation. The payload is zeroed, except that a TAG_List gets an empty
+  * list and a TAG_Compound an empty nbt_compound, both of which allocate from
+  * the arena as they grow. Push list members with nbt_arena_list_push().
+  */
+nbt_tag *nbt_new_arena_tag(arena *a, uint8_t tag_type, const nbt_atom *atom);
+
+/** \brief Names a tag with an interned name
+  * \param tag  The tag to name. Create it with a NULL name.
+  * \param atom The interned name, or NULL to leave the tag unnamed
+  *
+  * This saves readers from converting names to wchar_t just so that
+  * nbt_new_tag() can intern them again.
+  */
+void nbt_set_name(nbt_tag *tag, const nbt_atom *atom);
+
+/** \brief Appends a tag to a TAG_List built with nbt_new_arena_tag().
+  * \param a    The arena the list was built in
+  * \param tag  The TAG_List
+  * \param child The tag to append
+  * \return 0 on success, non-zero member of #linked_list_errors on error
+  */
+int nbt_arena_list_push(arena *a, nbt_tag *tag, nbt_tag *child);
+
 /** \brief Frees a tag, its payload, and its metadata.
   * \param doomed The tag to free
   * \return void
+  *
+  * Tags flagged #NBT_TAG_ARENA are left alone; they are freed by resetting or
+  * freeing their arena.
   */
 void nbt_free_tag(nbt_tag *doomed);
 
@@ -143,6 +217,14 @@ nbt_tag *nbt_new_simple_tag(uint8_t tag_type, wchar_t *name, uint16_t name_len,
   */
 u_tag_payload *nbt_new_simple_payload(uint8_t tag_type, void *payload_value);
 
+/** \brief Converts a big-endian simple payload into a u_tag_payload.
+  * \param      tag_type      The type of the tag. Must be a simple type.
+  * \param[in]  payload_value A pointer to the payload as it appears in a file
+  * \param[out] payload       Where to store the converted value
+  * \return 0 on success, -1 if tag_type is not a simple type.
+  */
+int nbt_convert_simple_payload(uint8_t tag_type, void *payload_value, u_tag_payload *payload);
+
 /** \brief Gets the size of a payload for a simple tag type.
   * \param[in] tag_type The type of tag
   * \return The size of the payload for the tag, or 0 if an invalid type is passed
@@ -190,6 +272,18 @@ nbt_tag *nbt_new_string_tag(wchar_t *payload_value, wchar_t *name, uint16_t name
   */
 nbt_tag *nbt_new_list_tag(wchar_t *name, uint16_t name_len, int8_t child_tag_type);
 
+/** \brief Creates a new NBT_List tag holding a packed array of simple tags
+  * \param[in] a              The arena to allocate from, or NULL to use
+  *                           malloc()
+  * \param[in] atom           The interned name of the tag, or NULL
+  * \param[in] child_tag_type The type of the elements. Must be a simple type.
+  * \param[in] length         The number of elements
+  *
+  * The new tag is flagged #NBT_TAG_PACKED, and its array_payload has room for
+  * length zeroed elements, to be filled in host byte order.
+  */
+nbt_tag *nbt_new_packed_list_tag(arena *a, const nbt_atom *atom, int8_t child_tag_type, int32_t length);
+
 /** \brief Creates a new NBT_Compound tag
   * \param[in] name The name of the tag
   * \param[in] name_len      The length of the name in characters
@@ -206,10 +300,55 @@ nbt_tag *nbt_new_compound_tag(wchar_t *name, uint16_t name_len);
   * \param expected_type    What type you expect this tag to be. See 
   *                         #nbt_tag_types
   * \return A pointer to the payload, or NULL if the type of the tag is not as
-  *         expected or the payload is simply missing
+  *         expected or the payload is simply missing. A TAG_List flagged
+  *         #NBT_TAG_PACKED gives its array rather than a list.
   */
 void *nbt_payload(nbt_tag *tag, uint8_t expected_type);
 
+/** \brief Counts the elements of a TAG_List
+  * \param tag  The list
+  * \return The number of elements, or -1 if the tag is not a TAG_List.
+  *
+  * Takes constant time for packed lists and linear time for the others.
+  */
+int32_t nbt_list_length(nbt_tag *tag);
+
+/** \brief Retrieve the packed elements of a TAG_List
+  * \param tag                  The list
+  * \param expected_child_type  The type the elements should be
+  * \return A pointer to nbt_list_length() elements of the C type matching
+  *         expected_child_type (int8_t, int16_t, int32_t, int64_t, float or
+  *         double), or NULL if the tag is not a packed list of that type.
+  */
+void *nbt_list_array(nbt_tag *tag, uint8_t expected_child_type);
+
+/** \brief Retrieve a single element of a packed TAG_List
+  * \param      tag     The list
+  * \param      index   The position of the element
+  * \param[out] out     Where to store the element
+  * \return 0 on success, -1 if the tag is not a packed list or index is out
+  *         of range.
+  */
+int nbt_list_get(nbt_tag *tag, int32_t index, u_tag_payload *out);
+
+/** \brief Retrieve a single element of a TAG_List of complex tags
+  * \param tag      The list
+  * \param index    The position of the element
+  * \return The element, or NULL if the tag is packed or index is out of
+  *         range. Takes linear time.
+  */
+nbt_tag *nbt_list_item(nbt_tag *tag, int32_t index);
+
+/** \brief Converts an array of big-endian simple payloads to host order
+  * \param      tag_type   The type of the elements. Must be a simple type.
+  * \param[in]  raw        The elements as they appear in a file, which need
+  *                         not be aligned. May be the same as out.
+  * \param      count      The number of elements
+  * \param[out] out        Where to store the converted elements
+  * \return 0 on success, -1 if tag_type is not a simple type.
+  */
+int nbt_convert_simple_array(uint8_t tag_type, const uint8_t *raw, int32_t count, void *out);
+
 /** \brief Search a TAG_Compound hash for a given key
   * \param tag  The tag to search
   * \param key  The key to look for
@@ -217,6 +356,17 @@ void *nbt_payload(nbt_tag *tag, uint8_t expected_type);
   *         or NULL if the key was not found
   */
 nbt_tag *nbt_hash_search(nbt_tag *tag, wchar_t *key);
+
+/** \brief Search a TAG_Compound hash for an interned name
+  * \param tag  The tag to search
+  * \param key  The interned name to look for
+  * \return The tag for the given key, or NULL if the tag was not a
+  *         TAG_Compound or the key was not found
+  *
+  * Unlike nbt_hash_search(), the key is never converted, so this is the one
+  * to use in loops.
+  */
+nbt_tag *nbt_hash_search_atom(nbt_tag *tag, const nbt_atom *key);
 /*@}*/
 
 /** \name NBT Pretty Print Functions
@@ -254,15 +404,17 @@ void hex_dump(void *string, int string_length, int indent, int flags);
   */
 /*@{*/
 /** \brief Generates a hash value for a Named Binary Tag
-  * \param name The name of a tag, cast as a void pointer
-  * \return A hash value for the tag.
+  * \param name The nbt_atom naming a tag, cast as a void pointer
+  * \return The hash stored in the atom.
   */
 unsigned int nbt_hash_fn(void *name);
 
 /** \brief Compares two tags to see if their names match
-  * \param name1 The first name to compare (wchar_t* cast as void*)
-  * \param name2 The first name to compare (wchar_t* cast as void*)
+  * \param name1 The first name to compare (nbt_atom* cast as void*)
+  * \param name2 The first name to compare (nbt_atom* cast as void*)
   * \return 1 if the tags have the same name, 0 if they don't
+  *
+  * Atoms are unique, so this is a pointer comparison.
   */
 int nbt_name_eq(void *name1, void *name2);
 /*@}*/
@@ -0,0 +1,67 @@
+/** \file nbt_atom.h
+  * \brief Interned tag names
+  *
+  * The same few dozen tag names appear over and over in every chunk of a
+  * world. Each distinct name is stored once, as an nbt_atom, in a global
+  * table shared by every thread. Two names are equal exactly when their atoms
+  * are the same pointer, and each atom carries its hash, so looking a name up
+  * in a TAG_Compound never compares strings.
+  */
+
+#ifndef NBT_ATOM_H
+#define NBT_ATOM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <wchar.h>
+
+/** \brief How many buckets the intern table starts with. It doubles whenever
+  *        it holds twice as many atoms as buckets. */
+#define NBT_ATOM_BUCKETS 256
+
+/** \brief A single interned tag name. Atoms are never freed. */
+typedef struct nbt_atom_s
+{
+    struct nbt_atom_s *next;    /**< \brief The next atom in the same bucket */
+    uint32_t hash;              /**< \brief The hash of the UTF-8 name */
+    uint16_t length;            /**< \brief The length of utf8 in bytes */
+    uint16_t wide_length;       /**< \brief The length of wide in
+                                  *         characters */
+    const char *utf8;           /**< \brief The name as null-terminated
+                                  *         UTF-8 */
+    const wchar_t *wide;        /**< \brief The name as a null-terminated
+                                  *         wchar_t string */
+} nbt_atom;
+
+/** \brief Interns a UTF-8 name
+  * \param utf8     The name, which need not be null-terminated
+  * \param length   The length of the name in bytes
+  * \return The atom for the name, or NULL on error. nbt_read_error is set to
+  *         #NBT_READ_INVALID_UTF8 or #NBT_READ_OUT_OF_MEM.
+  *
+  * Safe to call from any thread.
+  */
+const nbt_atom *nbt_atom_intern(const char *utf8, size_t length);
+
+/** \brief Interns a wchar_t name
+  * \param name     The name, which need not be null-terminated
+  * \param length   The length of the name in characters
+  * \return The atom for the name, or NULL on error.
+  */
+const nbt_atom *nbt_atom_intern_wide(const wchar_t *name, size_t length);
+
+/** \brief Finds the atom for a wchar_t name without interning it
+  * \param name     The name, which need not be null-terminated
+  * \param length   The length of the name in characters
+  * \return The atom for the name, or NULL if no tag has ever had that name.
+  */
+const nbt_atom *nbt_atom_find_wide(const wchar_t *name, size_t length);
+
+/** \brief Hashes a UTF-8 name the way atoms are hashed
+  * \param utf8     The name
+  * \param length   The length of the name in bytes
+  * \return The 32-bit FNV-1a hash of the name
+  */
+uint32_t nbt_atom_hash(const char *utf8, size_t length);
+
+#endif
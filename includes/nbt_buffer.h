@@ -0,0 +1,209 @@
+/** \file nbt_buffer.h
+  * \brief Holds an entire decompressed NBT file in a single block of memory
+  *
+  * Reading a file through an nbt_buffer inflates it once, up front, so that
+  * the parser can hand out pointers straight into the decompressed data
+  * instead of allocating and copying every payload.
+  */
+
+#ifndef NBT_BUFFER_H
+#define NBT_BUFFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <zlib.h>
+
+/** \brief How many bytes to allocate for a new buffer when the caller doesn't
+  *        care. A pre-Anvil chunk inflates to a little over 80 KiB. */
+#define NBT_BUFFER_INITIAL_SIZE 98304
+
+/** \brief How many bytes to inflate at a time when a buffer is filled
+  *        lazily from its source. */
+#define NBT_BUFFER_READ_SIZE 16384
+
+/** \brief How deeply lists and compounds may be nested before a reader gives
+  *        up with #NBT_READ_TOO_DEEP, unless it is told otherwise. Minecraft
+  *        itself refuses anything deeper. */
+#define NBT_BUFFER_MAX_DEPTH 512
+
+/** \brief Holds a decompressed NBT file and a read cursor into it. */
+typedef struct
+{
+    uint8_t *data;      /**< \brief The decompressed contents of the file */
+    size_t   length;    /**< \brief How many bytes of data are valid */
+    size_t   capacity;  /**< \brief How many bytes have been allocated */
+    size_t   position;  /**< \brief Where the next read will start */
+    gzFile   source;    /**< \brief A file that is still being inflated on
+                          *         demand, or NULL once the buffer is
+                          *         complete */
+} nbt_buffer;
+
+/** \brief The most a gzip member can grow by when inflated. Deflate can't do
+  *        better than about 1032 to 1, so a trailer claiming more than this
+  *        is corrupt. */
+#define NBT_BUFFER_MAX_RATIO 1032
+
+/** \brief Flags for nbt_buffer_load() and nbt_buffer_open_flags() */
+enum nbt_buffer_load_flags
+{
+    NBT_BUFFER_TRUSTED = 0x01,  /**< \brief Don't check the inflated data
+                                  *         against the CRC-32 in the gzip
+                                  *         trailer. Only for input that is
+                                  *         known to be intact. */
+};
+
+/** \brief A TAG_List or TAG_Compound that a reader has begun but not yet
+  *        finished.
+  *
+  * The readers keep these on an explicit stack rather than recursing, so
+  * deeply nested data costs a few bytes per level instead of a C stack
+  * frame.
+  */
+typedef struct
+{
+    uint8_t tag_type;       /**< \brief TAG_List or TAG_Compound */
+    uint8_t child_tag_type; /**< \brief The type of the members of a
+                              *         TAG_List */
+    int32_t remaining;      /**< \brief How many members of a TAG_List are
+                              *         still to be read */
+} nbt_buffer_frame;
+
+/** \brief Allocates a new, empty buffer
+  * \param capacity How many bytes to allocate up front. Pass 0 to use
+  *                 #NBT_BUFFER_INITIAL_SIZE.
+  * \return A new nbt_buffer, or NULL if no memory could be allocated.
+  */
+nbt_buffer *nbt_buffer_new(size_t capacity);
+
+/** \brief Frees a buffer and the data it holds
+  * \param doomed   The nbt_buffer to free
+  *
+  * If the buffer still has a source, it is closed. Any tags that were read
+  * out of this buffer with nbt_read_buffer() point
+  * into its data, so they must be freed first.
+  */
+void nbt_buffer_free(nbt_buffer *doomed);
+
+/** \brief Inflates the remainder of a gzFile into a buffer
+  * \param buf  The buffer to fill. Its previous contents are discarded.
+  * \param file A gzFile to read from
+  * \return 0 on success, -1 on error. The error code is stored in
+  *         nbt_read_error.
+  *
+  * The buffer grows as needed, so do not hold on to pointers into it across
+  * calls to this function.
+  */
+int nbt_buffer_read_gz(nbt_buffer *buf, gzFile file);
+
+/** \brief Opens a gzipped NBT file and inflates it into a new buffer
+  * \param path The path to the file
+  * \return A new nbt_buffer holding the whole file, or NULL on error.
+  *
+  * Same as nbt_buffer_open_flags() with no flags, so the CRC is checked.
+  */
+nbt_buffer *nbt_buffer_open(char *path);
+
+/** \brief Opens a gzipped NBT file and inflates it into a new buffer
+  * \param path     The path to the file
+  * \param flags    A combination of #nbt_buffer_load_flags
+  * \return A new nbt_buffer holding the whole file, allocated at exactly the
+  *         inflated size, or NULL on error.
+  */
+nbt_buffer *nbt_buffer_open_flags(char *path, int flags);
+
+/** \brief Inflates a whole gzipped file into a buffer in one go
+  * \param buf      The buffer to fill. Its previous contents are discarded,
+  *                 and it grows to fit if needed.
+  * \param path     The path to the file
+  * \param flags    A combination of #nbt_buffer_load_flags
+  * \return 0 on success, -1 on error. The error code is stored in
+  *         nbt_read_error; #NBT_READ_CRC_MISMATCH means the data inflated
+  *         but didn't match its checksum.
+  *
+  * The file is read with a single read(), and the size of the inflated data
+  * is taken from the ISIZE field of the gzip trailer, so the buffer is sized
+  * once and the whole member is inflated with one call to inflate(). The
+  * compressed data and the zlib state are kept per thread and reused by the
+  * next load, rather than being set up and torn down for every file. Files
+  * that aren't a plain gzip member are read through zlib's gz functions
+  * instead.
+  */
+int nbt_buffer_load(nbt_buffer *buf, const char *path, int flags);
+
+/** \brief Opens a gzipped NBT file for lazy inflation
+  * \param path The path to the file
+  * \return A new nbt_buffer that inflates the file as it is read, or NULL on
+  *         error.
+  *
+  * Data is only inflated when a read needs it, so a reader that has found
+  * everything it wants can stop early with nbt_buffer_close_source(). Since
+  * the buffer grows as it fills, keep offsets rather than pointers into it
+  * until the source has been closed.
+  */
+nbt_buffer *nbt_buffer_open_stream(char *path);
+
+/** \brief Inflates whatever remains of a buffer's source
+  * \param buf  The buffer to complete
+  * \return 0 on success, -1 on error. Does nothing if the buffer is already
+  *         complete.
+  */
+int nbt_buffer_finish(nbt_buffer *buf);
+
+/** \brief Stops inflating a buffer's source and closes it
+  * \param buf  The buffer whose source should be closed
+  *
+  * Whatever has already been inflated remains in the buffer.
+  */
+void nbt_buffer_close_source(nbt_buffer *buf);
+
+/** \brief Consumes bytes from a buffer
+  * \param buf      The buffer to read from
+  * \param length   How many bytes to consume
+  * \return A pointer to the first byte consumed, or NULL if fewer than length
+  *         bytes remain. nbt_read_error is set on error.
+  *
+  * If the buffer still has a source, more data is inflated as needed, which
+  * may move the buffer's data.
+  */
+uint8_t *nbt_buffer_take(nbt_buffer *buf, size_t length);
+
+/** \brief Skips over the payload of a tag without building anything
+  * \param buf      The buffer to read from, positioned at the payload
+  * \param tag_type The type of the tag whose payload should be skipped
+  * \return 0 on success, -1 on error. nbt_read_error is set on error.
+  *
+  * Nested lists and compounds are stepped over without recursing, up to
+  * #NBT_BUFFER_MAX_DEPTH levels deep.
+  */
+int nbt_buffer_skip_payload(nbt_buffer *buf, uint8_t tag_type);
+
+/** \brief Skips over the payload of a tag, nested up to a given depth
+  * \param buf          The buffer to read from, positioned at the payload
+  * \param tag_type     The type of the tag whose payload should be skipped
+  * \param max_depth    How deeply lists and compounds may be nested, or 0
+  *                     for #NBT_BUFFER_MAX_DEPTH
+  * \return 0 on success, -1 on error. nbt_read_error is set on error.
+  *
+  * Like nbt_buffer_skip_payload(), but for readers that accept deeper
+  * nesting. Past #NBT_BUFFER_MAX_DEPTH levels, the stack is allocated with
+  * malloc().
+  */
+int nbt_buffer_skip_payload_depth(nbt_buffer *buf, uint8_t tag_type, int max_depth);
+
+/** \name Primitive Readers
+  * \brief Consume big-endian integers from a buffer
+  * \return 0 on success, -1 if the buffer ran out. nbt_read_error is set on
+  *         error.
+  *
+  * These copy through memcpy, so the data may be unaligned.
+  */
+/*@{*/
+/** \brief Reads a single byte */
+int nbt_buffer_read_u8(nbt_buffer *buf, uint8_t *out);
+/** \brief Reads a big-endian 16-bit integer and converts it to host order */
+int nbt_buffer_read_be16(nbt_buffer *buf, int16_t *out);
+/** \brief Reads a big-endian 32-bit integer and converts it to host order */
+int nbt_buffer_read_be32(nbt_buffer *buf, int32_t *out);
+/*@}*/
+
+#endif
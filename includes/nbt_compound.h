@@ -0,0 +1,92 @@
+/** \file nbt_compound.h
+  * \brief The payload of a TAG_Compound
+  *
+  * Most compounds hold only a handful of tags (an item, a position, a tile
+  * entity), so their children are kept in a flat array in the order they
+  * were read and searched by comparing atoms. Only once a compound grows past
+  * #NBT_COMPOUND_INDEX_THRESHOLD children does it get a hashtable index on
+  * top of the array.
+  */
+
+#ifndef NBT_COMPOUND_H
+#define NBT_COMPOUND_H
+
+#include <stdint.h>
+
+#include "arena.h"
+#include "nbt_atom.h"
+#include "hashtable.h"
+
+/** \brief How many children a compound may have before it is indexed by a
+  *        hashtable. */
+#define NBT_COMPOUND_INDEX_THRESHOLD 16
+
+/** \brief How many children a new compound has room for. */
+#define NBT_COMPOUND_INITIAL_SIZE 4
+
+struct nbt_tag_s;
+
+/** \brief A single child of a compound. */
+typedef struct
+{
+    const nbt_atom *atom;       /**< \brief The name of the child */
+    struct nbt_tag_s *tag;      /**< \brief The child itself */
+} nbt_compound_entry;
+
+/** \brief Holds the children of a TAG_Compound. */
+typedef struct
+{
+    nbt_compound_entry *entries;    /**< \brief The children, in the order
+                                      *         they were inserted */
+    uint32_t count;                 /**< \brief How many entries are in use */
+    uint32_t capacity;              /**< \brief How many entries fit before
+                                      *         the array must grow */
+    struct hashtable *index;        /**< \brief Maps atoms to tags once there
+                                      *         are more than
+                                      *         #NBT_COMPOUND_INDEX_THRESHOLD
+                                      *         children, NULL before */
+    arena *arena;                   /**< \brief The arena everything is
+                                      *         allocated from, or NULL for
+                                      *         malloc() */
+} nbt_compound;
+
+/** \brief Creates an empty compound
+  * \param a    The arena to allocate from, or NULL to use malloc()
+  * \return A new nbt_compound, or NULL if no memory could be allocated.
+  */
+nbt_compound *nbt_compound_new(arena *a);
+
+/** \brief Frees a compound and its children
+  * \param doomed       The compound to free
+  * \param free_tags    Whether to free the children with nbt_free_tag()
+  *
+  * Does nothing to a compound that lives in an arena.
+  */
+void nbt_compound_free(nbt_compound *doomed, int free_tags);
+
+/** \brief Adds a child to a compound
+  * \param c        The compound
+  * \param atom     The name of the child
+  * \param tag      The child
+  * \return 0 on success, -1 if no memory could be allocated.
+  *
+  * A child that already has the same name is replaced and freed.
+  */
+int nbt_compound_insert(nbt_compound *c, const nbt_atom *atom, struct nbt_tag_s *tag);
+
+/** \brief Finds a child of a compound
+  * \param c    The compound
+  * \param atom The name of the child
+  * \return The child, or NULL if there is none by that name.
+  */
+struct nbt_tag_s *nbt_compound_search(nbt_compound *c, const nbt_atom *atom);
+
+/** \brief Removes a child from a compound without freeing it
+  * \param c    The compound
+  * \param atom The name of the child
+  * \return The child that was removed, or NULL if there is none by that
+  *         name.
+  */
+struct nbt_tag_s *nbt_compound_remove(nbt_compound *c, const nbt_atom *atom);
+
+#endif
@@ -0,0 +1,86 @@
+/** \file nbt_loader.h
+  * \brief Per-caller state for reading NBT files and chunks
+  *
+  * An nbt_loader carries everything a load needs besides its input: where the
+  * error of the last load is reported, the scratch memory used while reading,
+  * the arena trees are built in and the flags files are opened with. Give
+  * each thread its own loader and any number of them can read chunks at
+  * once.
+  *
+  * The plain functions (chunk_new(), nbt_read(), nbt_read_buffer()) still
+  * work; they report through nbt_read_error and chunk_errno, which are
+  * private to each thread.
+  */
+
+#ifndef NBT_LOADER_H
+#define NBT_LOADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+/** \brief How many bytes of scratch memory a loader starts with. Enough for
+  *        every name and nearly every string in a chunk. */
+#define NBT_LOADER_SCRATCH_SIZE 256
+
+/** \brief The state of one caller that reads NBT files and chunks */
+typedef struct
+{
+    int     error;          /**< \brief Why the last load failed, a member of
+                              *         #nbt_read_errors, or #NBT_READ_OK */
+    int     chunk_error;    /**< \brief Why the last chunk_new_with() failed,
+                              *         a member of #chunk_new_error_codes */
+    int     flags;          /**< \brief A combination of
+                              *         #nbt_buffer_load_flags used when
+                              *         opening files */
+    arena  *arena;          /**< \brief The arena nbt_read_buffer_with()
+                              *         builds trees in, or NULL for
+                              *         malloc() */
+    const uint8_t *alpha;   /**< \brief The alpha of each of the 256 block
+                              *         types, which chunk_new_with() builds
+                              *         opacity from when asked to, or NULL
+                              *         */
+    char   *scratch;        /**< \brief Memory that lives until the next
+                              *         call that uses it */
+    size_t  scratch_size;   /**< \brief How many bytes scratch holds */
+} nbt_loader;
+
+/** \brief Prepares a loader that lives on the stack or inside another struct
+  * \param ctx      The loader to prepare
+  * \param a        The arena to build trees in, or NULL for malloc()
+  * \param flags    A combination of #nbt_buffer_load_flags
+  *
+  * Pair with nbt_loader_clear().
+  */
+void nbt_loader_init(nbt_loader *ctx, arena *a, int flags);
+
+/** \brief Frees the scratch memory of a loader set up with nbt_loader_init()
+  * \param ctx  The loader
+  *
+  * The arena belongs to the caller and is left alone.
+  */
+void nbt_loader_clear(nbt_loader *ctx);
+
+/** \brief Allocates a new loader
+  * \param a        The arena to build trees in, or NULL for malloc()
+  * \param flags    A combination of #nbt_buffer_load_flags
+  * \return A new nbt_loader, or NULL if no memory could be allocated.
+  */
+nbt_loader *nbt_loader_new(arena *a, int flags);
+
+/** \brief Frees a loader made with nbt_loader_new()
+  * \param doomed   The loader to free
+  */
+void nbt_loader_free(nbt_loader *doomed);
+
+/** \brief Gets scratch memory from a loader
+  * \param ctx  The loader
+  * \param size How many bytes are needed
+  * \return At least size bytes, or NULL if no memory could be allocated, in
+  *         which case ctx->error is set. The memory is only good until the
+  *         next call.
+  */
+void *nbt_loader_scratch(nbt_loader *ctx, size_t size);
+
+#endif
@@ -0,0 +1,67 @@
+/** \file nbt_select.h
+  * \brief Reads only selected tags out of an NBT file
+  *
+  * Rather than building a whole tree, nbt_select() walks a buffer looking for
+  * a fixed set of tag paths. Subtrees that cannot contain a wanted tag are
+  * skipped without allocating anything, and reading stops as soon as every
+  * wanted tag has been seen.
+  */
+
+#ifndef NBT_SELECT_H
+#define NBT_SELECT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "nbt.h"
+#include "nbt_buffer.h"
+
+/** \brief The longest tag path that nbt_select() will follow, in bytes. */
+#define NBT_SELECT_PATH_SIZE 256
+
+/** \brief Describes a tag wanted by nbt_select() and where it was found. */
+typedef struct
+{
+    const char *path;       /**< \brief The UTF-8 names of the tag and its
+                              *         parents, separated by '/'. An unnamed
+                              *         root compound is left out, so
+                              *         "Level/Blocks" finds Blocks whether the
+                              *         root is Level itself or an unnamed
+                              *         compound holding Level. */
+    uint8_t type;           /**< \brief The expected type of the tag; a tag of
+                              *         any other type is ignored. */
+
+    uint8_t found;          /**< \brief Set to 1 if the tag was found. */
+    int32_t length;         /**< \brief The length of a TAG_Byte_Array or
+                              *         TAG_String in bytes, or the number of
+                              *         entries in a TAG_List. */
+    size_t offset;          /**< \brief Where the payload starts in the
+                              *         buffer. */
+    u_tag_payload value;    /**< \brief The payload of a simple tag, in host
+                              *         byte order. */
+} nbt_selection;
+
+/** \brief Finds the wanted tags in an NBT buffer
+  * \param         buf      A buffer positioned at the start of the root tag
+  * \param[in,out] wanted   An array of tags to look for. Their path and type
+  *                         must be filled in; the rest is filled in by this
+  *                         function.
+  * \param         count    The number of entries in wanted
+  * \return The number of wanted tags that were found, or -1 on error. The
+  *         error code is stored in nbt_read_error.
+  *
+  * When every wanted tag has been found, the buffer's source is closed and
+  * the rest of the file is never inflated. A TAG_List or TAG_Compound that is
+  * wanted is recorded and then skipped, so its payload can be read later.
+  */
+int nbt_select(nbt_buffer *buf, nbt_selection *wanted, int count);
+
+/** \brief Retrieves the payload of a found tag
+  * \param buf  The buffer that was passed to nbt_select()
+  * \param sel  A selection filled in by nbt_select()
+  * \return A pointer to the value for simple tags, a pointer into the buffer
+  *         for everything else, or NULL if the tag was not found.
+  */
+void *nbt_selection_payload(nbt_buffer *buf, nbt_selection *sel);
+
+#endif
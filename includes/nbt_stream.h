@@ -0,0 +1,114 @@
+/** \file nbt_stream.h
+  * \brief Event-driven reading of NBT files
+  *
+  * nbt_stream() walks an NBT file and reports each tag to a set of callbacks
+  * as it goes, without building any nbt_tag, hashtable or list. Byte arrays,
+  * strings and names are handed over as borrowed spans of the buffer.
+  *
+  * The walk is a single loop over an explicit stack of open lists and
+  * compounds, so however deeply the data is nested, the C stack stays the
+  * same size. The depth of that stack is bounded; see nbt_stream_with().
+  */
+
+#ifndef NBT_STREAM_H
+#define NBT_STREAM_H
+
+#include <stdint.h>
+
+#include "nbt.h"
+#include "nbt_buffer.h"
+
+/** \brief Values an nbt_stream_handler callback may return. */
+enum nbt_stream_actions
+{
+    NBT_STREAM_CONTINUE,    /**< \brief Keep going */
+    NBT_STREAM_SKIP,        /**< \brief Skip the children of the compound or
+                              *         list just begun. Its end callback is
+                              *         not called. Same as
+                              *         #NBT_STREAM_CONTINUE elsewhere. */
+    NBT_STREAM_STOP,        /**< \brief Stop reading immediately */
+};
+
+/** \brief The callbacks used by nbt_stream().
+  *
+  * Each callback receives the user pointer given to nbt_stream(), and the
+  * name of the tag as UTF-8 with its length in bytes. Tags inside a TAG_List
+  * have no name and are given NULL and 0. Any callback may be NULL, in which
+  * case the event is ignored but the children of compounds and lists are
+  * still visited.
+  *
+  * Every pointer passed to a callback points into the buffer and is only
+  * guaranteed to be valid until the callback returns. Callbacks return a
+  * member of #nbt_stream_actions.
+  */
+typedef struct
+{
+    /** \brief A TAG_Compound begins. Its children follow. */
+    int (*begin_compound)(void *user, const char *name, uint16_t name_length);
+
+    /** \brief The most recently begun TAG_Compound ends. */
+    int (*end_compound)(void *user);
+
+    /** \brief A TAG_List of length tags of child_tag_type begins. */
+    int (*begin_list)(void *user, const char *name, uint16_t name_length, uint8_t child_tag_type, int32_t length);
+
+    /** \brief The most recently begun TAG_List ends. */
+    int (*end_list)(void *user);
+
+    /** \brief A simple tag, with its value converted to host byte order. */
+    int (*scalar)(void *user, const char *name, uint16_t name_length, uint8_t tag_type, u_tag_payload *value);
+
+    /** \brief A TAG_Byte_Array. */
+    int (*byte_array)(void *user, const char *name, uint16_t name_length, const uint8_t *data, int32_t length);
+
+    /** \brief A TAG_String, as UTF-8 that is not null-terminated. */
+    int (*string)(void *user, const char *name, uint16_t name_length, const char *utf8, int32_t length);
+
+    /** \brief A TAG_List of simple tags, handed over whole as length
+      *        big-endian values of child_tag_type, possibly unaligned.
+      *
+      * If this is set, it is called instead of begin_list, scalar and
+      * end_list for such lists. nbt_convert_simple_array() converts the
+      * values to host byte order.
+      */
+    int (*scalar_array)(void *user, const char *name, uint16_t name_length, uint8_t child_tag_type, const uint8_t *raw, int32_t length);
+} nbt_stream_handler;
+
+/** \brief Options for nbt_stream_with(). Zero them for the defaults. */
+typedef struct
+{
+    int max_depth;          /**< \brief How deeply lists and compounds may be
+                              *         nested, or 0 for
+                              *         #NBT_BUFFER_MAX_DEPTH. Subtrees a
+                              *         handler skips may go as deep. */
+    uint8_t payload_type;   /**< \brief If not TAG_End, the buffer is
+                              *         positioned at the payload of an
+                              *         unnamed tag of this type, as inside a
+                              *         TAG_List, rather than at a tag */
+} nbt_stream_options;
+
+/** \brief Reads a tag from a buffer and reports it to a handler
+  * \param buf      A buffer positioned at the start of a tag
+  * \param handler  The callbacks to invoke
+  * \param user     A pointer passed through to every callback
+  * \return 0 when the tag has been read or a callback asked to stop, -1 on
+  *         error. The error code is stored in nbt_read_error.
+  */
+int nbt_stream(nbt_buffer *buf, nbt_stream_handler *handler, void *user);
+
+/** \brief Reads a tag from a buffer and reports it to a handler, with options
+  * \param buf      A buffer positioned at the start of a tag
+  * \param handler  The callbacks to invoke
+  * \param user     A pointer passed through to every callback
+  * \param options  How to read, or NULL for the same defaults as
+  *                 nbt_stream()
+  * \return 0 when the tag has been read or a callback asked to stop, -1 on
+  *         error. Nesting deeper than the maximum depth is an error, with
+  *         nbt_read_error set to #NBT_READ_TOO_DEEP.
+  *
+  * Up to #NBT_BUFFER_MAX_DEPTH levels are tracked on the C stack; a larger
+  * max_depth allocates its stack with malloc().
+  */
+int nbt_stream_with(nbt_buffer *buf, nbt_stream_handler *handler, void *user, const nbt_stream_options *options);
+
+#endif
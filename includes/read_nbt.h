@@ -7,6 +7,9 @@
 
 #include <zlib.h>
 #include "nbt.h"
+#include "nbt_buffer.h"
+#include "arena.h"
+#include "nbt_loader.h"
 
 /** \brief Error codes returned by nbt_read() */
 enum nbt_read_errors
@@ -22,8 +25,17 @@ enum nbt_read_errors
                                   *         the input file */
     NBT_READ_INVALID_UTF8,      /**< \brief An invalid utf-8 byte was detected
                                   */
+    NBT_READ_TOO_DEEP,          /**< \brief Lists and compounds were nested
+                                  *         more deeply than the reader
+                                  *         allows */
+    NBT_READ_CRC_MISMATCH,      /**< \brief The inflated data didn't match the
+                                  *         CRC-32 in the gzip trailer */
 };
 
+/** \brief The error code of the last failed read on the calling thread, a
+  *        member of #nbt_read_errors. Each thread has its own. */
+extern __thread int nbt_read_error;
+
 /** \brief How big the generic, reusable buffer should be */
 #define NBT_READ_BUFFER_SIZE 16
 
@@ -61,6 +73,67 @@ enum nbt_read_errors
   */
 nbt_tag *nbt_read(gzFile file, int force_tag_type);
 
+/** \brief Read an NBT file through a loader
+  * \param[in] ctx            The loader, which must not be used by another
+  *                           thread at the same time
+  * \param[in] file           A gzFile to read from
+  * \param[in] force_tag_type As for nbt_read()
+  * \return An nbt_tag holding the next tag in the file, or NULL on error,
+  *         in which case ctx->error says why.
+  *
+  * Works like nbt_read(), but names and strings are read through the
+  * loader's scratch memory.
+  */
+nbt_tag *nbt_read_with(nbt_loader *ctx, gzFile file, int force_tag_type);
+
+/** \brief Read an NBT tag out of an nbt_buffer without copying payloads.
+  * \param[in] buf            An nbt_buffer holding a decompressed NBT file,
+  *                           positioned at the start of a tag
+  * \param[in] force_tag_type Set to the child tag type if you are reading tags
+  *                           for an NBT_List, and pass 0 in every other case
+  * \return An nbt_tag holding the next tag in the buffer, or NULL on error.
+  *         The error code is stored in nbt_read_error.
+  *
+  * Works like nbt_read(), except that TAG_Byte_Array and TAG_String payloads
+  * are not copied: the tags are flagged #NBT_TAG_BORROWED and point straight
+  * into buf, and strings are left as UTF-8 (#NBT_TAG_UTF8). Free the tree
+  * with nbt_free_tag() before freeing buf. If buf is still being inflated
+  * lazily, it is completed first.
+  *
+  * Unlike nbt_read(), this does not recurse: the tree is built from the
+  * events of nbt_stream_with(), and lists and compounds may be nested up to
+  * #NBT_BUFFER_MAX_DEPTH levels deep before it fails with
+  * #NBT_READ_TOO_DEEP.
+  */
+nbt_tag *nbt_read_buffer(nbt_buffer *buf, int force_tag_type);
+
+/** \brief Read an NBT tag out of an nbt_buffer into an arena.
+  * \param[in] buf            An nbt_buffer holding a decompressed NBT file,
+  *                           positioned at the start of a tag
+  * \param[in] a              The arena to build the tree in
+  * \param[in] force_tag_type Set to the child tag type if you are reading tags
+  *                           for an NBT_List, and pass 0 in every other case
+  * \return An nbt_tag holding the next tag in the buffer, or NULL on error.
+  *         The error code is stored in nbt_read_error.
+  *
+  * Works like nbt_read_buffer(), except that every tag, name, list node and
+  * hashtable is allocated from a, and flagged #NBT_TAG_ARENA. The whole tree
+  * is thrown away by resetting or freeing the arena; nbt_free_tag() does
+  * nothing to it. On error, whatever was built so far stays in the arena
+  * until it is reset.
+  */
+nbt_tag *nbt_read_buffer_arena(nbt_buffer *buf, arena *a, int force_tag_type);
+
+/** \brief Read an NBT tag out of an nbt_buffer through a loader.
+  * \param[in] ctx            The loader. The tree is built in its arena,
+  *                           or with malloc() if it has none.
+  * \param[in] buf            As for nbt_read_buffer()
+  * \param[in] force_tag_type As for nbt_read_buffer()
+  * \return An nbt_tag holding the next tag in the buffer, or NULL on error,
+  *         in which case ctx->error says why.
+  */
+nbt_tag *nbt_read_buffer_with(nbt_loader *ctx, nbt_buffer *buf, int force_tag_type);
+
 /** \brief Wraps gzread in zlib.h and does error checking
   * \param[in]  file   A gzFile to read from
   * \param[out] buffer The buffer to write to
@@ -73,6 +146,14 @@ nbt_tag *nbt_read(gzFile file, int force_tag_type);
   */
 int nbt_read_gzread(gzFile file, void *buffer, int length);
 
+/** \brief Reads a tag name from a gzFile and interns it
+  * \param[in] file   A gzFile to read from
+  * \param[in] length The length of the name in bytes
+  * \return The interned name, or NULL on error. Error code stored in
+  *         nbt_read_error.
+  */
+const nbt_atom *nbt_read_gzread_atom(gzFile file, int length);
+
 /** \brief Reads a utf8 string from a gzFile
   * \param[in]  file         A gzFile to read from
   * \param[out] wchar_buffer A buffer to write to that's big enough to fit length characters
@@ -17,6 +17,18 @@
 /** \brief How many chunks should comprise a tile in both X and Z directions */
 #define RENDERER_TILE_SIZE  16
 
+/** \brief The tile a chunk coordinate falls in, rounding down for negative
+  *        coordinates too */
+#define RENDERER_TILE_OF(coord) \
+    ((coord) >= 0 ? (coord) / RENDERER_TILE_SIZE : -((RENDERER_TILE_SIZE - 1 - (coord)) / RENDERER_TILE_SIZE))
+
+/** \brief How large the buffer holding the path to a tile in a batch should
+  *        be */
+#define RENDERER_PATH_SIZE 256
+
+/** \brief The most threads renderer_perform_parallel() uses */
+#define RENDERER_MAX_THREADS 256
+
 /** \brief How many buckets the cache should initially contain */
 #define RENDERER_CACHE_BUCKETS 32
 
@@ -36,6 +48,8 @@ enum renderer_errors
     RENDER_MEM_PNGWRITE,    /**< \brief Couldn't create a PNG write struct */
     RENDER_MEM_PNGINFO,     /**< \brief Couldn't create a PNG info struct */
     RENDER_MEM_ROW,         /**< \brief Couldn't create a row of PNG data */
+    RENDER_MEM_IMAGE,       /**< \brief Couldn't create the image of a whole
+                              *         tile */
 };
 
 /** \brief Contains pointers to all the functions that a renderer must 
@@ -48,8 +62,31 @@ typedef struct
     /** \brief Write a row of image data. */
     void (*draw_row)(void*,png_bytep,int);
 
+    /** \brief Write the image data of a whole tile, four bytes a pixel, in
+      *        whatever order suits the renderer. Optional; without it, the
+      *        tile is drawn a row at a time by renderer_draw_rows(). */
+    void (*draw_tile)(void*,png_bytep);
+
+    /** \brief Create a cache like the renderer's own, for another thread
+      *        rendering with it. Optional; without it, renders aren't
+      *        spread over threads. */
+    chunk_cache *(*new_cache)(void);
+
+    /** \brief How many rows at a time can be drawn independently of the
+      *        rest, each band starting at a multiple of this with a cache of
+      *        its own, or 0 if each row may depend on the ones before it */
+    int band_height;
+
 } renderer_funcs;
 
+/** \brief A tile with chunks in it */
+typedef struct
+{
+    int32_t tile_x;         /**< \brief The X coordinate of the tile */
+    int32_t tile_z;         /**< \brief The Z coordinate of the tile */
+    uint32_t chunks;        /**< \brief How many chunks it holds */
+} renderer_tile;
+
 /** \brief Holds information about a %renderer.
   */
 typedef struct 
@@ -66,6 +103,8 @@ typedef struct
     chunk_cache *cache;     /**< \brief A chunk_cache */
 
     color_map *map;         /**< \brief A color_map used by this %renderer */
+    uint8_t alpha[256];     /**< \brief The alpha of each block type in map,
+                              *         for chunk_get_surface() */
 #ifdef DO_BLOCK_COUNT
     uint8_t block_count[256]; 
 #endif
@@ -91,11 +130,92 @@ renderer *renderer_new(level *lvl, color_map *map, renderer_funcs *funcs, chunk_
   * \param output_path  The place where the image should be stored.
   * \return 0 on success, nonzero if an error occured. No image is created if 
   *         the renderer fails.
+  *
+  * The tile is drawn whole with renderer_funcs.draw_tile, or a row at a time
+  * by renderer_draw_rows() if the renderer doesn't have it, and then encoded.
   */
 int renderer_perform(renderer *r, int32_t tile_x, int32_t tile_z, char *output_path);
 
+/** \brief Draws a whole tile a row at a time
+  * \param      _r      A void pointer to a renderer
+  * \param[out] image   The tile, four bytes a pixel
+  *
+  * Stands in for renderer_funcs.draw_tile with renderers that only draw
+  * rows.
+  */
+void renderer_draw_rows(void *_r, png_bytep image);
+
+/** \brief Perform the render, drawing bands of the tile on several threads
+  * \param r        The renderer to use to perform the rendering
+  * \param tile_x   The X coordinate of the tile you wish to render
+  * \param tile_z   The Z coordinate of the tile you wish to render
+  * \param output_path  The place where the image should be stored.
+  * \param threads  How many threads to draw on, or 0 for one per processor.
+  *                 Capped at the number of bands.
+  * \return 0 on success, nonzero if an error occured. No image is created if
+  *         the renderer fails.
+  *
+  * The tile is split into bands renderer_funcs.band_height rows high, which
+  * are drawn concurrently into an image of the whole tile, each thread with
+  * a copy of r that has a cache of its own. The image is then written out
+  * in order, so it's byte for byte the same as renderer_perform()'s. A
+  * renderer without bands or renderer_funcs.new_cache, or a single thread,
+  * falls back to renderer_perform().
+  */
+int renderer_perform_bands(renderer *r, int32_t tile_x, int32_t tile_z, char *output_path, int threads);
+
+/** \brief Lists the tiles of a level that hold at least one chunk
+  * \param      lvl     The level
+  * \param      rect    The smallest X, smallest Z, largest X and largest Z of
+  *                     the tiles to keep, inclusive, or NULL to keep them all
+  * \param[out] tiles   The tiles, sorted by X then Z. Free with free().
+  * \param[out] count   How many tiles there are
+  * \return 0 on success, nonzero if the chunks couldn't be listed or no
+  *         memory could be had.
+  *
+  * The chunks come from level_get_chunks(), so from the level's index if it
+  * has one.
+  */
+int renderer_list_tiles(level *lvl, const int32_t *rect, renderer_tile **tiles, uint64_t *count);
+
+/** \brief Renders a batch of tiles into a directory
+  * \param r            The renderer to use
+  * \param tiles        The tiles to render, from renderer_list_tiles()
+  * \param count        How many tiles there are
+  * \param output_dir   The directory to write them to, as tile_X_Z.png
+  * \return How many tiles failed to render.
+  *
+  * Every tile goes through renderer_perform() with the same renderer, so the
+  * level, its index and the chunk pool stay warm from one tile to the next.
+  * A tile that fails doesn't stop the rest.
+  */
+uint64_t renderer_perform_all(renderer *r, const renderer_tile *tiles, uint64_t count, const char *output_dir);
+
+/** \brief Renders a batch of tiles into a directory on several threads
+  * \param r            The renderer to use
+  * \param tiles        The tiles to render, from renderer_list_tiles()
+  * \param count        How many tiles there are
+  * \param output_dir   The directory to write them to, as tile_X_Z.png
+  * \param threads      How many threads to render on, or 0 for one per
+  *                     processor. Capped at #RENDERER_MAX_THREADS.
+  * \return How many tiles failed to render.
+  *
+  * Each thread renders with a copy of r that has a cache of its own, from
+  * renderer_funcs.new_cache, and shares the level and color map. The tiles
+  * are split between the threads in runs of roughly as many chunks each.
+  * A thread that runs out steals the back half of whichever run has the
+  * most tiles left, so uneven tiles even out.
+  *
+  * Each tile is rendered exactly as renderer_perform() renders it, so the
+  * images are byte for byte the same as renderer_perform_all()'s. Without
+  * renderer_funcs.new_cache, or with one thread, this is
+  * renderer_perform_all().
+  */
+uint64_t renderer_perform_parallel(renderer *r, const renderer_tile *tiles, uint64_t count, const char *output_dir, int threads);
+
 /** \brief Sanity checks the renderer, ensuring that vital information exists
-  * \param r    A renderer to check.
+  * \param r    A renderer to check. It needs dimensions and at least one of
+  *             draw_row and draw_tile.
   * \return 0 on succes, -1 if there are missing functions.
   */
 int renderer_sanity_check(renderer *r);
@@ -127,6 +247,20 @@ void renderer_blend_color(png_bytep pixel1, png_bytep pixel2, float gamma);
   */
 float renderer_calc_gamma(chunk *c, int16_t coord_x, int16_t coord_y, int16_t coord_z, float sky_percent, float block_percent);
 
+/** \brief Calculates the gamma for a block from light values already read
+  * \param c                The chunk that the block resides on
+  * \param coord_y          The Y coordinate of the block
+  * \param light            The block's sky light in the high nibble and its
+  *                         block light in the low nibble, as kept by a
+  *                         chunk_surface
+  * \param sky_percent      How much sky lighting should contribute to the
+  *                         total gamma (0.0 = none, 1.0 = full)
+  * \param block_percent    How much block lighting should contribute to the
+  *                         total gamma (0.0 = none, 1.0 = full)
+  * \return The same gamma renderer_calc_gamma() gives for the block
+  */
+float renderer_light_gamma(chunk *c, int16_t coord_y, uint8_t light, float sky_percent, float block_percent);
+
 #endif
 
 
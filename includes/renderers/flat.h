@@ -10,12 +10,16 @@
 #include "level.h"
 #include "colors.h"
 #include "chunk.h"
+#include "cache.h"
 
 /** \brief The width of a flat %renderer image in pixels */
 #define RENDERER_FLAT_IMAGE_WIDTH  256
 /** \brief The height of a flat %renderer image in pixels */
 #define RENDERER_FLAT_IMAGE_HEIGHT 256
 
+/** \brief How many rows of a tile are drawn from the same row of chunks */
+#define RENDERER_FLAT_BAND_HEIGHT CHUNK_SIZE_Z
+
 /** \brief The number of slots to use for a cache */
 #define RENDERER_FLAT_CACHE_SIZE 16
 
@@ -42,13 +46,32 @@ int renderer_flat_dimensions(int *width, int *height);
 
 /** \brief Draws a single row of image data
   * \param      _r          A void pointer to a renderer
-  * \param[out] buffer      The buffer to draw upon
+  * \param[out] buffer      The buffer to draw upon, four bytes a pixel
   * \param      row_number  Which row is to be rendered
   *
   * Implements renderer_funcs.draw_row.
   */
 void renderer_flat_draw_row(void *_r, png_bytep buffer, int row_number);
 
+/** \brief Draws a whole tile, a chunk at a time
+  * \param      _r      A void pointer to a renderer
+  * \param[out] image   The tile, four bytes a pixel
+  *
+  * Each chunk is fetched once and drawn whole while its surface is at hand,
+  * rather than a row of it at a time. The pixels are the same as
+  * renderer_flat_draw_row() draws.
+  *
+  * Implements renderer_funcs.draw_tile.
+  */
+void renderer_flat_draw_tile(void *_r, png_bytep image);
+
+/** \brief Creates a cache like the one a flat %renderer starts with
+  * \return A new cache, or NULL on error.
+  *
+  * Implements renderer_funcs.new_cache.
+  */
+chunk_cache *renderer_flat_new_cache(void);
+
 /** \brief Retrieve a chunk at the given coordinates
   * \param r        The renderer whose level's chunks you want
   * \param coord_x  The X Coordinate of the chunk you want
@@ -45,6 +45,13 @@ int renderer_oblique_dimensions(int *width, int *height);
   */
 void renderer_oblique_draw_row(void *_r, png_bytep buffer, int row_number);
 
+/** \brief Creates a cache like the one an oblique %renderer starts with
+  * \return A new cache, or NULL on error.
+  *
+  * Implements renderer_funcs.new_cache.
+  */
+chunk_cache *renderer_oblique_new_cache(void);
+
 /** \brief Retrieve a chunk at the given coordinates
   * \param r        The renderer whose level's chunks you want
   * \param coord_x  The X Coordinate of the chunk you want
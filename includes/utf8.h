@@ -38,6 +38,9 @@
 #define UTF8_IGNORE_ERROR		0x01
 /** \brief Set flag to skip processing the Byte Order Mark. */
 #define UTF8_SKIP_BOM			0x02
+/** \brief Set flag to decode one octet at a time, without widening runs of
+  *        ASCII in blocks. Only useful for comparing the two. */
+#define UTF8_SCALAR			0x04
 /*@}*/
 
 /** \brief Converts a bytestream of utf8 data to wchar_t
@@ -47,6 +50,10 @@
   * \param      outsize The size of the wchar_t buffer
   * \param      flags   Optional flags to control (see \ref utf8flags utf8flags)
   * \return The number of characters written to out. Returns 0 on error.
+  *
+  * Runs of ASCII are checked and widened 16 bytes at a time with SSE2, or 8
+  * at a time elsewhere; the full decoder only sees octets with the high bit
+  * set.
   */
 size_t		utf8_to_wchar(const char *in, size_t insize, wchar_t *out,
 		    size_t outsize, int flags);
@@ -13,15 +13,16 @@
 #include "level.h"
 #include "chunk.h"
 #include "maths.h"
+#include "read_nbt.h"
+#include "arena.h"
 
 level *level_load(char *path)
 {
-    gzFile file;
-    level *new;
+    level *new = NULL;
     char *filename_buffer;
     int filename_length = strlen(path) + 15;
     nbt_tag *tag;
-    struct hashtable *hash;
+    nbt_compound *root;
 
     filename_buffer = calloc(filename_length, sizeof(char));
     if (filename_buffer == NULL)
@@ -36,31 +37,32 @@ level *level_load(char *path)
     if (snprintf(filename_buffer, filename_length, "%s/level.dat", new->input_path) == 0)
         goto level_load_error;
 
-    file = gzopen(filename_buffer, "r");
-    if (file == Z_NULL)
-        goto level_load_error;
-
-    new->data = (nbt_tag*)nbt_read(file, 0);
-    if (new->data == NULL)
+    new->buffer = nbt_buffer_open(filename_buffer);
+    if (new->buffer == NULL)
         goto level_load_error;
 
     free(filename_buffer);
     filename_buffer = NULL;
 
-    gzclose(file);
-    file = Z_NULL;
+    // The whole tree is thrown away at once by level_free()
+    new->tree_arena = arena_new(0);
+    if (new->tree_arena == NULL)
+        goto level_load_error;
+
+    new->data = nbt_read_buffer_arena(new->buffer, new->tree_arena, 0);
+    if (new->data == NULL)
+        goto level_load_error;
 
     if (wcsncmp(new->data->name, L"(null)", 7) == 0)
     {
-        hash = (struct hashtable *)nbt_payload(new->data, TAG_Compound);
-        if (hash == NULL)
+        root = (nbt_compound *)nbt_payload(new->data, TAG_Compound);
+        if (root == NULL)
             goto level_load_error;
 
-        tag = hashtable_remove(hash, L"Data");
+        tag = nbt_compound_remove(root, nbt_atom_intern("Data", 4));
         if (tag == NULL)
             goto level_load_error;
 
-        nbt_free_tag(new->data);
         new->data = tag;
     }
 
@@ -70,9 +72,6 @@ level_load_error:
     if (filename_buffer != NULL)
         free(filename_buffer);
 
-    if (file == Z_NULL)
-        gzclose(file);
-
     if (new != NULL)
         level_free(new);
 
@@ -81,13 +80,25 @@ level_load_error:
 
 void level_free(level *doomed)
 {
-    if (doomed->data != NULL)
-        nbt_free_tag(doomed->data);
+    // data lives in the arena and points into the buffer
+    if (doomed->tree_arena != NULL)
+        arena_free(doomed->tree_arena);
+
+    if (doomed->buffer != NULL)
+        nbt_buffer_free(doomed->buffer);
+
+    if (doomed->index != NULL)
+        level_index_free(doomed->index);
 
     free(doomed);
 }
 
 chunk *level_get_chunk_at(level *lvl, int coord_x, int coord_z)
+{
+    return level_get_chunk_with(lvl, NULL, coord_x, coord_z);
+}
+
+chunk *level_get_chunk_with(level *lvl, nbt_loader *ctx, int coord_x, int coord_z)
 {
     int directory_x, directory_z;
     char dir_x_base36[LEVEL_BASE_36_SIZE], dir_z_base36[LEVEL_BASE_36_SIZE];
@@ -95,6 +106,11 @@ chunk *level_get_chunk_at(level *lvl, int coord_x, int coord_z)
     char input_file[LEVEL_BUFFER_SIZE];
     struct stat st;
 
+    // The index knows whether the file is there without asking the disk, so
+    // a missing chunk never has its path built
+    if (lvl->index != NULL && level_index_find(lvl->index, coord_x, coord_z) == NULL)
+        return NULL;
+
     if (base10tobase36(coord_x, coord_x_base36, LEVEL_BASE_36_SIZE))
         return NULL;
 
@@ -122,110 +138,105 @@ chunk *level_get_chunk_at(level *lvl, int coord_x, int coord_z)
         return NULL;
     }
 
-    if (stat(input_file, &st))
-    {
+    // Without an index, the file has to be looked for
+    if (lvl->index == NULL && stat(input_file, &st))
         return NULL;
-    }
+
+    if (ctx != NULL)
+        return chunk_new_with(ctx, input_file, coord_x, coord_z);
 
     return chunk_new(input_file, coord_x, coord_z);
 }
 
 void level_get_dimensions(level *lvl)
 {
-    DIR *world, *x_dir, *z_dir;
-    struct dirent *world_entry, *x_entry, *z_entry;
-    int smallest_x = 0, smallest_z = 0, largest_x = 0, largest_z = 0;
-    int32_t chunk_x, chunk_z;
-    uint64_t chunk_count = 0;
-    struct stat st;
-    char x_path[LEVEL_BUFFER_SIZE], z_path[LEVEL_BUFFER_SIZE], chunk_path[LEVEL_BUFFER_SIZE];
-    const char *format = "%s/%s";
-    extern int errno;
+    level_scan *scan;
 
     if (lvl == NULL)
         return;
 
-    stat(lvl->input_path, &st);
-    if (!S_ISDIR(st.st_mode))
+    if (lvl->index != NULL)
+    {
+        lvl->smallest_x = lvl->index->smallest_x;
+        lvl->smallest_z = lvl->index->smallest_z;
+        lvl->largest_x = lvl->index->largest_x;
+        lvl->largest_z = lvl->index->largest_z;
+        lvl->chunk_count = lvl->index->count;
         return;
+    }
 
-    world = opendir(lvl->input_path);
-    if (world == NULL)
+    scan = level_scan_world(lvl->input_path, 0);
+    if (scan == NULL)
         return;
 
-    while ((world_entry = readdir(world)) != NULL)
-    {
-        if (world_entry->d_name[0] == '.')
-            continue;
+    lvl->smallest_x = scan->smallest_x;
+    lvl->smallest_z = scan->smallest_z;
+    lvl->largest_x = scan->largest_x;
+    lvl->largest_z = scan->largest_z;
+    lvl->chunk_count = scan->count;
 
-        if (snprintf(x_path, LEVEL_BUFFER_SIZE, format, lvl->input_path, world_entry->d_name) == -1)
-            continue;
+    level_scan_free(scan);
+}
 
-        if (stat(x_path, &st))
-            continue;
+int level_load_index(level *lvl)
+{
+    level_index *index;
+
+    if (lvl == NULL)
+        return -1;
+
+    index = level_index_open(lvl->input_path);
+    if (index == NULL)
+        return -1;
+
+    if (lvl->index != NULL)
+        level_index_free(lvl->index);
+
+    lvl->index = index;
+    level_get_dimensions(lvl);
+
+    return 0;
+}
+
+level_scan *level_get_chunks(level *lvl)
+{
+    level_scan *scan;
+    uint32_t i;
+
+    if (lvl == NULL)
+        return NULL;
+
+    if (lvl->index == NULL)
+        return level_scan_world(lvl->input_path, 0);
 
-        if (S_ISDIR(st.st_mode))
+    scan = calloc(1, sizeof(level_scan));
+    if (scan == NULL)
+        return NULL;
+
+    if (lvl->index->count > 0)
+    {
+        scan->coords = malloc(lvl->index->count * sizeof(level_scan_coords));
+        if (scan->coords == NULL)
         {
-            x_dir = opendir(x_path);
-            if (x_dir == NULL)
-                continue;
-
-            while ((x_entry = readdir(x_dir)) != NULL)
-            {
-                if (x_entry->d_name[0] == '.')
-                    continue;
-
-                if (snprintf(z_path, LEVEL_BUFFER_SIZE, format, x_path, x_entry->d_name) == -1)
-                    continue;
-
-                if (stat(z_path, &st))
-                    continue;
-
-                if (S_ISDIR(st.st_mode))
-                {
-                    z_dir = opendir(z_path);
-                    if (z_dir == NULL)
-                        continue;
-
-                    while ((z_entry = readdir(z_dir)) != NULL)
-                    {
-                        if (z_entry->d_name[0] == '.')
-                            continue;
-
-                        if (snprintf(chunk_path, LEVEL_BUFFER_SIZE, format, z_path, z_entry->d_name) == -1)
-                            continue;
-
-                        if (stat(chunk_path, &st))
-                            continue;
-
-                        if (S_ISREG(st.st_mode) && 
-                            chunk_get_coords_from_filename(chunk_path, &chunk_x, &chunk_z) == 0
-                           )
-                        {
-                            chunk_count++;
-
-                            if (chunk_x < smallest_x)
-                                smallest_x = chunk_x;
-                            if (chunk_z < smallest_z)
-                                smallest_z = chunk_z;
-
-                            if (chunk_x > largest_x)
-                                largest_x = chunk_x;
-                            if (chunk_z > largest_z)
-                                largest_z = chunk_z;
-                        }
-                    }
-                    closedir(z_dir);
-                }
-            }
-            closedir(x_dir);
+            free(scan);
+            return NULL;
         }
     }
-    closedir(world);
 
-    lvl->smallest_x = smallest_x;
-    lvl->smallest_z = smallest_z;
-    lvl->largest_x = largest_x;
-    lvl->largest_z = largest_z;
-    lvl->chunk_count = chunk_count;
+    for (i = 0; i < lvl->index->count; i++)
+    {
+        scan->coords[i].coord_x = lvl->index->entries[i].coord_x;
+        scan->coords[i].coord_z = lvl->index->entries[i].coord_z;
+    }
+
+    scan->count = lvl->index->count;
+    scan->smallest_x = lvl->index->smallest_x;
+    scan->smallest_z = lvl->index->smallest_z;
+    scan->largest_x = lvl->index->largest_x;
+    scan->largest_z = lvl->index->largest_z;
+
+    // The index keeps them by directory
+    level_scan_sort(scan);
+
+    return scan;
 }
@@ -0,0 +1,460 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "level.h"
+#include "level_index.h"
+#include "chunk.h"
+#include "maths.h"
+
+// How many directories there are in all
+#define LEVEL_INDEX_DIRECTORY_COUNT (LEVEL_INDEX_DIRECTORIES * LEVEL_INDEX_DIRECTORIES)
+
+// An mtime in nanoseconds, which is fine enough to tell apart two saves
+// within the same second
+#define LEVEL_INDEX_MTIME(st) ((int64_t)(st).st_mtim.tv_sec * 1000000000 + (st).st_mtim.tv_nsec)
+
+// Which slot the search for a chunk starts at
+#define LEVEL_INDEX_HASH(x, z) ((uint32_t)(x) * 0x9E3779B1U ^ (uint32_t)(z) * 0x85EBCA77U)
+
+/** \brief What precedes the directories and entries in an index file */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t directories;
+    int32_t smallest_x;
+    int32_t smallest_z;
+    int32_t largest_x;
+    int32_t largest_z;
+} level_index_header;
+
+static void level_index_read(level_index *index, const char *input_path);
+static int level_index_refresh(level_index *index, const char *input_path);
+static int level_index_scan(level_index_entry **entries, uint32_t *count, uint32_t *capacity, const char *z_path, int directory_x, int directory_z);
+static int level_index_append(level_index_entry **entries, uint32_t *count, uint32_t *capacity, const level_index_entry *entry);
+static int level_index_compare(const void *a, const void *b);
+static int level_index_hash(level_index *index);
+static void level_index_bounds(level_index *index);
+static void level_index_write(const level_index *index, const char *input_path);
+
+level_index *level_index_open(const char *input_path)
+{
+    level_index *new;
+    int i, changed;
+
+    new = calloc(1, sizeof(level_index));
+    if (new == NULL)
+        return NULL;
+
+    for (i = 0; i < LEVEL_INDEX_DIRECTORY_COUNT; i++)
+        new->directories[i].mtime = LEVEL_INDEX_UNSCANNED;
+
+    // Whatever was saved last time is only a starting point; a file that
+    // can't be read back just means every directory gets scanned
+    level_index_read(new, input_path);
+
+    changed = level_index_refresh(new, input_path);
+    if (changed < 0)
+        goto level_index_open_error;
+
+    if (level_index_hash(new))
+        goto level_index_open_error;
+
+    if (changed)
+    {
+        level_index_bounds(new);
+        level_index_write(new, input_path);
+    }
+
+    return new;
+
+level_index_open_error:
+    level_index_free(new);
+    return NULL;
+}
+
+void level_index_free(level_index *doomed)
+{
+    if (doomed == NULL)
+        return;
+
+    if (doomed->entries != NULL)
+        free(doomed->entries);
+
+    if (doomed->slots != NULL)
+        free(doomed->slots);
+
+    free(doomed);
+}
+
+const level_index_entry *level_index_find(const level_index *index, int32_t coord_x, int32_t coord_z)
+{
+    const level_index_entry *entry;
+    uint32_t slot;
+
+    if (index->slots == NULL)
+        return NULL;
+
+    // Linear probing; there are always at least twice as many slots as
+    // entries, so an empty one turns up quickly
+    for (slot = LEVEL_INDEX_HASH(coord_x, coord_z) & index->slot_mask;
+         index->slots[slot] != 0;
+         slot = (slot + 1) & index->slot_mask)
+    {
+        entry = index->entries + index->slots[slot] - 1;
+        if (entry->coord_x == coord_x && entry->coord_z == coord_z)
+            return entry;
+    }
+
+    return NULL;
+}
+
+/* Loads the index file saved in the world directory, if there's a valid one.
+ * The index is left empty otherwise. */
+static void level_index_read(level_index *index, const char *input_path)
+{
+    char path[LEVEL_BUFFER_SIZE];
+    level_index_header header;
+    level_index_directory directories[LEVEL_INDEX_DIRECTORY_COUNT];
+    level_index_entry *entries = NULL;
+    FILE *file;
+    int i;
+
+    if (snprintf(path, LEVEL_BUFFER_SIZE, "%s/%s", input_path, LEVEL_INDEX_FILENAME) >= LEVEL_BUFFER_SIZE)
+        return;
+
+    file = fopen(path, "rb");
+    if (file == NULL)
+        return;
+
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != LEVEL_INDEX_MAGIC ||
+        header.version != LEVEL_INDEX_VERSION ||
+        header.directories != LEVEL_INDEX_DIRECTORY_COUNT)
+        goto level_index_read_cleanup;
+
+    if (fread(directories, sizeof(directories), 1, file) != 1)
+        goto level_index_read_cleanup;
+
+    // Every directory has to point inside the entries, or none of it can be
+    // trusted
+    for (i = 0; i < LEVEL_INDEX_DIRECTORY_COUNT; i++)
+        if (directories[i].first > header.count || directories[i].count > header.count - directories[i].first)
+            goto level_index_read_cleanup;
+
+    if (header.count > 0)
+    {
+        entries = malloc(header.count * sizeof(level_index_entry));
+        if (entries == NULL || fread(entries, sizeof(level_index_entry), header.count, file) != header.count)
+            goto level_index_read_cleanup;
+    }
+
+    memcpy(index->directories, directories, sizeof(directories));
+    index->entries = entries;
+    index->count = header.count;
+    index->smallest_x = header.smallest_x;
+    index->smallest_z = header.smallest_z;
+    index->largest_x = header.largest_x;
+    index->largest_z = header.largest_z;
+    entries = NULL;
+
+level_index_read_cleanup:
+    if (entries != NULL)
+        free(entries);
+
+    fclose(file);
+}
+
+/* Brings the index up to date with the world directory, scanning only the
+ * directories whose mtime has changed. Returns 1 if anything changed, 0 if
+ * nothing did and -1 on error. */
+static int level_index_refresh(level_index *index, const char *input_path)
+{
+    level_index_directory directories[LEVEL_INDEX_DIRECTORY_COUNT];
+    level_index_directory *old;
+    level_index_entry *entries = NULL;
+    uint32_t count = 0, capacity = 0, directory, i;
+    uint64_t present;
+    char x_name[LEVEL_BASE_36_SIZE], z_name[LEVEL_BASE_36_SIZE];
+    char x_path[LEVEL_BUFFER_SIZE], z_path[LEVEL_BUFFER_SIZE];
+    DIR *x_dir;
+    struct dirent *x_entry;
+    struct stat st;
+    int directory_x, directory_z, changed = 0;
+    int64_t number;
+    extern __thread int base36_errno;
+
+    if (stat(input_path, &st) || !S_ISDIR(st.st_mode))
+        return -1;
+
+    for (i = 0; i < LEVEL_INDEX_DIRECTORY_COUNT; i++)
+    {
+        directories[i].mtime = LEVEL_INDEX_UNSCANNED;
+        directories[i].first = 0;
+        directories[i].count = 0;
+    }
+
+    for (directory_x = 0; directory_x < LEVEL_INDEX_DIRECTORIES; directory_x++)
+    {
+        if (base10tobase36(directory_x, x_name, LEVEL_BASE_36_SIZE))
+            goto level_index_refresh_error;
+
+        if (snprintf(x_path, LEVEL_BUFFER_SIZE, "%s/%s", input_path, x_name) >= LEVEL_BUFFER_SIZE)
+            continue;
+
+        x_dir = opendir(x_path);
+        if (x_dir == NULL)
+            continue;
+
+        // Note which Z directories exist first, so they're visited in order
+        // and the index comes out the same whatever order readdir() uses
+        present = 0;
+        while ((x_entry = readdir(x_dir)) != NULL)
+        {
+            if (x_entry->d_name[0] == '.')
+                continue;
+
+            number = base36tobase10(x_entry->d_name, strlen(x_entry->d_name));
+            if (base36_errno != BASE36_OK || number < 0 || number >= LEVEL_INDEX_DIRECTORIES)
+                continue;
+
+            present |= (uint64_t)1 << number;
+        }
+        closedir(x_dir);
+
+        for (directory_z = 0; directory_z < LEVEL_INDEX_DIRECTORIES; directory_z++)
+        {
+            if (!(present >> directory_z & 1))
+                continue;
+
+            if (base10tobase36(directory_z, z_name, LEVEL_BASE_36_SIZE))
+                goto level_index_refresh_error;
+
+            if (snprintf(z_path, LEVEL_BUFFER_SIZE, "%s/%s", x_path, z_name) >= LEVEL_BUFFER_SIZE)
+                continue;
+
+            if (stat(z_path, &st) || !S_ISDIR(st.st_mode))
+                continue;
+
+            directory = directory_x * LEVEL_INDEX_DIRECTORIES + directory_z;
+            old = index->directories + directory;
+            directories[directory].mtime = LEVEL_INDEX_MTIME(st);
+            directories[directory].first = count;
+
+            if (old->mtime == directories[directory].mtime)
+            {
+                // Nothing was added, removed or saved here since last time
+                for (i = old->first; i < old->first + old->count; i++)
+                    if (level_index_append(&entries, &count, &capacity, index->entries + i))
+                        goto level_index_refresh_error;
+            }
+            else
+            {
+                if (level_index_scan(&entries, &count, &capacity, z_path, directory_x, directory_z))
+                    goto level_index_refresh_error;
+
+                index->rescanned++;
+                changed = 1;
+            }
+
+            directories[directory].count = count - directories[directory].first;
+        }
+    }
+
+    // A directory that's gone is a change too
+    for (i = 0; i < LEVEL_INDEX_DIRECTORY_COUNT && !changed; i++)
+        if (index->directories[i].mtime != directories[i].mtime)
+            changed = 1;
+
+    if (index->entries != NULL)
+        free(index->entries);
+
+    memcpy(index->directories, directories, sizeof(directories));
+    index->entries = entries;
+    index->count = count;
+
+    return changed;
+
+level_index_refresh_error:
+    if (entries != NULL)
+        free(entries);
+
+    return -1;
+}
+
+/* Adds every chunk file in a directory to the entries, sorted */
+static int level_index_scan(level_index_entry **entries, uint32_t *count, uint32_t *capacity, const char *z_path, int directory_x, int directory_z)
+{
+    char chunk_path[LEVEL_BUFFER_SIZE];
+    level_index_entry entry;
+    DIR *z_dir;
+    struct dirent *z_entry;
+    struct stat st;
+    uint32_t first = *count;
+    int status = 0;
+
+    z_dir = opendir(z_path);
+    if (z_dir == NULL)
+        return 0;
+
+    memset(&entry, 0, sizeof(entry));
+    while ((z_entry = readdir(z_dir)) != NULL)
+    {
+        if (z_entry->d_name[0] == '.')
+            continue;
+
+        if (chunk_get_coords_from_filename(z_entry->d_name, &entry.coord_x, &entry.coord_z))
+            continue;
+
+        // A chunk is only ever looked for in the directory its coordinates
+        // name, so one anywhere else may as well not exist
+        if ((unsigned int)entry.coord_x % LEVEL_INDEX_DIRECTORIES != directory_x ||
+            (unsigned int)entry.coord_z % LEVEL_INDEX_DIRECTORIES != directory_z)
+            continue;
+
+        if (snprintf(chunk_path, LEVEL_BUFFER_SIZE, "%s/%s", z_path, z_entry->d_name) >= LEVEL_BUFFER_SIZE)
+            continue;
+
+        if (stat(chunk_path, &st) || !S_ISREG(st.st_mode))
+            continue;
+
+        entry.size = st.st_size;
+        entry.mtime = LEVEL_INDEX_MTIME(st);
+
+        if (level_index_append(entries, count, capacity, &entry))
+        {
+            status = -1;
+            break;
+        }
+    }
+    closedir(z_dir);
+
+    if (status == 0)
+        qsort(*entries + first, *count - first, sizeof(level_index_entry), level_index_compare);
+
+    return status;
+}
+
+/* Adds an entry to a growing array of them */
+static int level_index_append(level_index_entry **entries, uint32_t *count, uint32_t *capacity, const level_index_entry *entry)
+{
+    level_index_entry *grown;
+    uint32_t size;
+
+    if (*count == *capacity)
+    {
+        size = *capacity == 0 ? 256 : *capacity * 2;
+        grown = realloc(*entries, size * sizeof(level_index_entry));
+        if (grown == NULL)
+            return -1;
+
+        *entries = grown;
+        *capacity = size;
+    }
+
+    (*entries)[(*count)++] = *entry;
+    return 0;
+}
+
+static int level_index_compare(const void *a, const void *b)
+{
+    const level_index_entry *left = a, *right = b;
+
+    if (left->coord_x != right->coord_x)
+        return left->coord_x < right->coord_x ? -1 : 1;
+
+    if (left->coord_z != right->coord_z)
+        return left->coord_z < right->coord_z ? -1 : 1;
+
+    return 0;
+}
+
+/* Builds the hash of every entry's coordinates */
+static int level_index_hash(level_index *index)
+{
+    uint32_t size = 64, slot, i;
+
+    while (size < index->count * 2)
+        size *= 2;
+
+    index->slots = calloc(size, sizeof(uint32_t));
+    if (index->slots == NULL)
+        return -1;
+    index->slot_mask = size - 1;
+
+    for (i = 0; i < index->count; i++)
+    {
+        slot = LEVEL_INDEX_HASH(index->entries[i].coord_x, index->entries[i].coord_z) & index->slot_mask;
+        while (index->slots[slot] != 0)
+            slot = (slot + 1) & index->slot_mask;
+
+        index->slots[slot] = i + 1;
+    }
+
+    return 0;
+}
+
+/* Works out the smallest and largest coordinates of the chunks */
+static void level_index_bounds(level_index *index)
+{
+    level_index_entry *entry;
+    uint32_t i;
+
+    index->smallest_x = index->smallest_z = 0;
+    index->largest_x = index->largest_z = 0;
+
+    for (i = 0; i < index->count; i++)
+    {
+        entry = index->entries + i;
+
+        if (i == 0 || entry->coord_x < index->smallest_x)
+            index->smallest_x = entry->coord_x;
+        if (i == 0 || entry->coord_z < index->smallest_z)
+            index->smallest_z = entry->coord_z;
+
+        if (i == 0 || entry->coord_x > index->largest_x)
+            index->largest_x = entry->coord_x;
+        if (i == 0 || entry->coord_z > index->largest_z)
+            index->largest_z = entry->coord_z;
+    }
+}
+
+/* Saves the index in the world directory. It's written to a temporary file
+ * and renamed over the old one, so a reader never sees half of it. */
+static void level_index_write(const level_index *index, const char *input_path)
+{
+    char path[LEVEL_BUFFER_SIZE], temporary[LEVEL_BUFFER_SIZE];
+    level_index_header header;
+    FILE *file;
+    int failed;
+
+    if (snprintf(path, LEVEL_BUFFER_SIZE, "%s/%s", input_path, LEVEL_INDEX_FILENAME) >= LEVEL_BUFFER_SIZE ||
+        snprintf(temporary, LEVEL_BUFFER_SIZE, "%s.tmp", path) >= LEVEL_BUFFER_SIZE)
+        return;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = LEVEL_INDEX_MAGIC;
+    header.version = LEVEL_INDEX_VERSION;
+    header.count = index->count;
+    header.directories = LEVEL_INDEX_DIRECTORY_COUNT;
+    header.smallest_x = index->smallest_x;
+    header.smallest_z = index->smallest_z;
+    header.largest_x = index->largest_x;
+    header.largest_z = index->largest_z;
+
+    file = fopen(temporary, "wb");
+    if (file == NULL)
+        return;
+
+    failed = fwrite(&header, sizeof(header), 1, file) != 1 ||
+             fwrite(index->directories, sizeof(index->directories), 1, file) != 1 ||
+             fwrite(index->entries, sizeof(level_index_entry), index->count, file) != index->count;
+
+    if (fclose(file) || failed || rename(temporary, path))
+        remove(temporary);
+}
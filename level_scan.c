@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "level.h"
+#include "level_scan.h"
+#include "chunk.h"
+#include "maths.h"
+
+// How many directories there are along each axis
+#define LEVEL_SCAN_DIRECTORIES 64
+
+/** \brief The directories a scan hands out to its threads */
+typedef struct
+{
+    int world_fd;                       /**< \brief The world directory */
+    char names[LEVEL_SCAN_DIRECTORIES][LEVEL_BASE_36_SIZE];
+                                        /**< \brief The X directories */
+    int numbers[LEVEL_SCAN_DIRECTORIES];/**< \brief What each is named for */
+    int directories;                    /**< \brief How many there are */
+    int next;                           /**< \brief The next one to hand out
+                                          */
+    pthread_mutex_t lock;               /**< \brief Guards next */
+} level_scan_work;
+
+/** \brief One thread of a scan, and the chunks it found */
+typedef struct
+{
+    level_scan_work *work;
+    level_scan_coords *coords;
+    uint64_t count;
+    uint64_t capacity;
+    int error;
+    pthread_t thread;
+} level_scan_worker;
+
+static int level_scan_directory_number(char *name, int *number);
+static int level_scan_is(int dir_fd, struct dirent *entry, unsigned char type);
+static void *level_scan_run(void *data);
+static int level_scan_x(level_scan_worker *worker, int index);
+static int level_scan_append(level_scan_worker *worker, int32_t coord_x, int32_t coord_z);
+static int level_scan_compare(const void *a, const void *b);
+
+level_scan *level_scan_world(const char *input_path, int threads)
+{
+    level_scan_work work;
+    level_scan_worker workers[LEVEL_SCAN_MAX_THREADS];
+    level_scan *scan = NULL;
+    level_scan_coords *coords;
+    DIR *world;
+    struct dirent *entry;
+    uint64_t count = 0;
+    long processors;
+    int i, number, started = 1, error = 0;
+
+    memset(&work, 0, sizeof(work));
+    memset(workers, 0, sizeof(workers));
+
+    work.world_fd = open(input_path, O_RDONLY | O_DIRECTORY);
+    if (work.world_fd < 0)
+        return NULL;
+
+    // fdopendir() takes the descriptor over, so it gets one of its own
+    world = fdopendir(dup(work.world_fd));
+    if (world == NULL)
+    {
+        close(work.world_fd);
+        return NULL;
+    }
+
+    while ((entry = readdir(world)) != NULL && work.directories < LEVEL_SCAN_DIRECTORIES)
+    {
+        if (level_scan_directory_number(entry->d_name, &number))
+            continue;
+
+        if (!level_scan_is(work.world_fd, entry, DT_DIR))
+            continue;
+
+        strcpy(work.names[work.directories], entry->d_name);
+        work.numbers[work.directories] = number;
+        work.directories++;
+    }
+    closedir(world);
+
+    if (threads <= 0)
+    {
+        processors = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = processors > 0 ? processors : 1;
+    }
+    if (threads > LEVEL_SCAN_MAX_THREADS)
+        threads = LEVEL_SCAN_MAX_THREADS;
+    if (threads > work.directories)
+        threads = work.directories > 0 ? work.directories : 1;
+
+    pthread_mutex_init(&work.lock, NULL);
+
+    // The calling thread is the first worker. If a thread can't be started,
+    // the ones that did just do more of the work.
+    for (i = 0; i < threads; i++)
+        workers[i].work = &work;
+
+    for (i = 1; i < threads; i++)
+    {
+        if (pthread_create(&workers[i].thread, NULL, level_scan_run, workers + i))
+            break;
+        started++;
+    }
+
+    level_scan_run(workers);
+
+    for (i = 1; i < started; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    pthread_mutex_destroy(&work.lock);
+    close(work.world_fd);
+
+    for (i = 0; i < started; i++)
+    {
+        error |= workers[i].error;
+        count += workers[i].count;
+    }
+
+    if (error)
+        goto level_scan_world_cleanup;
+
+    scan = calloc(1, sizeof(level_scan));
+    if (scan == NULL)
+        goto level_scan_world_cleanup;
+
+    if (count > 0)
+    {
+        scan->coords = malloc(count * sizeof(level_scan_coords));
+        if (scan->coords == NULL)
+        {
+            free(scan);
+            scan = NULL;
+            goto level_scan_world_cleanup;
+        }
+    }
+
+    for (i = 0, coords = scan->coords; i < started; i++)
+    {
+        if (workers[i].count > 0)
+            memcpy(coords, workers[i].coords, workers[i].count * sizeof(level_scan_coords));
+        coords += workers[i].count;
+    }
+    scan->count = count;
+
+    // Which thread found what depends on timing, so sort it all out
+    level_scan_sort(scan);
+
+    if (count > 0)
+    {
+        scan->smallest_x = scan->coords[0].coord_x;
+        scan->largest_x = scan->coords[count - 1].coord_x;
+        scan->smallest_z = scan->largest_z = scan->coords[0].coord_z;
+    }
+
+    for (coords = scan->coords; coords < scan->coords + count; coords++)
+    {
+        if (coords->coord_z < scan->smallest_z)
+            scan->smallest_z = coords->coord_z;
+        if (coords->coord_z > scan->largest_z)
+            scan->largest_z = coords->coord_z;
+    }
+
+level_scan_world_cleanup:
+    for (i = 0; i < started; i++)
+        if (workers[i].coords != NULL)
+            free(workers[i].coords);
+
+    return scan;
+}
+
+void level_scan_sort(level_scan *scan)
+{
+    if (scan->count > 0)
+        qsort(scan->coords, scan->count, sizeof(level_scan_coords), level_scan_compare);
+}
+
+void level_scan_free(level_scan *doomed)
+{
+    if (doomed == NULL)
+        return;
+
+    if (doomed->coords != NULL)
+        free(doomed->coords);
+
+    free(doomed);
+}
+
+/* Works out which of the 64 directories a name is, if it's one of them */
+static int level_scan_directory_number(char *name, int *number)
+{
+    char canonical[LEVEL_BASE_36_SIZE];
+    int64_t value;
+    extern __thread int base36_errno;
+
+    if (name[0] == '.')
+        return -1;
+
+    value = base36tobase10(name, strlen(name));
+    if (base36_errno != BASE36_OK || value < 0 || value >= LEVEL_SCAN_DIRECTORIES)
+        return -1;
+
+    // Only the name level_get_chunk_at() would build counts
+    if (base10tobase36(value, canonical, LEVEL_BASE_36_SIZE) || strcmp(canonical, name) != 0)
+        return -1;
+
+    *number = value;
+    return 0;
+}
+
+/* Checks what a directory entry is, which only costs a stat() when the
+ * filesystem doesn't say or the entry is a link */
+static int level_scan_is(int dir_fd, struct dirent *entry, unsigned char type)
+{
+    struct stat st;
+
+    if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK)
+        return entry->d_type == type;
+
+    if (fstatat(dir_fd, entry->d_name, &st, 0))
+        return 0;
+
+    return type == DT_DIR ? S_ISDIR(st.st_mode) : S_ISREG(st.st_mode);
+}
+
+/* Scans X directories until there are none left */
+static void *level_scan_run(void *data)
+{
+    level_scan_worker *worker = data;
+    level_scan_work *work = worker->work;
+    int index;
+
+    while (!worker->error)
+    {
+        pthread_mutex_lock(&work->lock);
+        index = work->next++;
+        pthread_mutex_unlock(&work->lock);
+
+        if (index >= work->directories)
+            break;
+
+        if (level_scan_x(worker, index))
+            worker->error = 1;
+    }
+
+    return NULL;
+}
+
+/* Finds the chunks in every Z directory of an X directory */
+static int level_scan_x(level_scan_worker *worker, int index)
+{
+    level_scan_work *work = worker->work;
+    DIR *x_dir, *z_dir;
+    struct dirent *x_entry, *z_entry;
+    int32_t coord_x, coord_z;
+    int fd, directory_z, status = 0;
+
+    fd = openat(work->world_fd, work->names[index], O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return 0;
+
+    x_dir = fdopendir(fd);
+    if (x_dir == NULL)
+    {
+        close(fd);
+        return 0;
+    }
+
+    while (status == 0 && (x_entry = readdir(x_dir)) != NULL)
+    {
+        if (level_scan_directory_number(x_entry->d_name, &directory_z))
+            continue;
+
+        if (!level_scan_is(dirfd(x_dir), x_entry, DT_DIR))
+            continue;
+
+        fd = openat(dirfd(x_dir), x_entry->d_name, O_RDONLY | O_DIRECTORY);
+        if (fd < 0)
+            continue;
+
+        z_dir = fdopendir(fd);
+        if (z_dir == NULL)
+        {
+            close(fd);
+            continue;
+        }
+
+        while ((z_entry = readdir(z_dir)) != NULL)
+        {
+            if (z_entry->d_name[0] == '.')
+                continue;
+
+            if (chunk_get_coords_from_filename(z_entry->d_name, &coord_x, &coord_z))
+                continue;
+
+            if ((unsigned int)coord_x % LEVEL_SCAN_DIRECTORIES != work->numbers[index] ||
+                (unsigned int)coord_z % LEVEL_SCAN_DIRECTORIES != directory_z)
+                continue;
+
+            if (!level_scan_is(dirfd(z_dir), z_entry, DT_REG))
+                continue;
+
+            if (level_scan_append(worker, coord_x, coord_z))
+            {
+                status = -1;
+                break;
+            }
+        }
+        closedir(z_dir);
+    }
+    closedir(x_dir);
+
+    return status;
+}
+
+/* Adds a chunk to what a thread has found */
+static int level_scan_append(level_scan_worker *worker, int32_t coord_x, int32_t coord_z)
+{
+    level_scan_coords *grown;
+    uint64_t size;
+
+    if (worker->count == worker->capacity)
+    {
+        size = worker->capacity == 0 ? 256 : worker->capacity * 2;
+        grown = realloc(worker->coords, size * sizeof(level_scan_coords));
+        if (grown == NULL)
+            return -1;
+
+        worker->coords = grown;
+        worker->capacity = size;
+    }
+
+    worker->coords[worker->count].coord_x = coord_x;
+    worker->coords[worker->count].coord_z = coord_z;
+    worker->count++;
+
+    return 0;
+}
+
+static int level_scan_compare(const void *a, const void *b)
+{
+    const level_scan_coords *left = a, *right = b;
+
+    if (left->coord_x != right->coord_x)
+        return left->coord_x < right->coord_x ? -1 : 1;
+
+    if (left->coord_z != right->coord_z)
+        return left->coord_z < right->coord_z ? -1 : 1;
+
+    return 0;
+}
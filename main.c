@@ -6,12 +6,16 @@
 #include <string.h>
 #include <locale.h>
 #include <math.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 
 #include "main.h"
 #include "config.h"
 #include "nbt.h"
 #include "level.h"
 #include "chunk.h"
+#include "chunk_pool.h"
 #include "colors.h"
 #include "colors/hardcoded.h"
 #include "renderer.h"
@@ -20,11 +24,13 @@
 int main (int argc, char **argv)
 {
     configuration config;
+    chunk_pool_stats stats;
     level *l = NULL;
     color_map *map = NULL;
     renderer *r = NULL;
-    int errcode = 0, i, tile_x, tile_z, tile_x_start, tile_x_end, tile_z_start, tile_z_end;
-    char filename_buffer[256];
+    renderer_tile *tiles = NULL;
+    uint64_t tile_count, failed;
+    int errcode = 0;
 
     if (!setlocale(LC_CTYPE, ""))
     {
@@ -38,6 +44,12 @@ int main (int argc, char **argv)
         goto main_cleanup;
     }
 
+    if (config.trusted)
+        chunk_load_flags |= NBT_BUFFER_TRUSTED;
+
+    if (config.packed)
+        chunk_load_flags |= CHUNK_LOAD_PACKED;
+
     map = color_map_hardcoded_new(256, 4);
     if (map == NULL)
     {
@@ -52,14 +64,25 @@ int main (int argc, char **argv)
         goto main_cleanup;
     }
 
-    /*
-    level_get_dimensions(l);
+    // Without the index, every chunk is looked for on disk instead
+    if (config.index && level_load_index(l))
+        fprintf(stderr, "Couldn't index the level, carrying on without it\n");
+
+    // A batch only renders the tiles that have something in them
+    if (config.batch)
+    {
+        if (renderer_list_tiles(l, config.has_tile_rect ? config.tile_rect : NULL, &tiles, &tile_count))
+        {
+            printf("Error listing the level's tiles\n");
+            goto main_cleanup;
+        }
 
-    tile_x_start = (int)floor(l->smallest_x / 16) - 1;
-    tile_x_end = (int)floor(l->largest_x / 16);
-    tile_z_start = (int)floor(l->smallest_z / 16) - 1;
-    tile_z_end = (int)floor(l->largest_z / 16);
-    */
+        if (mkdir(config.output_filename, 0777) && errno != EEXIST)
+        {
+            printf("Unable to create %s\n", config.output_filename);
+            goto main_cleanup;
+        }
+    }
 
     r = renderer_flat_new(l, map);
     if (r == NULL)
@@ -68,25 +91,33 @@ int main (int argc, char **argv)
         goto main_cleanup;
     }
 
-    if (errcode = renderer_perform(r, config.tile_x, config.tile_z, config.output_filename))
+    if (config.batch)
+    {
+        failed = renderer_perform_parallel(r, tiles, tile_count, config.output_filename, config.threads);
+        printf("Rendered %llu tiles into %s", (unsigned long long)(tile_count - failed), config.output_filename);
+        if (failed > 0)
+            printf(", %llu failed", (unsigned long long)failed);
+        printf("\n");
+    }
+    else if (errcode = renderer_perform_bands(r, config.tile_x, config.tile_z, config.output_filename, config.threads))
     {
         printf("Rendering failed: %i\n", errcode);
     }
 
-    /*
-    for (tile_x = tile_x_start; tile_x <= tile_x_end; tile_x++)
-        for (tile_z = tile_z_start; tile_z <= tile_z_end; tile_z++)
-        {
-            memset(filename_buffer, 0, 256);
-            snprintf(filename_buffer, 256, "%s/tile_%i_%i.png", config.output_filename, tile_x, tile_z);
-            if (errcode = renderer_perform(r, tile_x, tile_z, filename_buffer))
-            {
-                printf("Rendering failed: %i\n", errcode);
-            }
-        }
-    */
+    // The render's own threads are joined by now, so their pools count too
+    if (config.stats)
+    {
+        chunk_pool_get_stats(&stats);
+        fprintf(stderr, "chunk blocks over %llu threads: %llu allocated, %llu reused, %lld KB at most in use, %lld KB pooled\n",
+                (unsigned long long)stats.threads,
+                (unsigned long long)stats.allocations, (unsigned long long)stats.reused,
+                (long long)stats.high_water / 1024, (long long)stats.pooled / 1024);
+    }
 
 main_cleanup:
+    if (tiles != NULL)
+        free(tiles);
+
     if (r != NULL)
         renderer_free(r);
     else
@@ -5,7 +5,7 @@
 
 #include "maths.h"
 
-int base36_errno;
+__thread int base36_errno;
 
 int64_t base36tobase10(char *base36, int length)
 {
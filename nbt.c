@@ -6,11 +6,24 @@
 #include <math.h>
 #include "nbt.h"
 #include "linked_list.h"
+#include "arena.h"
+#include "nbt_atom.h"
+#include "nbt_compound.h"
 #include "main.h"
 
 nbt_tag *nbt_new_tag(uint8_t tag_type, wchar_t *name, uint16_t name_len, u_tag_meta *meta, u_tag_payload *payload)
 {
     nbt_tag *new; 
+    const nbt_atom *atom = NULL;
+
+    // The tag owns the name it was given, but keeps the interned copy
+    if (name != NULL)
+    {
+        atom = nbt_atom_intern_wide(name, wcsnlen(name, name_len));
+        free(name);
+        if (atom == NULL)
+            return NULL;
+    }
 
     new = malloc(sizeof(nbt_tag));
     if (new == NULL)
@@ -26,19 +39,111 @@ nbt_tag *nbt_new_tag(uint8_t tag_type, wchar_t *name, uint16_t name_len, u_tag_m
         new->type = tag_type;
     }
 
-    new->name = name;
-    new->name_len = name_len;
+    new->flags = 0;
     new->meta = meta;
     new->payload = payload;
+    nbt_set_name(new, atom);
+
+    return new;
+}
+
+void nbt_set_name(nbt_tag *tag, const nbt_atom *atom)
+{
+    tag->atom = atom;
+    tag->name = atom != NULL ? (wchar_t*)atom->wide : NULL;
+    tag->name_len = atom != NULL ? atom->wide_length : 0;
+}
+
+/* Everything nbt_new_arena_tag() needs for one tag, in one allocation */
+typedef struct
+{
+    nbt_tag       tag;
+    u_tag_meta    meta;
+    u_tag_payload payload;
+} nbt_arena_tag;
+
+/* Allocates a tag with a zeroed payload in an arena */
+static nbt_arena_tag *nbt_arena_tag_alloc(arena *a, uint8_t tag_type, const nbt_atom *atom)
+{
+    nbt_arena_tag *new;
+
+    new = arena_calloc(a, 1, sizeof(nbt_arena_tag));
+    if (new == NULL)
+        return NULL;
+
+    if (tag_type < NBT_TAG_TYPE_MIN || tag_type > NBT_TAG_TYPE_MAX)
+        new->tag.type = TAG_Invalid;
+    else
+        new->tag.type = tag_type;
+
+    new->tag.flags = NBT_TAG_ARENA;
+    nbt_set_name(&(new->tag), atom);
+    new->tag.meta = &(new->meta);
+    new->tag.payload = &(new->payload);
 
     return new;
 }
 
+nbt_tag *nbt_new_arena_tag(arena *a, uint8_t tag_type, const nbt_atom *atom)
+{
+    nbt_arena_tag *new;
+    list *new_list;
+
+    new = nbt_arena_tag_alloc(a, tag_type, atom);
+    if (new == NULL)
+        return NULL;
+
+    switch (tag_type)
+    {
+        case TAG_List:
+            new_list = arena_alloc(a, sizeof(list));
+            if (new_list == NULL)
+                return NULL;
+
+            // The nodes live in the arena, so nothing is ever freed
+            new_list->start = NULL;
+            new_list->end = NULL;
+            new_list->data_free_func = NULL;
+            new->payload.list_payload = new_list;
+            break;
+
+        case TAG_Compound:
+            new->payload.compound_payload = nbt_compound_new(a);
+            if (new->payload.compound_payload == NULL)
+                return NULL;
+            break;
+    }
+
+    return &(new->tag);
+}
+
+int nbt_arena_list_push(arena *a, nbt_tag *tag, nbt_tag *child)
+{
+    list_node *node;
+
+    if (tag == NULL || tag->type != TAG_List || (tag->flags & NBT_TAG_PACKED))
+        return E_LINKED_LIST_NULL_HAYSTACK;
+
+    node = arena_alloc(a, sizeof(list_node));
+    if (node == NULL)
+        return E_LINKED_LIST_OUT_OF_MEM;
+
+    node->data = child;
+    node->prev = NULL;
+    node->next = NULL;
+
+    return list_push_node(tag->payload->list_payload, node);
+}
+
 void nbt_free_tag(nbt_tag *doomed)
 {
     if (doomed == NULL)
         return;
 
+    // Arena tags go away with their arena, all at once
+    if (doomed->flags & NBT_TAG_ARENA)
+        return;
+
     if (doomed->payload != NULL)
     {
         switch (doomed->type)
@@ -53,22 +158,29 @@ void nbt_free_tag(nbt_tag *doomed)
                 break;
 
             case TAG_Byte_Array:
-                if (doomed->payload->byte_array_payload != NULL)
+                if (doomed->payload->byte_array_payload != NULL &&
+                    !(doomed->flags & NBT_TAG_BORROWED))
                     free(doomed->payload->byte_array_payload);
                 break;
             case TAG_String:
-                if (doomed->payload->string_payload != NULL)
+                if (doomed->payload->string_payload != NULL &&
+                    !(doomed->flags & NBT_TAG_BORROWED))
                     free(doomed->payload->string_payload);
                 break;
 
             case TAG_List:
-                if (doomed->payload->list_payload != NULL)
+                if (doomed->flags & NBT_TAG_PACKED)
+                {
+                    if (doomed->payload->array_payload != NULL)
+                        free(doomed->payload->array_payload);
+                }
+                else if (doomed->payload->list_payload != NULL)
                     list_free(doomed->payload->list_payload);
                 break;
 
             case TAG_Compound:
                 if (doomed->payload->compound_payload != NULL)
-                    hashtable_destroy(doomed->payload->compound_payload, 1);
+                    nbt_compound_free(doomed->payload->compound_payload, 1);
                 break;
             default:
                 // TODO: Handle unlisted tag type
@@ -83,19 +195,12 @@ void nbt_free_tag(nbt_tag *doomed)
         free(doomed->meta);
     }
 
-    if (doomed->name != NULL)
-    {
-        free(doomed->name);
-    }
-
     free(doomed);
 }
 
 u_tag_payload *nbt_new_simple_payload(uint8_t tag_type, void *payload_value)
 {
     u_tag_payload *payload;
-    uint32_t float_temp;
-    uint64_t double_temp;
     
     if (!nbt_is_simple_tag_type(tag_type))
         return NULL;
@@ -104,6 +209,19 @@ u_tag_payload *nbt_new_simple_payload(uint8_t tag_type, void *payload_value)
     if (payload == NULL)
         return NULL;
 
+    nbt_convert_simple_payload(tag_type, payload_value, payload);
+
+    return payload;
+}
+
+int nbt_convert_simple_payload(uint8_t tag_type, void *payload_value, u_tag_payload *payload)
+{
+    uint32_t float_temp;
+    uint64_t double_temp;
+
+    if (!nbt_is_simple_tag_type(tag_type))
+        return (-1);
+
     switch (tag_type)
     {
         case TAG_Byte:
@@ -131,7 +249,7 @@ u_tag_payload *nbt_new_simple_payload(uint8_t tag_type, void *payload_value)
             break;
     }
 
-    return payload;
+    return 0;
 }
 
 nbt_tag *nbt_new_simple_tag(uint8_t tag_type, wchar_t *name, uint16_t name_len, void *payload_value)
@@ -210,32 +328,85 @@ nbt_tag *nbt_new_list_tag(wchar_t *name, uint16_t name_len, int8_t child_tag_typ
         return NULL;
     }
 
+    meta->length = 0;
     meta->child_tag_type = child_tag_type;
     payload->list_payload = new_list;
 
     return nbt_new_tag(TAG_List, name, name_len, meta, payload);
 }
 
+nbt_tag *nbt_new_packed_list_tag(arena *a, const nbt_atom *atom, int8_t child_tag_type, int32_t length)
+{
+    nbt_tag       *new;
+    nbt_arena_tag *arena_tag;
+    u_tag_payload *payload;
+    u_tag_meta    *meta;
+    void          *array;
+    size_t         size;
+
+    if (!nbt_is_simple_tag_type(child_tag_type) || length < 0)
+        return NULL;
+
+    // Keep at least one byte so an empty list still has an array
+    size = (size_t)length * nbt_get_payload_size(child_tag_type);
+    if (size == 0)
+        size = 1;
+
+    if (a != NULL)
+    {
+        arena_tag = nbt_arena_tag_alloc(a, TAG_List, atom);
+        array = arena_calloc(a, 1, size);
+        if (arena_tag == NULL || array == NULL)
+            return NULL;
+
+        new = &(arena_tag->tag);
+    }
+    else
+    {
+        array = calloc(1, size);
+        payload = malloc(sizeof(u_tag_payload));
+        meta = malloc(sizeof(u_tag_meta));
+        new = NULL;
+
+        if (array != NULL && payload != NULL && meta != NULL)
+            new = nbt_new_tag(TAG_List, NULL, 0, meta, payload);
+
+        if (new == NULL)
+        {
+            free(array);
+            free(payload);
+            free(meta);
+            return NULL;
+        }
+
+        nbt_set_name(new, atom);
+    }
+
+    new->flags |= NBT_TAG_PACKED;
+    new->meta->length = length;
+    new->meta->child_tag_type = child_tag_type;
+    new->payload->array_payload = array;
+
+    return new;
+}
+
 nbt_tag *nbt_new_compound_tag(wchar_t *name, uint16_t name_len)
 {
-    struct hashtable *new_hash;
+    nbt_compound *new_compound;
     u_tag_payload *payload;
 
-    new_hash = create_hashtable(NBT_TAG_HASH_BUCKETS,
-            nbt_hash_fn,
-            nbt_name_eq,
-            (vfp)nbt_free_tag);
-    if (new_hash == NULL)
+    new_compound = nbt_compound_new(NULL);
+    if (new_compound == NULL)
         return NULL;
 
     payload = malloc(sizeof(u_tag_payload));
     if (payload == NULL)
     {
-        hashtable_destroy(new_hash, 1);
+        nbt_compound_free(new_compound, 1);
         return NULL;
     }
 
-    payload->compound_payload = new_hash;
+    payload->compound_payload = new_compound;
 
     return nbt_new_tag(TAG_Compound, name, name_len, NULL, payload);
 }
@@ -295,8 +466,8 @@ void nbt_print_single(nbt_tag *tag, int indent)
     };
     char *tag_name = NULL;
     list_node *iterator = NULL;
-    struct hashtable_itr *hash_itr = NULL;
-    nbt_tag *child = NULL;
+    nbt_tag *child = NULL, element;
+    u_tag_payload element_payload;
 
     if (tag == NULL || tag->type == TAG_Invalid)
     {
@@ -348,7 +519,10 @@ void nbt_print_single(nbt_tag *tag, int indent)
                     printf("[meta missing]");
                 break;
             case TAG_String:
-                printf("\"%ls\"", tag->payload->string_payload);
+                if (tag->flags & NBT_TAG_UTF8)
+                    printf("\"%.*s\"", tag->meta->length, tag->payload->utf8_payload);
+                else
+                    printf("\"%ls\"", tag->payload->string_payload);
                 /*
                 printf("\n");
                 hex_dump((void*)tag->payload->string_payload, tag->meta->length, indent + 2, HEX_WCHAR_T);
@@ -359,34 +533,48 @@ void nbt_print_single(nbt_tag *tag, int indent)
                 printf("\n");
                 print_indent(indent);
                 printf("{\n");
-                iterator = tag->payload->list_payload->start;
-                while (iterator != NULL)
+                if (tag->flags & NBT_TAG_PACKED)
                 {
-                    nbt_print_single((nbt_tag*)iterator->data, indent + 2);
-                    iterator = iterator->next;
+                    // Print each element as the tag it would have been
+                    element.type = tag->meta->child_tag_type;
+                    element.flags = 0;
+                    element.name = NULL;
+                    element.name_len = 0;
+                    element.atom = NULL;
+                    element.meta = NULL;
+                    element.payload = &element_payload;
+                    for (i = 0; i < tag->meta->length; i++)
+                    {
+                        nbt_list_get(tag, i, &element_payload);
+                        nbt_print_single(&element, indent + 2);
+                    }
+                }
+                else
+                {
+                    iterator = tag->payload->list_payload->start;
+                    while (iterator != NULL)
+                    {
+                        nbt_print_single((nbt_tag*)iterator->data, indent + 2);
+                        iterator = iterator->next;
+                    }
                 }
                 print_indent(indent);
                 printf("}");
                 break;
 
             case TAG_Compound:
-                hash_itr = (struct hashtable_itr*)hashtable_iterator(tag->payload->compound_payload);
-
                 printf("\n");
                 print_indent(indent);
                 printf("{\n");
-                do
+                for (i = 0; i < tag->payload->compound_payload->count; i++)
                 {
-                    child = (nbt_tag*)hashtable_iterator_value(hash_itr);
+                    child = tag->payload->compound_payload->entries[i].tag;
                     if (child != NULL)
                         nbt_print_single(child, indent + 2);
-                } while (hashtable_iterator_advance(hash_itr));
+                }
 
                 print_indent(indent);
                 printf("}");
-
-                free(hash_itr);
-
                 break;
         }
     printf("\n");
@@ -439,24 +627,15 @@ void hex_dump(void *string, int string_length, int indent, int flags)
 
 unsigned int nbt_hash_fn(void *name)
 {
-    unsigned long hash = 5381;
-    uint32_t c; 
-
-    if (name != NULL)
-    {
-        while (c = *((uint32_t*)(name++)))
-            hash = ((hash << 5) + hash) + c;
-    }
+    if (name == NULL)
+        return 0;
 
-    return hash;
+    return ((nbt_atom*)name)->hash;
 }
 
 int nbt_name_eq(void *name1, void *name2)
 {
-    if (name1 == NULL || name2 == NULL)
-        return -1;
-
-    return wcscmp(name1, name2) == 0;
+    return name1 == name2;
 }
 
 void *nbt_payload(nbt_tag *tag, uint8_t expected_type)
@@ -495,16 +674,110 @@ void *nbt_payload(nbt_tag *tag, uint8_t expected_type)
     }
 }
 
-nbt_tag *nbt_hash_search(nbt_tag *tag, wchar_t *key)
+int32_t nbt_list_length(nbt_tag *tag)
 {
-    struct hashtable *hash;
+    list_node *iterator;
+    int32_t length = 0;
 
+    if (tag == NULL || tag->type != TAG_List)
+        return (-1);
+
+    if (tag->flags & NBT_TAG_PACKED)
+        return tag->meta->length;
+
+    for (iterator = tag->payload->list_payload->start; iterator != NULL; iterator = iterator->next)
+        length++;
+
+    return length;
+}
+
+void *nbt_list_array(nbt_tag *tag, uint8_t expected_child_type)
+{
+    if (tag == NULL || tag->type != TAG_List || !(tag->flags & NBT_TAG_PACKED))
+        return NULL;
+
+    if (tag->meta->child_tag_type != expected_child_type)
+        return NULL;
+
+    return tag->payload->array_payload;
+}
+
+int nbt_list_get(nbt_tag *tag, int32_t index, u_tag_payload *out)
+{
+    uint8_t size;
+
+    if (tag == NULL || tag->type != TAG_List || !(tag->flags & NBT_TAG_PACKED))
+        return (-1);
+
+    if (index < 0 || index >= tag->meta->length)
+        return (-1);
+
+    size = nbt_get_payload_size(tag->meta->child_tag_type);
+    memcpy(out, (uint8_t*)tag->payload->array_payload + (size_t)index * size, size);
+
+    return 0;
+}
+
+nbt_tag *nbt_list_item(nbt_tag *tag, int32_t index)
+{
+    list_node *iterator;
+
+    if (tag == NULL || tag->type != TAG_List || (tag->flags & NBT_TAG_PACKED) || index < 0)
+        return NULL;
+
+    for (iterator = tag->payload->list_payload->start; iterator != NULL; iterator = iterator->next)
+        if (index-- == 0)
+            return (nbt_tag*)iterator->data;
+
+    return NULL;
+}
+
+int nbt_convert_simple_array(uint8_t tag_type, const uint8_t *raw, int32_t count, void *out)
+{
+    uint8_t *value = out, size;
+    int32_t i;
+
+    if (!nbt_is_simple_tag_type(tag_type))
+        return (-1);
+
+    size = nbt_get_payload_size(tag_type);
+
+    // Copy first so every element is aligned, then swap in place
+    if (out != (void*)raw)
+        memcpy(out, raw, (size_t)count * size);
+
+    switch (size)
+    {
+        case 2:
+            for (i = 0; i < count; i++)
+                ((uint16_t*)value)[i] = be16toh(((uint16_t*)value)[i]);
+            break;
+        case 4:
+            for (i = 0; i < count; i++)
+                ((uint32_t*)value)[i] = be32toh(((uint32_t*)value)[i]);
+            break;
+        case 8:
+            for (i = 0; i < count; i++)
+                ((uint64_t*)value)[i] = be64toh(((uint64_t*)value)[i]);
+            break;
+    }
+
+    return 0;
+}
+
+nbt_tag *nbt_hash_search(nbt_tag *tag, wchar_t *key)
+{
     if (tag == NULL || key == NULL)
         return NULL;
 
-    hash = nbt_payload(tag, TAG_Compound);
-    if (hash == NULL)
+    // A name that was never interned can't be the name of any tag
+    return nbt_hash_search_atom(tag, nbt_atom_find_wide(key, wcslen(key)));
+}
+
+nbt_tag *nbt_hash_search_atom(nbt_tag *tag, const nbt_atom *key)
+{
+    if (tag == NULL || key == NULL)
         return NULL;
 
-    return hashtable_search(hash, key);
+    return nbt_compound_search(nbt_payload(tag, TAG_Compound), key);
 }
@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "nbt_atom.h"
+#include "read_nbt.h"
+#include "utf8.h"
+
+/** \brief How many bytes of UTF-8 to convert on the stack before resorting to
+  *        malloc() in the wchar_t functions. */
+#define NBT_ATOM_STACK_SIZE 256
+
+static const nbt_atom *nbt_atom_lookup(const char *utf8, size_t length, uint32_t hash);
+static const nbt_atom *nbt_atom_wide(const wchar_t *name, size_t length, int intern);
+static void nbt_atom_grow(void);
+
+static pthread_rwlock_t nbt_atom_lock = PTHREAD_RWLOCK_INITIALIZER;
+static nbt_atom **nbt_atom_buckets = NULL;
+static size_t nbt_atom_bucket_count = 0;
+static size_t nbt_atom_count = 0;
+
+uint32_t nbt_atom_hash(const char *utf8, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)utf8[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+const nbt_atom *nbt_atom_intern(const char *utf8, size_t length)
+{
+    extern __thread int nbt_read_error;
+    const nbt_atom *found;
+    nbt_atom *new;
+    wchar_t *wide;
+    char *copy;
+    uint32_t hash;
+    size_t wide_length = 0;
+
+    if (length > UINT16_MAX || (utf8 == NULL && length > 0))
+    {
+        nbt_read_error = NBT_READ_MALFORMED_INPUT;
+        return NULL;
+    }
+
+    hash = nbt_atom_hash(utf8, length);
+
+    // Nearly every call finds a name that was seen before, which only needs
+    // the shared lock.
+    pthread_rwlock_rdlock(&nbt_atom_lock);
+    found = nbt_atom_lookup(utf8, length, hash);
+    pthread_rwlock_unlock(&nbt_atom_lock);
+
+    if (found != NULL)
+        return found;
+
+    // The atom, its wchar_t rendition and its UTF-8 share one allocation.
+    // A UTF-8 name never has more characters than bytes.
+    new = malloc(sizeof(nbt_atom) + (length + 1) * sizeof(wchar_t) + length + 1);
+    if (new == NULL)
+    {
+        nbt_read_error = NBT_READ_OUT_OF_MEM;
+        return NULL;
+    }
+
+    wide = (wchar_t*)(new + 1);
+    copy = (char*)(wide + length + 1);
+
+    if (length > 0)
+    {
+        wide_length = utf8_to_wchar(utf8, length, wide, length, 0);
+        if (wide_length == 0)
+        {
+            free(new);
+            nbt_read_error = NBT_READ_INVALID_UTF8;
+            return NULL;
+        }
+        memcpy(copy, utf8, length);
+    }
+
+    wide[wide_length] = L'\0';
+    copy[length] = '\0';
+
+    new->hash = hash;
+    new->length = length;
+    new->wide_length = wide_length;
+    new->utf8 = copy;
+    new->wide = wide;
+
+    pthread_rwlock_wrlock(&nbt_atom_lock);
+
+    // Another thread may have interned the same name in the meantime
+    found = nbt_atom_lookup(utf8, length, hash);
+    if (found == NULL)
+    {
+        if (nbt_atom_count >= nbt_atom_bucket_count * 2)
+            nbt_atom_grow();
+
+        if (nbt_atom_buckets == NULL)
+        {
+            pthread_rwlock_unlock(&nbt_atom_lock);
+            free(new);
+            nbt_read_error = NBT_READ_OUT_OF_MEM;
+            return NULL;
+        }
+
+        new->next = nbt_atom_buckets[hash & (nbt_atom_bucket_count - 1)];
+        nbt_atom_buckets[hash & (nbt_atom_bucket_count - 1)] = new;
+        nbt_atom_count++;
+        found = new;
+        new = NULL;
+    }
+
+    pthread_rwlock_unlock(&nbt_atom_lock);
+
+    if (new != NULL)
+        free(new);
+
+    return found;
+}
+
+const nbt_atom *nbt_atom_intern_wide(const wchar_t *name, size_t length)
+{
+    return nbt_atom_wide(name, length, 1);
+}
+
+const nbt_atom *nbt_atom_find_wide(const wchar_t *name, size_t length)
+{
+    return nbt_atom_wide(name, length, 0);
+}
+
+/* Searches the table. The caller must hold the lock. */
+static const nbt_atom *nbt_atom_lookup(const char *utf8, size_t length, uint32_t hash)
+{
+    nbt_atom *atom;
+
+    if (nbt_atom_buckets == NULL)
+        return NULL;
+
+    for (atom = nbt_atom_buckets[hash & (nbt_atom_bucket_count - 1)]; atom != NULL; atom = atom->next)
+        if (atom->hash == hash && atom->length == length &&
+            memcmp(atom->utf8, utf8, length) == 0)
+            return atom;
+
+    return NULL;
+}
+
+/* Converts a wchar_t name to UTF-8, then interns it or just looks it up. */
+static const nbt_atom *nbt_atom_wide(const wchar_t *name, size_t length, int intern)
+{
+    extern __thread int nbt_read_error;
+    char stack[NBT_ATOM_STACK_SIZE], *utf8 = stack;
+    const nbt_atom *found;
+    size_t utf8_length = 0;
+
+    if (name == NULL)
+        return NULL;
+
+    if (length > 0)
+    {
+        utf8_length = wchar_to_utf8(name, length, NULL, 0, 0);
+        if (utf8_length == 0)
+        {
+            nbt_read_error = NBT_READ_INVALID_UTF8;
+            return NULL;
+        }
+
+        if (utf8_length > NBT_ATOM_STACK_SIZE)
+        {
+            utf8 = malloc(utf8_length);
+            if (utf8 == NULL)
+            {
+                nbt_read_error = NBT_READ_OUT_OF_MEM;
+                return NULL;
+            }
+        }
+
+        wchar_to_utf8(name, length, utf8, utf8_length, 0);
+    }
+
+    if (intern)
+        found = nbt_atom_intern(utf8, utf8_length);
+    else
+    {
+        pthread_rwlock_rdlock(&nbt_atom_lock);
+        found = nbt_atom_lookup(utf8, utf8_length, nbt_atom_hash(utf8, utf8_length));
+        pthread_rwlock_unlock(&nbt_atom_lock);
+    }
+
+    if (utf8 != stack)
+        free(utf8);
+
+    return found;
+}
+
+/* Doubles the number of buckets. The caller must hold the write lock. If no
+ * memory can be had, the table just stays as it is. */
+static void nbt_atom_grow(void)
+{
+    nbt_atom **buckets, *atom, *next;
+    size_t count, i;
+
+    count = nbt_atom_bucket_count == 0 ? NBT_ATOM_BUCKETS : nbt_atom_bucket_count * 2;
+
+    buckets = calloc(count, sizeof(nbt_atom*));
+    if (buckets == NULL)
+        return;
+
+    for (i = 0; i < nbt_atom_bucket_count; i++)
+    {
+        for (atom = nbt_atom_buckets[i]; atom != NULL; atom = next)
+        {
+            next = atom->next;
+            atom->next = buckets[atom->hash & (count - 1)];
+            buckets[atom->hash & (count - 1)] = atom;
+        }
+    }
+
+    if (nbt_atom_buckets != NULL)
+        free(nbt_atom_buckets);
+
+    nbt_atom_buckets = buckets;
+    nbt_atom_bucket_count = count;
+}
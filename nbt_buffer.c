@@ -0,0 +1,710 @@
+#include <zlib.h>
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "nbt_buffer.h"
+#include "read_nbt.h"
+#include "nbt.h"
+
+/** \name gzip Format
+  * \brief The parts of RFC 1952 needed to find the deflate data in a member
+  */
+/*@{*/
+#define GZIP_ID1            0x1f
+#define GZIP_ID2            0x8b
+#define GZIP_CM_DEFLATE     8
+#define GZIP_FLG_FHCRC      0x02
+#define GZIP_FLG_FEXTRA     0x04
+#define GZIP_FLG_FNAME      0x08
+#define GZIP_FLG_FCOMMENT   0x10
+#define GZIP_HEADER_SIZE    10
+#define GZIP_TRAILER_SIZE   8
+/*@}*/
+
+/* What a thread keeps between calls to nbt_buffer_load(), so that loading a
+ * file neither sets up nor tears down a z_stream */
+typedef struct
+{
+    z_stream stream;            // Raw inflate state, reset between files
+    int      ready;             // Whether inflateInit2() has been called
+    uint8_t *input;             // The compressed file
+    size_t   input_capacity;    // How many bytes input has room for
+} nbt_buffer_inflater;
+
+static int nbt_buffer_grow(nbt_buffer *buf, size_t capacity);
+static int nbt_buffer_fill(nbt_buffer *buf, size_t needed);
+static nbt_buffer_inflater *nbt_buffer_thread_inflater(void);
+static void nbt_buffer_thread_init(void);
+static void nbt_buffer_thread_free(void *doomed);
+static int nbt_buffer_read_file(nbt_buffer_inflater *inf, const char *path, size_t *length);
+static size_t nbt_buffer_gzip_header(const uint8_t *data, size_t length);
+
+static pthread_key_t nbt_buffer_thread_key;
+static pthread_once_t nbt_buffer_thread_once = PTHREAD_ONCE_INIT;
+static __thread nbt_buffer_inflater *thread_inflater = NULL;
+
+nbt_buffer *nbt_buffer_new(size_t capacity)
+{
+    nbt_buffer *new;
+
+    if (capacity == 0)
+        capacity = NBT_BUFFER_INITIAL_SIZE;
+
+    new = malloc(sizeof(nbt_buffer));
+    if (new == NULL)
+        return NULL;
+
+    new->data = malloc(capacity);
+    if (new->data == NULL)
+    {
+        free(new);
+        return NULL;
+    }
+
+    new->capacity = capacity;
+    new->length = 0;
+    new->position = 0;
+    new->source = NULL;
+
+    return new;
+}
+
+void nbt_buffer_free(nbt_buffer *doomed)
+{
+    if (doomed == NULL)
+        return;
+
+    nbt_buffer_close_source(doomed);
+
+    if (doomed->data != NULL)
+        free(doomed->data);
+
+    free(doomed);
+}
+
+int nbt_buffer_read_gz(nbt_buffer *buf, gzFile file)
+{
+    extern __thread int nbt_read_error;
+    int bytes_read;
+
+    if (buf == NULL || file == NULL)
+        return (-1);
+
+    buf->length = 0;
+    buf->position = 0;
+
+    if (buf->capacity == 0 && nbt_buffer_grow(buf, NBT_BUFFER_INITIAL_SIZE))
+        return (-1);
+
+    for (;;)
+    {
+        // Double the buffer whenever it fills up; one or two passes through
+        // here is typical since the initial size fits a whole chunk.
+        if (buf->length == buf->capacity && nbt_buffer_grow(buf, buf->capacity * 2))
+            return (-1);
+
+        bytes_read = gzread(file, buf->data + buf->length, buf->capacity - buf->length);
+        if (bytes_read < 0)
+        {
+            nbt_read_error = NBT_READ_GZREAD_ERROR;
+            return (-1);
+        }
+        else if (bytes_read == 0)
+            break;
+
+        buf->length += bytes_read;
+    }
+
+    return 0;
+}
+
+nbt_buffer *nbt_buffer_open(char *path)
+{
+    return nbt_buffer_open_flags(path, 0);
+}
+
+nbt_buffer *nbt_buffer_open_flags(char *path, int flags)
+{
+    extern __thread int nbt_read_error;
+    nbt_buffer *new;
+
+    // Left empty so that nbt_buffer_load() allocates exactly what the file
+    // inflates to
+    new = calloc(1, sizeof(nbt_buffer));
+    if (new == NULL)
+    {
+        nbt_read_error = NBT_READ_OUT_OF_MEM;
+        return NULL;
+    }
+
+    if (nbt_buffer_load(new, path, flags))
+    {
+        nbt_buffer_free(new);
+        return NULL;
+    }
+
+    return new;
+}
+
+int nbt_buffer_load(nbt_buffer *buf, const char *path, int flags)
+{
+    extern __thread int nbt_read_error;
+    nbt_buffer_inflater *inf;
+    const uint8_t *trailer;
+    size_t length, header_length;
+    uint32_t crc, isize;
+    gzFile file;
+    int err;
+
+    if (buf == NULL || path == NULL)
+        return (-1);
+
+    nbt_buffer_close_source(buf);
+    buf->length = 0;
+    buf->position = 0;
+
+    inf = nbt_buffer_thread_inflater();
+    if (inf == NULL)
+    {
+        nbt_read_error = NBT_READ_OUT_OF_MEM;
+        return (-1);
+    }
+
+    if (nbt_buffer_read_file(inf, path, &length))
+        return (-1);
+
+    // Anything but a single gzip member, such as a file that was never
+    // compressed, is left to the gz functions, which know what to do with it
+    header_length = nbt_buffer_gzip_header(inf->input, length);
+    if (header_length == 0)
+        goto nbt_buffer_load_gz;
+
+    // Both trailer fields are little-endian
+    trailer = inf->input + length - GZIP_TRAILER_SIZE;
+    crc = trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (uint32_t)trailer[3] << 24;
+    isize = trailer[4] | trailer[5] << 8 | trailer[6] << 16 | (uint32_t)trailer[7] << 24;
+
+    if (isize / NBT_BUFFER_MAX_RATIO > length)
+    {
+        nbt_read_error = NBT_READ_MALFORMED_INPUT;
+        return (-1);
+    }
+
+    if (nbt_buffer_grow(buf, isize > 0 ? isize : 1))
+        return (-1);
+
+    if (!inf->ready)
+    {
+        memset(&(inf->stream), 0, sizeof(z_stream));
+        if (inflateInit2(&(inf->stream), -MAX_WBITS) != Z_OK)
+        {
+            nbt_read_error = NBT_READ_OUT_OF_MEM;
+            return (-1);
+        }
+        inf->ready = 1;
+    }
+    else
+        inflateReset(&(inf->stream));
+
+    inf->stream.next_in = inf->input + header_length;
+    inf->stream.avail_in = length - header_length - GZIP_TRAILER_SIZE;
+    inf->stream.next_out = buf->data;
+    inf->stream.avail_out = isize;
+
+    // The output has exactly the room the trailer promised, so a single call
+    // either finishes the member or the file is damaged
+    err = inflate(&(inf->stream), Z_FINISH);
+
+    // Data left over means more than one member, and the trailer only
+    // described the last of them
+    if (err == Z_STREAM_END && inf->stream.avail_in > 0)
+        goto nbt_buffer_load_gz;
+
+    if (err != Z_STREAM_END || inf->stream.total_out != isize)
+    {
+        nbt_read_error = NBT_READ_GZREAD_ERROR;
+        return (-1);
+    }
+
+    if (!(flags & NBT_BUFFER_TRUSTED) && crc32(crc32(0L, Z_NULL, 0), buf->data, isize) != crc)
+    {
+        nbt_read_error = NBT_READ_CRC_MISMATCH;
+        return (-1);
+    }
+
+    buf->length = isize;
+    return 0;
+
+nbt_buffer_load_gz:
+    file = gzopen(path, "r");
+    if (file == Z_NULL)
+    {
+        nbt_read_error = NBT_READ_GZREAD_ERROR;
+        return (-1);
+    }
+
+    err = nbt_buffer_read_gz(buf, file);
+    gzclose(file);
+    return err;
+}
+
+nbt_buffer *nbt_buffer_open_stream(char *path)
+{
+    extern __thread int nbt_read_error;
+    nbt_buffer *new;
+
+    new = nbt_buffer_new(0);
+    if (new == NULL)
+    {
+        nbt_read_error = NBT_READ_OUT_OF_MEM;
+        return NULL;
+    }
+
+    new->source = gzopen(path, "r");
+    if (new->source == Z_NULL)
+    {
+        nbt_read_error = NBT_READ_GZREAD_ERROR;
+        new->source = NULL;
+        nbt_buffer_free(new);
+        return NULL;
+    }
+
+    return new;
+}
+
+int nbt_buffer_finish(nbt_buffer *buf)
+{
+    int err = 0;
+
+    while (buf->source != NULL && err == 0)
+        err = nbt_buffer_fill(buf, NBT_BUFFER_READ_SIZE);
+
+    return err;
+}
+
+void nbt_buffer_close_source(nbt_buffer *buf)
+{
+    if (buf->source != NULL)
+    {
+        gzclose(buf->source);
+        buf->source = NULL;
+    }
+}
+
+static int nbt_buffer_grow(nbt_buffer *buf, size_t capacity)
+{
+    extern __thread int nbt_read_error;
+    uint8_t *grown;
+
+    if (capacity <= buf->capacity)
+        return 0;
+
+    grown = realloc(buf->data, capacity);
+    if (grown == NULL)
+    {
+        nbt_read_error = NBT_READ_OUT_OF_MEM;
+        return (-1);
+    }
+
+    buf->data = grown;
+    buf->capacity = capacity;
+
+    return 0;
+}
+
+static int nbt_buffer_fill(nbt_buffer *buf, size_t needed)
+{
+    extern __thread int nbt_read_error;
+    size_t capacity;
+    int bytes_read;
+
+    if (needed < NBT_BUFFER_READ_SIZE)
+        needed = NBT_BUFFER_READ_SIZE;
+
+    capacity = buf->capacity;
+    while (capacity - buf->length < needed)
+        capacity *= 2;
+
+    if (nbt_buffer_grow(buf, capacity))
+        return (-1);
+
+    while (needed > 0)
+    {
+        bytes_read = gzread(buf->source, buf->data + buf->length, needed);
+        if (bytes_read < 0)
+        {
+            nbt_read_error = NBT_READ_GZREAD_ERROR;
+            return (-1);
+        }
+        else if (bytes_read == 0)
+        {
+            // Everything has been inflated, so the buffer is complete
+            nbt_buffer_close_source(buf);
+            break;
+        }
+
+        buf->length += bytes_read;
+        needed -= bytes_read < needed ? bytes_read : needed;
+    }
+
+    return 0;
+}
+
+static nbt_buffer_inflater *nbt_buffer_thread_inflater(void)
+{
+    if (thread_inflater != NULL)
+        return thread_inflater;
+
+    if (pthread_once(&nbt_buffer_thread_once, nbt_buffer_thread_init))
+        return NULL;
+
+    thread_inflater = calloc(1, sizeof(nbt_buffer_inflater));
+    if (thread_inflater != NULL)
+        pthread_setspecific(nbt_buffer_thread_key, thread_inflater);
+
+    return thread_inflater;
+}
+
+static void nbt_buffer_thread_init(void)
+{
+    pthread_key_create(&nbt_buffer_thread_key, nbt_buffer_thread_free);
+}
+
+static void nbt_buffer_thread_free(void *doomed)
+{
+    nbt_buffer_inflater *inf = (nbt_buffer_inflater*)doomed;
+
+    if (inf->ready)
+        inflateEnd(&(inf->stream));
+
+    free(inf->input);
+    free(inf);
+}
+
+/* Reads a whole file into the thread's input buffer, growing it as needed */
+static int nbt_buffer_read_file(nbt_buffer_inflater *inf, const char *path, size_t *length)
+{
+    extern __thread int nbt_read_error;
+    struct stat info;
+    uint8_t *grown;
+    ssize_t bytes_read;
+    size_t total = 0;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        nbt_read_error = NBT_READ_GZREAD_ERROR;
+        return (-1);
+    }
+
+    if (fstat(fd, &info))
+        goto nbt_buffer_read_file_error;
+
+    if ((size_t)info.st_size > inf->input_capacity)
+    {
+        grown = realloc(inf->input, info.st_size);
+        if (grown == NULL)
+        {
+            close(fd);
+            nbt_read_error = NBT_READ_OUT_OF_MEM;
+            return (-1);
+        }
+
+        inf->input = grown;
+        inf->input_capacity = info.st_size;
+    }
+
+    // One read() is normally enough, but it is allowed to come up short
+    while (total < (size_t)info.st_size)
+    {
+        bytes_read = read(fd, inf->input + total, info.st_size - total);
+        if (bytes_read < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            goto nbt_buffer_read_file_error;
+        }
+        else if (bytes_read == 0)
+            break;
+
+        total += bytes_read;
+    }
+
+    close(fd);
+    *length = total;
+    return 0;
+
+nbt_buffer_read_file_error:
+    close(fd);
+    nbt_read_error = NBT_READ_GZREAD_ERROR;
+    return (-1);
+}
+
+/* Finds where the deflate data starts in a gzip member. Returns 0 if the data
+ * isn't a deflated gzip member with room for a trailer. */
+static size_t nbt_buffer_gzip_header(const uint8_t *data, size_t length)
+{
+    size_t position = GZIP_HEADER_SIZE;
+    uint8_t flags;
+
+    if (length < GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE ||
+        data[0] != GZIP_ID1 || data[1] != GZIP_ID2 || data[2] != GZIP_CM_DEFLATE)
+        return 0;
+
+    flags = data[3];
+
+    if (flags & GZIP_FLG_FEXTRA)
+    {
+        if (position + 2 > length)
+            return 0;
+        position += 2 + (data[position] | data[position + 1] << 8);
+    }
+
+    if (flags & GZIP_FLG_FNAME)
+    {
+        while (position < length && data[position] != '\0')
+            position++;
+        position++;
+    }
+
+    if (flags & GZIP_FLG_FCOMMENT)
+    {
+        while (position < length && data[position] != '\0')
+            position++;
+        position++;
+    }
+
+    if (flags & GZIP_FLG_FHCRC)
+        position += 2;
+
+    if (position + GZIP_TRAILER_SIZE > length)
+        return 0;
+
+    return position;
+}
+
+uint8_t *nbt_buffer_take(nbt_buffer *buf, size_t length)
+{
+    extern __thread int nbt_read_error;
+    uint8_t *start;
+
+    while (buf->length - buf->position < length)
+    {
+        if (buf->source == NULL)
+        {
+            nbt_read_error = NBT_READ_PREMATURE_EOF;
+            return NULL;
+        }
+
+        if (nbt_buffer_fill(buf, length - (buf->length - buf->position)))
+            return NULL;
+    }
+
+    start = buf->data + buf->position;
+    buf->position += length;
+
+    return start;
+}
+
+int nbt_buffer_read_u8(nbt_buffer *buf, uint8_t *out)
+{
+    uint8_t *raw;
+
+    if ((raw = nbt_buffer_take(buf, sizeof(uint8_t))) == NULL)
+        return (-1);
+
+    *out = *raw;
+    return 0;
+}
+
+int nbt_buffer_read_be16(nbt_buffer *buf, int16_t *out)
+{
+    uint8_t *raw;
+    uint16_t value;
+
+    if ((raw = nbt_buffer_take(buf, sizeof(value))) == NULL)
+        return (-1);
+
+    memcpy(&value, raw, sizeof(value));
+    *out = (int16_t)be16toh(value);
+    return 0;
+}
+
+int nbt_buffer_read_be32(nbt_buffer *buf, int32_t *out)
+{
+    uint8_t *raw;
+    uint32_t value;
+
+    if ((raw = nbt_buffer_take(buf, sizeof(value))) == NULL)
+        return (-1);
+
+    memcpy(&value, raw, sizeof(value));
+    *out = (int32_t)be32toh(value);
+    return 0;
+}
+
+int nbt_buffer_skip_payload(nbt_buffer *buf, uint8_t tag_type)
+{
+    return nbt_buffer_skip_payload_depth(buf, tag_type, NBT_BUFFER_MAX_DEPTH);
+}
+
+int nbt_buffer_skip_payload_depth(nbt_buffer *buf, uint8_t tag_type, int max_depth)
+{
+    extern __thread int nbt_read_error;
+    nbt_buffer_frame local_stack[NBT_BUFFER_MAX_DEPTH], *stack = local_stack, *frame;
+    uint8_t child_tag_type;
+    int16_t short_length;
+    int32_t length;
+    int depth = 0, result = (-1);
+
+    if (max_depth <= 0)
+        max_depth = NBT_BUFFER_MAX_DEPTH;
+
+    // As deep as nbt_stream_with() may go, so skipping is never stricter
+    // than visiting
+    if (max_depth > NBT_BUFFER_MAX_DEPTH)
+    {
+        stack = malloc(max_depth * sizeof(nbt_buffer_frame));
+        if (stack == NULL)
+        {
+            nbt_read_error = NBT_READ_OUT_OF_MEM;
+            return (-1);
+        }
+    }
+
+    for (;;)
+    {
+        // Step over the payload of the current tag, or open it up if it has
+        // children of its own
+        if (nbt_is_simple_tag_type(tag_type))
+        {
+            if (nbt_buffer_take(buf, nbt_get_payload_size(tag_type)) == NULL)
+                goto nbt_buffer_skip_done;
+        }
+        else
+            switch (tag_type)
+            {
+                case TAG_Byte_Array:
+                    if (nbt_buffer_read_be32(buf, &length))
+                        goto nbt_buffer_skip_done;
+                    if (length < 0)
+                        goto nbt_buffer_skip_malformed;
+                    if (nbt_buffer_take(buf, length) == NULL)
+                        goto nbt_buffer_skip_done;
+                    break;
+
+                case TAG_String:
+                    if (nbt_buffer_read_be16(buf, &short_length))
+                        goto nbt_buffer_skip_done;
+                    if (short_length < 0)
+                        goto nbt_buffer_skip_malformed;
+                    if (nbt_buffer_take(buf, short_length) == NULL)
+                        goto nbt_buffer_skip_done;
+                    break;
+
+                case TAG_List:
+                    if (nbt_buffer_read_u8(buf, &child_tag_type) ||
+                        nbt_buffer_read_be32(buf, &length))
+                        goto nbt_buffer_skip_done;
+                    if (length < 0 || !nbt_is_valid_tag_type(child_tag_type))
+                        goto nbt_buffer_skip_malformed;
+
+                    // Lists of simple tags can be stepped over in one go
+                    if (nbt_is_simple_tag_type(child_tag_type))
+                    {
+                        if (nbt_buffer_take(buf, (size_t)length * nbt_get_payload_size(child_tag_type)) == NULL)
+                            goto nbt_buffer_skip_done;
+                        break;
+                    }
+
+                    if (length == 0 || child_tag_type == TAG_End)
+                        break;
+
+                    if (depth == max_depth)
+                        goto nbt_buffer_skip_too_deep;
+
+                    frame = &stack[depth++];
+                    frame->tag_type = TAG_List;
+                    frame->child_tag_type = child_tag_type;
+                    frame->remaining = length;
+                    break;
+
+                case TAG_Compound:
+                    if (depth == max_depth)
+                        goto nbt_buffer_skip_too_deep;
+
+                    frame = &stack[depth++];
+                    frame->tag_type = TAG_Compound;
+                    break;
+
+                case TAG_End:
+                    break;
+
+                default:
+                    goto nbt_buffer_skip_malformed;
+            }
+
+        // Move on to the next tag, closing every list and compound that has
+        // run out on the way
+        for (;;)
+        {
+            if (depth == 0)
+            {
+                result = 0;
+                goto nbt_buffer_skip_done;
+            }
+
+            frame = &stack[depth - 1];
+            if (frame->tag_type == TAG_List)
+            {
+                if (frame->remaining > 0)
+                {
+                    frame->remaining--;
+                    tag_type = frame->child_tag_type;
+                    break;
+                }
+            }
+            else
+            {
+                if (nbt_buffer_read_u8(buf, &tag_type))
+                    goto nbt_buffer_skip_done;
+
+                if (tag_type != TAG_End)
+                {
+                    if (!nbt_is_valid_tag_type(tag_type))
+                        goto nbt_buffer_skip_malformed;
+
+                    if (nbt_buffer_read_be16(buf, &short_length))
+                        goto nbt_buffer_skip_done;
+                    if (short_length < 0)
+                        goto nbt_buffer_skip_malformed;
+                    if (nbt_buffer_take(buf, short_length) == NULL)
+                        goto nbt_buffer_skip_done;
+                    break;
+                }
+            }
+
+            depth--;
+        }
+    }
+
+nbt_buffer_skip_too_deep:
+    nbt_read_error = NBT_READ_TOO_DEEP;
+    goto nbt_buffer_skip_done;
+
+nbt_buffer_skip_malformed:
+    nbt_read_error = NBT_READ_MALFORMED_INPUT;
+
+nbt_buffer_skip_done:
+    if (stack != local_stack)
+        free(stack);
+
+    return result;
+}
@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "nbt.h"
+#include "nbt_compound.h"
+#include "hashtable.h"
+#include "arena.h"
+
+static void *nbt_compound_alloc(nbt_compound *c, size_t size);
+static void *nbt_compound_arena_alloc(void *a, size_t size);
+static int nbt_compound_grow(nbt_compound *c);
+static int nbt_compound_build_index(nbt_compound *c);
+static int32_t nbt_compound_find(nbt_compound *c, const nbt_atom *atom);
+
+nbt_compound *nbt_compound_new(arena *a)
+{
+    nbt_compound *new;
+
+    if (a != NULL)
+        new = arena_alloc(a, sizeof(nbt_compound));
+    else
+        new = malloc(sizeof(nbt_compound));
+
+    if (new == NULL)
+        return NULL;
+
+    new->arena = a;
+    new->count = 0;
+    new->capacity = NBT_COMPOUND_INITIAL_SIZE;
+    new->index = NULL;
+
+    new->entries = nbt_compound_alloc(new, new->capacity * sizeof(nbt_compound_entry));
+    if (new->entries == NULL)
+    {
+        if (a == NULL)
+            free(new);
+        return NULL;
+    }
+
+    return new;
+}
+
+void nbt_compound_free(nbt_compound *doomed, int free_tags)
+{
+    uint32_t i;
+
+    if (doomed == NULL || doomed->arena != NULL)
+        return;
+
+    if (free_tags)
+        for (i = 0; i < doomed->count; i++)
+            nbt_free_tag(doomed->entries[i].tag);
+
+    // The index only borrows the tags
+    if (doomed->index != NULL)
+        hashtable_destroy(doomed->index, 0);
+
+    free(doomed->entries);
+    free(doomed);
+}
+
+int nbt_compound_insert(nbt_compound *c, const nbt_atom *atom, nbt_tag *tag)
+{
+    int32_t i;
+
+    if (c == NULL || atom == NULL)
+        return (-1);
+
+    i = nbt_compound_find(c, atom);
+    if (i >= 0)
+    {
+        // Names are unique within a compound, so the newer tag wins
+        nbt_free_tag(c->entries[i].tag);
+        c->entries[i].tag = tag;
+
+        if (c->index != NULL)
+        {
+            hashtable_remove(c->index, (void*)atom);
+            if (!hashtable_insert(c->index, (void*)atom, tag))
+                return (-1);
+        }
+
+        return 0;
+    }
+
+    if (c->count == c->capacity && nbt_compound_grow(c))
+        return (-1);
+
+    c->entries[c->count].atom = atom;
+    c->entries[c->count].tag = tag;
+    c->count++;
+
+    if (c->index != NULL)
+        return hashtable_insert(c->index, (void*)atom, tag) ? 0 : (-1);
+
+    // Only big compounds are worth the hashtable. If it can't be built, the
+    // compound still works; it just gets searched the slow way.
+    if (c->count > NBT_COMPOUND_INDEX_THRESHOLD)
+        nbt_compound_build_index(c);
+
+    return 0;
+}
+
+nbt_tag *nbt_compound_search(nbt_compound *c, const nbt_atom *atom)
+{
+    int32_t i;
+
+    if (c == NULL || atom == NULL)
+        return NULL;
+
+    if (c->index != NULL)
+        return hashtable_search(c->index, (void*)atom);
+
+    i = nbt_compound_find(c, atom);
+    return i < 0 ? NULL : c->entries[i].tag;
+}
+
+nbt_tag *nbt_compound_remove(nbt_compound *c, const nbt_atom *atom)
+{
+    nbt_tag *removed;
+    int32_t i;
+
+    if (c == NULL || atom == NULL)
+        return NULL;
+
+    i = nbt_compound_find(c, atom);
+    if (i < 0)
+        return NULL;
+
+    removed = c->entries[i].tag;
+
+    // Keep the rest in order
+    memmove(c->entries + i, c->entries + i + 1, (c->count - i - 1) * sizeof(nbt_compound_entry));
+    c->count--;
+
+    if (c->index != NULL)
+        hashtable_remove(c->index, (void*)atom);
+
+    return removed;
+}
+
+/* Finds the position of a child in the entries, or -1 if it isn't there. */
+static int32_t nbt_compound_find(nbt_compound *c, const nbt_atom *atom)
+{
+    nbt_tag *tag;
+    uint32_t i;
+
+    // With an index, a name that isn't there is ruled out without scanning,
+    // which is the usual case when inserting
+    if (c->index != NULL)
+    {
+        tag = hashtable_search(c->index, (void*)atom);
+        if (tag == NULL)
+            return (-1);
+    }
+
+    // Atoms are unique, so comparing pointers is enough
+    for (i = 0; i < c->count; i++)
+        if (c->entries[i].atom == atom)
+            return i;
+
+    return (-1);
+}
+
+static void *nbt_compound_alloc(nbt_compound *c, size_t size)
+{
+    if (c->arena != NULL)
+        return arena_alloc(c->arena, size);
+
+    return malloc(size);
+}
+
+static void *nbt_compound_arena_alloc(void *a, size_t size)
+{
+    return arena_alloc((arena*)a, size);
+}
+
+/* Doubles the room for entries. Arena memory can't be given back, so there
+ * the old array is simply abandoned. */
+static int nbt_compound_grow(nbt_compound *c)
+{
+    nbt_compound_entry *grown;
+    uint32_t capacity = c->capacity * 2;
+
+    if (c->arena != NULL)
+    {
+        grown = arena_alloc(c->arena, capacity * sizeof(nbt_compound_entry));
+        if (grown != NULL)
+            memcpy(grown, c->entries, c->count * sizeof(nbt_compound_entry));
+    }
+    else
+        grown = realloc(c->entries, capacity * sizeof(nbt_compound_entry));
+
+    if (grown == NULL)
+        return (-1);
+
+    c->entries = grown;
+    c->capacity = capacity;
+
+    return 0;
+}
+
+static int nbt_compound_build_index(nbt_compound *c)
+{
+    struct hashtable *index;
+    uint32_t i;
+
+    if (c->arena != NULL)
+        index = create_hashtable_with_allocator(NBT_TAG_HASH_BUCKETS,
+                nbt_hash_fn, nbt_name_eq, NULL,
+                nbt_compound_arena_alloc, NULL, c->arena);
+    else
+        index = create_hashtable(NBT_TAG_HASH_BUCKETS,
+                nbt_hash_fn, nbt_name_eq, NULL);
+
+    if (index == NULL)
+        return (-1);
+
+    for (i = 0; i < c->count; i++)
+    {
+        if (!hashtable_insert(index, (void*)c->entries[i].atom, c->entries[i].tag))
+        {
+            hashtable_destroy(index, 0);
+            return (-1);
+        }
+    }
+
+    c->index = index;
+    return 0;
+}
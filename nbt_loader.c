@@ -0,0 +1,74 @@
+#include <stdlib.h>
+
+#include "nbt_loader.h"
+#include "read_nbt.h"
+
+void nbt_loader_init(nbt_loader *ctx, arena *a, int flags)
+{
+    ctx->error = NBT_READ_OK;
+    ctx->chunk_error = 0;
+    ctx->flags = flags;
+    ctx->arena = a;
+    ctx->alpha = NULL;
+    ctx->scratch = NULL;
+    ctx->scratch_size = 0;
+}
+
+void nbt_loader_clear(nbt_loader *ctx)
+{
+    if (ctx->scratch != NULL)
+        free(ctx->scratch);
+
+    ctx->scratch = NULL;
+    ctx->scratch_size = 0;
+}
+
+nbt_loader *nbt_loader_new(arena *a, int flags)
+{
+    nbt_loader *new;
+
+    new = malloc(sizeof(nbt_loader));
+    if (new == NULL)
+        return NULL;
+
+    nbt_loader_init(new, a, flags);
+    return new;
+}
+
+void nbt_loader_free(nbt_loader *doomed)
+{
+    if (doomed == NULL)
+        return;
+
+    nbt_loader_clear(doomed);
+    free(doomed);
+}
+
+void *nbt_loader_scratch(nbt_loader *ctx, size_t size)
+{
+    char *grown;
+    size_t scratch_size;
+
+    if (size <= ctx->scratch_size)
+        return ctx->scratch;
+
+    scratch_size = ctx->scratch_size > 0 ? ctx->scratch_size : NBT_LOADER_SCRATCH_SIZE;
+    while (scratch_size < size)
+        scratch_size *= 2;
+
+    // The old contents don't need to survive, so don't bother copying them
+    grown = malloc(scratch_size);
+    if (grown == NULL)
+    {
+        ctx->error = NBT_READ_OUT_OF_MEM;
+        return NULL;
+    }
+
+    if (ctx->scratch != NULL)
+        free(ctx->scratch);
+
+    ctx->scratch = grown;
+    ctx->scratch_size = scratch_size;
+
+    return grown;
+}
@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+
+#include "nbt.h"
+#include "nbt_buffer.h"
+#include "nbt_select.h"
+#include "read_nbt.h"
+
+static int nbt_select_compound(nbt_buffer *buf, nbt_selection *wanted, int count, int *remaining, char *path, int path_length);
+static int nbt_select_record(nbt_buffer *buf, nbt_selection *sel, uint8_t tag_type);
+
+int nbt_select(nbt_buffer *buf, nbt_selection *wanted, int count)
+{
+    extern __thread int nbt_read_error;
+    char path[NBT_SELECT_PATH_SIZE];
+    uint8_t tag_type;
+    int16_t name_length;
+    uint8_t *name;
+    int i, remaining = count;
+
+    if (buf == NULL || wanted == NULL)
+        return (-1);
+
+    for (i = 0; i < count; i++)
+        wanted[i].found = 0;
+
+    if (nbt_buffer_read_u8(buf, &tag_type) ||
+        nbt_buffer_read_be16(buf, &name_length))
+        return (-1);
+
+    if (tag_type != TAG_Compound || name_length < 0 || name_length >= NBT_SELECT_PATH_SIZE)
+    {
+        nbt_read_error = NBT_READ_MALFORMED_INPUT;
+        return (-1);
+    }
+
+    if ((name = nbt_buffer_take(buf, name_length)) == NULL)
+        return (-1);
+
+    // A named root is the first component of every path; an unnamed one is
+    // just a wrapper and is left out.
+    memcpy(path, name, name_length);
+    path[name_length] = '\0';
+
+    if (nbt_select_compound(buf, wanted, count, &remaining, path, name_length))
+        return (-1);
+
+    // Everything has been found (or the file has ended), so there's no point
+    // in inflating any further.
+    nbt_buffer_close_source(buf);
+
+    return count - remaining;
+}
+
+/* Walks the children of a compound.
+ *
+ * path holds the path to the compound and path_length is its length, which is
+ * 0 for the unnamed root. Children write their own paths in place after it.
+ * Returns 0 when the compound has been walked or everything has been found,
+ * -1 on error. */
+static int nbt_select_compound(nbt_buffer *buf, nbt_selection *wanted, int count, int *remaining, char *path, int path_length)
+{
+    extern __thread int nbt_read_error;
+    uint8_t tag_type;
+    int16_t name_length;
+    uint8_t *name;
+    int i, name_start, descend;
+    size_t child_length, wanted_length;
+
+    while (*remaining > 0)
+    {
+        if (nbt_buffer_read_u8(buf, &tag_type))
+            return (-1);
+
+        if (tag_type == TAG_End)
+            return 0;
+
+        if (!nbt_is_valid_tag_type(tag_type))
+        {
+            nbt_read_error = NBT_READ_MALFORMED_INPUT;
+            return (-1);
+        }
+
+        // Running out of input is reported by the buffer itself
+        if (nbt_buffer_read_be16(buf, &name_length))
+            return (-1);
+
+        if (name_length < 0)
+        {
+            nbt_read_error = NBT_READ_MALFORMED_INPUT;
+            return (-1);
+        }
+
+        if ((name = nbt_buffer_take(buf, name_length)) == NULL)
+            return (-1);
+
+        // Build the path to this child in place after the parent's path
+        name_start = path_length > 0 ? path_length + 1 : 0;
+        child_length = name_start + name_length;
+        if (child_length >= NBT_SELECT_PATH_SIZE)
+        {
+            if (nbt_buffer_skip_payload(buf, tag_type))
+                return (-1);
+            continue;
+        }
+
+        if (path_length > 0)
+            path[path_length] = '/';
+        memcpy(path + name_start, name, name_length);
+        path[child_length] = '\0';
+
+        descend = 0;
+        for (i = 0; i < count; i++)
+        {
+            if (wanted[i].found)
+                continue;
+
+            wanted_length = strlen(wanted[i].path);
+            if (wanted_length < child_length ||
+                memcmp(wanted[i].path, path, child_length) != 0)
+                continue;
+
+            if (wanted_length == child_length)
+            {
+                if (wanted[i].type == tag_type)
+                {
+                    if (nbt_select_record(buf, wanted + i, tag_type))
+                        return (-1);
+                    (*remaining)--;
+                    descend = -1;
+                    break;
+                }
+            }
+            else if (wanted[i].path[child_length] == '/' && tag_type == TAG_Compound)
+                descend = 1;
+        }
+
+        if (descend == 1)
+        {
+            if (nbt_select_compound(buf, wanted, count, remaining, path, child_length))
+                return (-1);
+        }
+        else if (descend == 0)
+        {
+            if (nbt_buffer_skip_payload(buf, tag_type))
+                return (-1);
+        }
+    }
+
+    return 0;
+}
+
+/* Records where a wanted tag was found and steps over its payload. */
+static int nbt_select_record(nbt_buffer *buf, nbt_selection *sel, uint8_t tag_type)
+{
+    uint8_t *raw, child_tag_type;
+    int16_t short_length;
+    uint8_t value[NBT_READ_BUFFER_SIZE];
+
+    sel->length = 0;
+
+    if (nbt_is_simple_tag_type(tag_type))
+    {
+        sel->offset = buf->position;
+        if ((raw = nbt_buffer_take(buf, nbt_get_payload_size(tag_type))) == NULL)
+            return (-1);
+
+        memcpy(value, raw, nbt_get_payload_size(tag_type));
+        nbt_convert_simple_payload(tag_type, value, &(sel->value));
+
+        sel->found = 1;
+        return 0;
+    }
+
+    switch (tag_type)
+    {
+        case TAG_Byte_Array:
+            if (nbt_buffer_read_be32(buf, &(sel->length)))
+                return (-1);
+            sel->offset = buf->position;
+            if (sel->length < 0 || nbt_buffer_take(buf, sel->length) == NULL)
+                return (-1);
+            break;
+
+        case TAG_String:
+            if (nbt_buffer_read_be16(buf, &short_length))
+                return (-1);
+            sel->length = short_length;
+            sel->offset = buf->position;
+            if (short_length < 0 || nbt_buffer_take(buf, short_length) == NULL)
+                return (-1);
+            break;
+
+        case TAG_List:
+            sel->offset = buf->position;
+            if (nbt_buffer_read_u8(buf, &child_tag_type) ||
+                nbt_buffer_read_be32(buf, &(sel->length)))
+                return (-1);
+
+            // Rewind so the whole payload, header included, gets skipped
+            buf->position = sel->offset;
+            if (nbt_buffer_skip_payload(buf, tag_type))
+                return (-1);
+            break;
+
+        default:
+            sel->offset = buf->position;
+            if (nbt_buffer_skip_payload(buf, tag_type))
+                return (-1);
+            break;
+    }
+
+    sel->found = 1;
+    return 0;
+}
+
+void *nbt_selection_payload(nbt_buffer *buf, nbt_selection *sel)
+{
+    if (buf == NULL || sel == NULL || !sel->found)
+        return NULL;
+
+    switch (sel->type)
+    {
+        case TAG_Byte:
+            return &(sel->value.byte_payload);
+        case TAG_Short:
+            return &(sel->value.short_payload);
+        case TAG_Int:
+            return &(sel->value.int_payload);
+        case TAG_Long:
+            return &(sel->value.long_payload);
+        case TAG_Float:
+            return &(sel->value.float_payload);
+        case TAG_Double:
+            return &(sel->value.double_payload);
+        default:
+            return buf->data + sel->offset;
+    }
+}
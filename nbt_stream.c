@@ -0,0 +1,284 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "nbt.h"
+#include "nbt_buffer.h"
+#include "nbt_stream.h"
+#include "read_nbt.h"
+
+int nbt_stream(nbt_buffer *buf, nbt_stream_handler *handler, void *user)
+{
+    return nbt_stream_with(buf, handler, user, NULL);
+}
+
+/* Walks the tags in a single loop. The tag being read is described by
+ * tag_type and its name; the lists and compounds it sits in are kept on an
+ * explicit stack of frames. Once a payload has been read, the loop pops
+ * frames until it finds the next tag, reporting the end of each list and
+ * compound it leaves on the way.
+ *
+ * The name is kept as an offset rather than a pointer, since reading the
+ * payload may move a buffer that is still being inflated. A name_length of -1
+ * means the tag is a member of a list and has no name. */
+int nbt_stream_with(nbt_buffer *buf, nbt_stream_handler *handler, void *user, const nbt_stream_options *options)
+{
+    extern __thread int nbt_read_error;
+    nbt_buffer_frame local_stack[NBT_BUFFER_MAX_DEPTH], *stack = local_stack, *frame;
+    uint8_t *raw, tag_type, child_tag_type, value[NBT_READ_BUFFER_SIZE];
+    int16_t name_length = -1, short_length;
+    int32_t length, i;
+    size_t name_offset = 0;
+    u_tag_payload converted;
+    int max_depth = NBT_BUFFER_MAX_DEPTH, depth = 0, action, result = (-1);
+
+// The name of the tag being read, as it should be passed to a callback
+#define NBT_STREAM_NAME (name_length < 0 ? NULL : (const char*)(buf->data + name_offset))
+#define NBT_STREAM_NAME_LENGTH (name_length < 0 ? 0 : name_length)
+
+    if (buf == NULL || handler == NULL)
+        return (-1);
+
+    if (options != NULL && options->max_depth > 0)
+        max_depth = options->max_depth;
+
+    if (max_depth > NBT_BUFFER_MAX_DEPTH)
+    {
+        stack = malloc(max_depth * sizeof(nbt_buffer_frame));
+        if (stack == NULL)
+        {
+            nbt_read_error = NBT_READ_OUT_OF_MEM;
+            return (-1);
+        }
+    }
+
+    if (options != NULL && options->payload_type != TAG_End)
+    {
+        tag_type = options->payload_type;
+        if (!nbt_is_valid_tag_type(tag_type))
+            goto nbt_stream_malformed;
+    }
+    else
+    {
+        if (nbt_buffer_read_u8(buf, &tag_type))
+            goto nbt_stream_done;
+
+        if (tag_type == TAG_End)
+        {
+            result = 0;
+            goto nbt_stream_done;
+        }
+
+        if (!nbt_is_valid_tag_type(tag_type))
+            goto nbt_stream_malformed;
+
+        if (nbt_buffer_read_be16(buf, &name_length))
+            goto nbt_stream_done;
+
+        if (name_length < 0)
+            goto nbt_stream_malformed;
+
+        name_offset = buf->position;
+        if (nbt_buffer_take(buf, name_length) == NULL)
+            goto nbt_stream_done;
+    }
+
+    for (;;)
+    {
+        action = NBT_STREAM_CONTINUE;
+
+        if (nbt_is_simple_tag_type(tag_type))
+        {
+            if ((raw = nbt_buffer_take(buf, nbt_get_payload_size(tag_type))) == NULL)
+                goto nbt_stream_done;
+
+            if (handler->scalar != NULL)
+            {
+                memcpy(value, raw, nbt_get_payload_size(tag_type));
+                nbt_convert_simple_payload(tag_type, value, &converted);
+                action = handler->scalar(user, NBT_STREAM_NAME, NBT_STREAM_NAME_LENGTH, tag_type, &converted);
+            }
+        }
+        else
+            switch (tag_type)
+            {
+                case TAG_Byte_Array:
+                    if (nbt_buffer_read_be32(buf, &length))
+                        goto nbt_stream_done;
+
+                    if (length < 0)
+                        goto nbt_stream_malformed;
+
+                    if ((raw = nbt_buffer_take(buf, length)) == NULL)
+                        goto nbt_stream_done;
+
+                    if (handler->byte_array != NULL)
+                        action = handler->byte_array(user, NBT_STREAM_NAME, NBT_STREAM_NAME_LENGTH, raw, length);
+                    break;
+
+                case TAG_String:
+                    if (nbt_buffer_read_be16(buf, &short_length))
+                        goto nbt_stream_done;
+
+                    if (short_length < 0)
+                        goto nbt_stream_malformed;
+
+                    if ((raw = nbt_buffer_take(buf, short_length)) == NULL)
+                        goto nbt_stream_done;
+
+                    if (handler->string != NULL)
+                        action = handler->string(user, NBT_STREAM_NAME, NBT_STREAM_NAME_LENGTH, (const char*)raw, short_length);
+                    break;
+
+                case TAG_List:
+                    if (nbt_buffer_read_u8(buf, &child_tag_type) ||
+                        nbt_buffer_read_be32(buf, &length))
+                        goto nbt_stream_done;
+
+                    if (length < 0 || !nbt_is_valid_tag_type(child_tag_type) ||
+                        (length > 0 && child_tag_type == TAG_End))
+                        goto nbt_stream_malformed;
+
+                    // Simple members can be handed over in one go
+                    if (nbt_is_simple_tag_type(child_tag_type) && handler->scalar_array != NULL)
+                    {
+                        if ((raw = nbt_buffer_take(buf, (size_t)length * nbt_get_payload_size(child_tag_type))) == NULL)
+                            goto nbt_stream_done;
+
+                        action = handler->scalar_array(user, NBT_STREAM_NAME, NBT_STREAM_NAME_LENGTH, child_tag_type, raw, length);
+                        break;
+                    }
+
+                    if (handler->begin_list != NULL)
+                        action = handler->begin_list(user, NBT_STREAM_NAME, NBT_STREAM_NAME_LENGTH, child_tag_type, length);
+
+                    if (action == NBT_STREAM_STOP)
+                        break;
+
+                    if (action == NBT_STREAM_SKIP)
+                    {
+                        if (nbt_is_simple_tag_type(child_tag_type))
+                        {
+                            if (nbt_buffer_take(buf, (size_t)length * nbt_get_payload_size(child_tag_type)) == NULL)
+                                goto nbt_stream_done;
+                        }
+                        else
+                            for (i = 0; i < length; i++)
+                                if (nbt_buffer_skip_payload_depth(buf, child_tag_type, max_depth))
+                                    goto nbt_stream_done;
+                        break;
+                    }
+
+                    if (depth == max_depth)
+                        goto nbt_stream_too_deep;
+
+                    frame = &stack[depth++];
+                    frame->tag_type = TAG_List;
+                    frame->child_tag_type = child_tag_type;
+                    frame->remaining = length;
+                    break;
+
+                case TAG_Compound:
+                    if (handler->begin_compound != NULL)
+                        action = handler->begin_compound(user, NBT_STREAM_NAME, NBT_STREAM_NAME_LENGTH);
+
+                    if (action == NBT_STREAM_STOP)
+                        break;
+
+                    if (action == NBT_STREAM_SKIP)
+                    {
+                        if (nbt_buffer_skip_payload_depth(buf, TAG_Compound, max_depth))
+                            goto nbt_stream_done;
+                        break;
+                    }
+
+                    if (depth == max_depth)
+                        goto nbt_stream_too_deep;
+
+                    frame = &stack[depth++];
+                    frame->tag_type = TAG_Compound;
+                    break;
+
+                default:
+                    goto nbt_stream_malformed;
+            }
+
+        if (action == NBT_STREAM_STOP)
+            break;
+
+        // Find the next tag, ending every list and compound that has run out
+        // on the way
+        for (;;)
+        {
+            if (depth == 0)
+                break;
+
+            frame = &stack[depth - 1];
+            action = NBT_STREAM_CONTINUE;
+
+            if (frame->tag_type == TAG_List)
+            {
+                if (frame->remaining > 0)
+                {
+                    frame->remaining--;
+                    tag_type = frame->child_tag_type;
+                    name_length = -1;
+                    break;
+                }
+
+                if (handler->end_list != NULL)
+                    action = handler->end_list(user);
+            }
+            else
+            {
+                if (nbt_buffer_read_u8(buf, &tag_type))
+                    goto nbt_stream_done;
+
+                if (tag_type != TAG_End)
+                {
+                    if (!nbt_is_valid_tag_type(tag_type))
+                        goto nbt_stream_malformed;
+
+                    if (nbt_buffer_read_be16(buf, &name_length))
+                        goto nbt_stream_done;
+
+                    if (name_length < 0)
+                        goto nbt_stream_malformed;
+
+                    name_offset = buf->position;
+                    if (nbt_buffer_take(buf, name_length) == NULL)
+                        goto nbt_stream_done;
+                    break;
+                }
+
+                if (handler->end_compound != NULL)
+                    action = handler->end_compound(user);
+            }
+
+            depth--;
+            if (action == NBT_STREAM_STOP)
+                break;
+        }
+
+        if (depth == 0 || action == NBT_STREAM_STOP)
+            break;
+    }
+
+    result = 0;
+    goto nbt_stream_done;
+
+nbt_stream_too_deep:
+    nbt_read_error = NBT_READ_TOO_DEEP;
+    goto nbt_stream_done;
+
+nbt_stream_malformed:
+    nbt_read_error = NBT_READ_MALFORMED_INPUT;
+
+nbt_stream_done:
+    if (stack != local_stack)
+        free(stack);
+
+    return result;
+
+#undef NBT_STREAM_NAME
+#undef NBT_STREAM_NAME_LENGTH
+}
@@ -4,27 +4,89 @@
 #include <stdlib.h>
 #include <endian.h>
 #include <wchar.h>
+#include <limits.h>
 #include "nbt.h"
 #include "read_nbt.h"
 #include "linked_list.h"
 #include "hashtable.h"
 #include "hashtable_itr.h"
 #include "utf8.h"
-
-int nbt_read_error;
+#include "nbt_buffer.h"
+#include "arena.h"
+#include "nbt_atom.h"
+#include "nbt_stream.h"
+#include "nbt_loader.h"
+
+__thread int nbt_read_error;
+
+// Different TAG_End tags don't really differ from one another, so we can
+// save a little memory here by only making one and just passing a pointer
+// to it when we need it. Nothing ever writes to it, so every thread can
+// share it.
+static const nbt_tag end_tag = {TAG_End, 0, NULL, 0, NULL, NULL};
+
+/* The state of nbt_read_buffer_tag() while it builds a tree */
+typedef struct
+{
+    arena   *arena;                             // Where to build, or NULL
+    nbt_tag *root;                              // The tag being read
+    nbt_tag *parents[NBT_BUFFER_MAX_DEPTH];     // The open lists and compounds
+    int      depth;                             // How many parents are open
+    int      failed;                            // Set when a callback fails
+} nbt_read_builder;
+
+static nbt_tag *nbt_read_tag(nbt_loader *ctx, gzFile file, int force_tag_type);
+static char *nbt_read_gzread_scratch(nbt_loader *ctx, gzFile file, int length);
+static nbt_tag *nbt_read_buffer_tag(nbt_buffer *buf, arena *a, int force_tag_type);
+static int nbt_read_builder_add(nbt_read_builder *b, nbt_tag *tag, const char *name, uint16_t name_length);
+static int nbt_read_builder_open(nbt_read_builder *b, nbt_tag *tag, const char *name, uint16_t name_length);
+static int nbt_read_builder_begin_compound(void *user, const char *name, uint16_t name_length);
+static int nbt_read_builder_begin_list(void *user, const char *name, uint16_t name_length, uint8_t child_tag_type, int32_t length);
+static int nbt_read_builder_end(void *user);
+static int nbt_read_builder_scalar(void *user, const char *name, uint16_t name_length, uint8_t tag_type, u_tag_payload *value);
+static int nbt_read_builder_byte_array(void *user, const char *name, uint16_t name_length, const uint8_t *data, int32_t length);
+static int nbt_read_builder_string(void *user, const char *name, uint16_t name_length, const char *utf8, int32_t length);
+static int nbt_read_builder_scalar_array(void *user, const char *name, uint16_t name_length, uint8_t child_tag_type, const uint8_t *raw, int32_t length);
 
 nbt_tag *nbt_read(gzFile file, int force_tag_type)
 {
-    // Different TAG_End tags don't really differ from one another, so we can
-    // save a little memory here by only making one and just passing a pointer
-    // to it when we need it.
-    static nbt_tag end_tag = {TAG_End, NULL, 0, NULL, NULL};
+    nbt_loader ctx;
+    nbt_tag *tag;
+
+    nbt_loader_init(&ctx, NULL, 0);
+    tag = nbt_read_tag(&ctx, file, force_tag_type);
+    nbt_loader_clear(&ctx);
+
+    return tag;
+}
+
+nbt_tag *nbt_read_with(nbt_loader *ctx, gzFile file, int force_tag_type)
+{
+    nbt_tag *tag;
+
+    if (ctx == NULL)
+        return NULL;
+
+    ctx->error = NBT_READ_OK;
+    tag = nbt_read_tag(ctx, file, force_tag_type);
+    if (tag == NULL)
+        ctx->error = nbt_read_error;
+
+    return tag;
+}
 
+/* Reads a tag out of a gzFile, recursing into lists and compounds. Names and
+ * strings are read through the loader's scratch memory. */
+static nbt_tag *nbt_read_tag(nbt_loader *ctx, gzFile file, int force_tag_type)
+{
     nbt_tag *tag, *child_tag;
     uint8_t tag_type = 0, child_tag_type = 0, payload_size = 0;
     int16_t name_length = 0, string_length = 0;
     int32_t byte_array_length = 0, i = 0, list_length = 0;
-    wchar_t *name = NULL, *string_payload, *child_name = NULL;
+    size_t list_size;
+    wchar_t *string_payload;
+    const nbt_atom *atom = NULL;
+    char *utf8;
     uint8_t *byte_array_payload, buffer[NBT_READ_BUFFER_SIZE];
 
     if (file == NULL)
@@ -47,7 +109,7 @@ nbt_tag *nbt_read(gzFile file, int force_tag_type)
 
     // If it's a TAG_End, we can stop here
     if (tag_type == TAG_End)
-        tag = &end_tag;
+        tag = (nbt_tag*)&end_tag;
     else
     {
         if (force_tag_type == 0)
@@ -63,23 +125,12 @@ nbt_tag *nbt_read(gzFile file, int force_tag_type)
                 goto nbt_read_malformed;
             }
             else if (name_length == 0)
-            {
-                name_length = 6;
-                name = calloc(name_length + 1, sizeof(wchar_t));
-                if (name == NULL)
-                    goto nbt_read_mem_error;
-                wcsncpy(name, L"(null)", name_length);
-            }
-            else
-            {
-                name = calloc(name_length + 1, sizeof(wchar_t));
-                if (name == NULL)
-                    goto nbt_read_mem_error;
+                atom = nbt_atom_intern("(null)", 6);
+            else if ((utf8 = nbt_read_gzread_scratch(ctx, file, name_length)) != NULL)
+                atom = nbt_atom_intern(utf8, name_length);
 
-                if (nbt_read_gzread_utf8(file, name, name_length))
-                    goto nbt_read_error;
-            }
-            //printf("Name: %ls\n", name);
+            if (atom == NULL)
+                goto nbt_read_error;
         }
 
         if (nbt_is_simple_tag_type(tag_type))
@@ -90,7 +141,7 @@ nbt_tag *nbt_read(gzFile file, int force_tag_type)
             if (nbt_read_gzread(file, (void*)buffer, payload_size))
                 goto nbt_read_error;
 
-            tag = nbt_new_simple_tag(tag_type, name, name_length, buffer);
+            tag = nbt_new_simple_tag(tag_type, NULL, 0, buffer);
         }
         else
             switch (tag_type)
@@ -113,7 +164,7 @@ nbt_tag *nbt_read(gzFile file, int force_tag_type)
                     if (nbt_read_gzread(file, (void*)byte_array_payload, byte_array_length))
                         goto nbt_read_error;
 
-                    tag = nbt_new_byte_array_tag(byte_array_payload, name, name_length, byte_array_length);
+                    tag = nbt_new_byte_array_tag(byte_array_payload, NULL, 0, byte_array_length);
                     break;
 
                 case TAG_String:
@@ -129,17 +180,23 @@ nbt_tag *nbt_read(gzFile file, int force_tag_type)
                     
                     if (string_length > 0)
                     {
+                        if ((utf8 = nbt_read_gzread_scratch(ctx, file, string_length)) == NULL)
+                            goto nbt_read_error;
+
                         string_payload = calloc(string_length + 1, sizeof(wchar_t));
                         if (string_payload == NULL)
                             goto nbt_read_mem_error;
 
-                        if (nbt_read_gzread_utf8(file, string_payload, string_length))
+                        if (utf8_to_wchar(utf8, string_length, string_payload, string_length, 0) == 0)
+                        {
+                            free(string_payload);
+                            nbt_read_error = NBT_READ_INVALID_UTF8;
                             goto nbt_read_error;
-
+                        }
                     }
                     else
                         string_payload = NULL;
-                    tag = nbt_new_string_tag(string_payload, name, name_length, string_length);
+                    tag = nbt_new_string_tag(string_payload, NULL, 0, string_length);
                     break;
 
                 case TAG_List:
@@ -152,8 +209,6 @@ nbt_tag *nbt_read(gzFile file, int force_tag_type)
                         goto nbt_read_malformed;
                     }
 
-                    tag = nbt_new_list_tag(name, name_length, child_tag_type);
-
                     if (nbt_read_gzread(file, (void*)&list_length, sizeof(list_length)))
                         goto nbt_read_error;
 
@@ -163,10 +218,36 @@ nbt_tag *nbt_read(gzFile file, int force_tag_type)
                         //printf("List length: %i\n", list_length);
                         goto nbt_read_malformed;
                     }
+
+                    // Simple elements are packed into an array in one go
+                    if (nbt_is_simple_tag_type(child_tag_type))
+                    {
+                        // gzread() takes an int, and no real list is that long
+                        list_size = (size_t)list_length * nbt_get_payload_size(child_tag_type);
+                        if (list_size > INT_MAX)
+                            goto nbt_read_malformed;
+
+                        tag = nbt_new_packed_list_tag(NULL, NULL, child_tag_type, list_length);
+                        if (tag == NULL)
+                            goto nbt_read_mem_error;
+
+                        if (nbt_read_gzread(file, tag->payload->array_payload, list_size))
+                        {
+                            nbt_free_tag(tag);
+                            goto nbt_read_error;
+                        }
+
+                        nbt_convert_simple_array(child_tag_type, tag->payload->array_payload, list_length, tag->payload->array_payload);
+                        break;
+                    }
+
+                    tag = nbt_new_list_tag(NULL, 0, child_tag_type);
+                    if (tag == NULL)
+                        goto nbt_read_mem_error;
                     
                     for (i = 0; i < list_length; i++)
                     {
-                        child_tag = nbt_read(file, child_tag_type);
+                        child_tag = nbt_read_tag(ctx, file, child_tag_type);
                         if (child_tag == NULL)
                         {
                             nbt_free_tag(tag);
@@ -184,11 +265,13 @@ nbt_tag *nbt_read(gzFile file, int force_tag_type)
                     break;
 
                 case TAG_Compound:
-                    tag = nbt_new_compound_tag(name, name_length);
+                    tag = nbt_new_compound_tag(NULL, 0);
+                    if (tag == NULL)
+                        goto nbt_read_mem_error;
 
                     do
                     {
-                        child_tag = nbt_read(file, 0);
+                        child_tag = nbt_read_tag(ctx, file, 0);
                         if (child_tag == NULL)
                         {
                             nbt_free_tag(tag);
@@ -197,13 +280,7 @@ nbt_tag *nbt_read(gzFile file, int force_tag_type)
                         }
 
                         if (child_tag->type != TAG_End)
-                        {
-                            // Copy the child's name to use as a key
-                            child_name = calloc(child_tag->name_len + 1, sizeof(wchar_t));
-                            wcsncpy(child_name, child_tag->name, child_tag->name_len);
-
-                            hashtable_insert(tag->payload->compound_payload, child_name, child_tag);
-                        }
+                            nbt_compound_insert(tag->payload->compound_payload, child_tag->atom, child_tag);
 
                     } while (child_tag != NULL && child_tag->type != TAG_End);
 
@@ -211,6 +288,9 @@ nbt_tag *nbt_read(gzFile file, int force_tag_type)
             }
     }
 
+    if (tag != NULL && tag != &end_tag)
+        nbt_set_name(tag, atom);
+
     //nbt_print_single(tag, 2);
     return tag;
 
@@ -223,9 +303,6 @@ nbt_read_malformed:
     goto nbt_read_error;
 
 nbt_read_error:
-
-    if (name != NULL)
-        free(name);
     return NULL;
 }
 
@@ -260,27 +337,348 @@ int nbt_read_gzread(gzFile file, void *buffer, int length)
     return 0;
 }
 
+const nbt_atom *nbt_read_gzread_atom(gzFile file, int length)
+{
+    const nbt_atom *atom;
+    char *utf8;
+
+    utf8 = malloc(length);
+    if (utf8 == NULL)
+    {
+        nbt_read_error = NBT_READ_OUT_OF_MEM;
+        return NULL;
+    }
+
+    if (nbt_read_gzread(file, utf8, length))
+        atom = NULL;
+    else
+        atom = nbt_atom_intern(utf8, length);
+
+    free(utf8);
+    return atom;
+}
+
 int nbt_read_gzread_utf8(gzFile file, wchar_t *wchar_buffer, int length)
 {
-    static unsigned char utf8_data[NBT_READ_UTF8_BUFFER_SIZE];
-    int bytes_read;
+    nbt_loader ctx;
+    char *utf8;
+    int err = 0;
 
     if (length < 1)
         return 0;
 
-    memset(utf8_data, 0, NBT_READ_UTF8_BUFFER_SIZE);
+    nbt_loader_init(&ctx, NULL, 0);
 
-    if (nbt_read_gzread(file, utf8_data, length))
-        return (-1);
-
-    bytes_read = utf8_to_wchar(utf8_data, length, wchar_buffer, length, 0);
-    if (bytes_read == 0)
+    utf8 = nbt_read_gzread_scratch(&ctx, file, length);
+    if (utf8 == NULL)
+        err = (-1);
+    else if (utf8_to_wchar(utf8, length, wchar_buffer, length, 0) == 0)
     {
         nbt_read_error = NBT_READ_INVALID_UTF8;
-        return (-1);
+        err = (-1);
     }
 
-    return 0;
+    nbt_loader_clear(&ctx);
+    return err;
+}
+
+/* Reads length bytes into the loader's scratch memory */
+static char *nbt_read_gzread_scratch(nbt_loader *ctx, gzFile file, int length)
+{
+    char *scratch;
+
+    scratch = nbt_loader_scratch(ctx, length);
+    if (scratch == NULL)
+    {
+        nbt_read_error = NBT_READ_OUT_OF_MEM;
+        return NULL;
+    }
+
+    if (nbt_read_gzread(file, scratch, length))
+        return NULL;
+
+    return scratch;
+}
+
+
+
+nbt_tag *nbt_read_buffer(nbt_buffer *buf, int force_tag_type)
+{
+    return nbt_read_buffer_tag(buf, NULL, force_tag_type);
+}
+
+nbt_tag *nbt_read_buffer_arena(nbt_buffer *buf, arena *a, int force_tag_type)
+{
+    if (a == NULL)
+        return NULL;
+
+    return nbt_read_buffer_tag(buf, a, force_tag_type);
+}
+
+nbt_tag *nbt_read_buffer_with(nbt_loader *ctx, nbt_buffer *buf, int force_tag_type)
+{
+    nbt_tag *tag;
+
+    if (ctx == NULL)
+        return NULL;
+
+    ctx->error = NBT_READ_OK;
+    tag = nbt_read_buffer_tag(buf, ctx->arena, force_tag_type);
+    if (tag == NULL)
+        ctx->error = nbt_read_error;
+
+    return tag;
+}
+
+/* Reads a tag out of a buffer, building it in the arena if one is given and
+ * with malloc otherwise. The tree is built from the events of
+ * nbt_stream_with(), so nothing here recurses: the tags still being filled
+ * are kept in the builder's own stack of parents. On error, anything already
+ * allocated in the arena is simply left there for the caller to reset. */
+static nbt_tag *nbt_read_buffer_tag(nbt_buffer *buf, arena *a, int force_tag_type)
+{
+    nbt_read_builder builder;
+    nbt_stream_options options;
+    nbt_stream_handler handler =
+    {
+        nbt_read_builder_begin_compound,
+        nbt_read_builder_end,
+        nbt_read_builder_begin_list,
+        nbt_read_builder_end,
+        nbt_read_builder_scalar,
+        nbt_read_builder_byte_array,
+        nbt_read_builder_string,
+        nbt_read_builder_scalar_array,
+    };
+
+    if (buf == NULL)
+        return NULL;
+
+    // Tags point into the buffer, so it mustn't move underneath them
+    if (nbt_buffer_finish(buf))
+        return NULL;
+
+    builder.arena = a;
+    builder.root = NULL;
+    builder.depth = 0;
+    builder.failed = 0;
+
+    options.max_depth = NBT_BUFFER_MAX_DEPTH;
+    options.payload_type = force_tag_type > 0 ? force_tag_type : TAG_End;
+
+    if (nbt_stream_with(buf, &handler, &builder, &options) || builder.failed)
+    {
+        nbt_free_tag(builder.root);
+        return NULL;
+    }
+
+    // Nothing was built, so the tag was a TAG_End
+    if (builder.root == NULL)
+        return (nbt_tag*)&end_tag;
+
+    return builder.root;
+}
+
+/* Names a new tag and hangs it off the tag it belongs to. Takes ownership of
+ * tag, which may be NULL if it couldn't be allocated. */
+static int nbt_read_builder_add(nbt_read_builder *b, nbt_tag *tag, const char *name, uint16_t name_length)
+{
+    const nbt_atom *atom;
+    nbt_tag *parent;
+
+    if (tag == NULL)
+        goto nbt_read_builder_mem_error;
+
+    // Members of a list have no name
+    if (name != NULL)
+    {
+        if (name_length == 0)
+            atom = nbt_atom_intern("(null)", 6);
+        else
+            atom = nbt_atom_intern(name, name_length);
+
+        if (atom == NULL)
+            goto nbt_read_builder_error;
+
+        nbt_set_name(tag, atom);
+    }
+
+    if (b->depth == 0)
+    {
+        b->root = tag;
+        return NBT_STREAM_CONTINUE;
+    }
+
+    parent = b->parents[b->depth - 1];
+    if (parent->type == TAG_Compound)
+    {
+        if (nbt_compound_insert(parent->payload->compound_payload, tag->atom, tag))
+            goto nbt_read_builder_mem_error;
+    }
+    else if (b->arena != NULL)
+    {
+        if (nbt_arena_list_push(b->arena, parent, tag))
+            goto nbt_read_builder_mem_error;
+    }
+    else if (list_push(parent->payload->list_payload, tag))
+        goto nbt_read_builder_mem_error;
+
+    return NBT_STREAM_CONTINUE;
+
+nbt_read_builder_mem_error:
+    nbt_read_error = NBT_READ_OUT_OF_MEM;
+
+nbt_read_builder_error:
+    nbt_free_tag(tag);
+    b->failed = 1;
+    return NBT_STREAM_STOP;
+}
+
+/* Adds a list or compound, then makes it the parent of the tags that follow */
+static int nbt_read_builder_open(nbt_read_builder *b, nbt_tag *tag, const char *name, uint16_t name_length)
+{
+    if (b->depth == NBT_BUFFER_MAX_DEPTH)
+    {
+        nbt_free_tag(tag);
+        nbt_read_error = NBT_READ_TOO_DEEP;
+        b->failed = 1;
+        return NBT_STREAM_STOP;
+    }
+
+    if (nbt_read_builder_add(b, tag, name, name_length) != NBT_STREAM_CONTINUE)
+        return NBT_STREAM_STOP;
+
+    b->parents[b->depth++] = tag;
+    return NBT_STREAM_CONTINUE;
+}
+
+static int nbt_read_builder_begin_compound(void *user, const char *name, uint16_t name_length)
+{
+    nbt_read_builder *b = user;
+    nbt_tag *tag;
+
+    if (b->arena != NULL)
+        tag = nbt_new_arena_tag(b->arena, TAG_Compound, NULL);
+    else
+        tag = nbt_new_compound_tag(NULL, 0);
+
+    return nbt_read_builder_open(b, tag, name, name_length);
+}
+
+static int nbt_read_builder_begin_list(void *user, const char *name, uint16_t name_length, uint8_t child_tag_type, int32_t length)
+{
+    nbt_read_builder *b = user;
+    nbt_tag *tag;
+
+    if (b->arena != NULL)
+    {
+        tag = nbt_new_arena_tag(b->arena, TAG_List, NULL);
+        if (tag != NULL)
+            tag->meta->child_tag_type = child_tag_type;
+    }
+    else
+        tag = nbt_new_list_tag(NULL, 0, child_tag_type);
+
+    return nbt_read_builder_open(b, tag, name, name_length);
+}
+
+static int nbt_read_builder_end(void *user)
+{
+    ((nbt_read_builder*)user)->depth--;
+    return NBT_STREAM_CONTINUE;
+}
+
+static int nbt_read_builder_scalar(void *user, const char *name, uint16_t name_length, uint8_t tag_type, u_tag_payload *value)
+{
+    nbt_read_builder *b = user;
+    u_tag_payload *payload;
+    nbt_tag *tag;
+
+    if (b->arena != NULL)
+    {
+        tag = nbt_new_arena_tag(b->arena, tag_type, NULL);
+        if (tag != NULL)
+            *(tag->payload) = *value;
+    }
+    else
+    {
+        tag = NULL;
+        payload = malloc(sizeof(u_tag_payload));
+        if (payload != NULL)
+        {
+            *payload = *value;
+            tag = nbt_new_tag(tag_type, NULL, 0, NULL, payload);
+            if (tag == NULL)
+                free(payload);
+        }
+    }
+
+    return nbt_read_builder_add(b, tag, name, name_length);
+}
+
+static int nbt_read_builder_byte_array(void *user, const char *name, uint16_t name_length, const uint8_t *data, int32_t length)
+{
+    nbt_read_builder *b = user;
+    nbt_tag *tag;
+
+    if (length < 1)
+    {
+        nbt_read_error = NBT_READ_MALFORMED_INPUT;
+        b->failed = 1;
+        return NBT_STREAM_STOP;
+    }
+
+    // The payload stays where it is; the tag just borrows it.
+    if (b->arena != NULL)
+    {
+        tag = nbt_new_arena_tag(b->arena, TAG_Byte_Array, NULL);
+        if (tag != NULL)
+        {
+            tag->payload->byte_array_payload = (uint8_t*)data;
+            tag->meta->length = length;
+        }
+    }
+    else
+        tag = nbt_new_byte_array_tag((uint8_t*)data, NULL, 0, length);
+
+    if (tag != NULL)
+        tag->flags |= NBT_TAG_BORROWED;
+
+    return nbt_read_builder_add(b, tag, name, name_length);
+}
+
+static int nbt_read_builder_string(void *user, const char *name, uint16_t name_length, const char *utf8, int32_t length)
+{
+    nbt_read_builder *b = user;
+    nbt_tag *tag;
+
+    if (b->arena != NULL)
+    {
+        tag = nbt_new_arena_tag(b->arena, TAG_String, NULL);
+        if (tag != NULL)
+            tag->meta->length = length;
+    }
+    else
+        tag = nbt_new_string_tag(NULL, NULL, 0, length);
+
+    if (tag != NULL)
+    {
+        tag->payload->utf8_payload = length > 0 ? (char*)utf8 : NULL;
+        tag->flags |= NBT_TAG_BORROWED | NBT_TAG_UTF8;
+    }
+
+    return nbt_read_builder_add(b, tag, name, name_length);
 }
 
+/* Simple members are packed into an array in one go */
+static int nbt_read_builder_scalar_array(void *user, const char *name, uint16_t name_length, uint8_t child_tag_type, const uint8_t *raw, int32_t length)
+{
+    nbt_read_builder *b = user;
+    nbt_tag *tag;
+
+    tag = nbt_new_packed_list_tag(b->arena, NULL, child_tag_type, length);
+    if (tag != NULL)
+        nbt_convert_simple_array(child_tag_type, raw, length, tag->payload->array_payload);
 
+    return nbt_read_builder_add(b, tag, name, name_length);
+}
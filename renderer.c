@@ -1,17 +1,72 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <png.h>
 #include <setjmp.h>
 #include <math.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "renderer.h"
 #include "level.h"
 #include "hashtable.h"
 #include "chunk.h"
 
+/** \brief One thread of renderer_perform_parallel(), and the tiles it has
+  *        left to render */
+typedef struct
+{
+    renderer *r;                /**< \brief What it renders with */
+    pthread_mutex_t lock;       /**< \brief Guards head and tail */
+    uint64_t head;              /**< \brief The next tile it renders */
+    uint64_t tail;              /**< \brief One past the last tile it has */
+    uint64_t failed;            /**< \brief How many tiles failed */
+    struct renderer_batch *batch;
+    pthread_t thread;
+} renderer_worker;
+
+/** \brief What the threads of renderer_perform_parallel() share */
+typedef struct renderer_batch
+{
+    const renderer_tile *tiles;
+    const char *output_dir;
+    renderer_worker *workers;
+    int count;
+} renderer_batch;
+
+/** \brief A tile being drawn by renderer_perform_bands(), and the bands
+  *        not yet handed out */
+typedef struct
+{
+    png_bytep image;            /**< \brief The whole tile, four bytes a
+                                  *         pixel */
+    int width;                  /**< \brief The width of the tile */
+    int height;                 /**< \brief The height of the tile */
+    int band_height;            /**< \brief How many rows a band has */
+    int count;                  /**< \brief How many bands there are */
+    int next;                   /**< \brief The next band to hand out */
+    pthread_mutex_t lock;       /**< \brief Guards next */
+} renderer_bands;
+
+/** \brief One thread of renderer_perform_bands() */
+typedef struct
+{
+    renderer *r;                /**< \brief What it draws with */
+    renderer_bands *bands;
+    pthread_t thread;
+} renderer_band_worker;
+
+static int renderer_write(renderer *r, char *output_path, png_bytep image);
+static void *renderer_band_run(void *data);
+static int renderer_perform_tile(renderer *r, const renderer_tile *tile, const char *output_dir);
+static void *renderer_worker_run(void *data);
+static int renderer_worker_steal(renderer_worker *thief);
+static int renderer_compare_tiles(const void *a, const void *b);
+
 renderer *renderer_new(level *lvl, color_map *map, renderer_funcs *funcs, chunk_cache *cache)
 {
     renderer *new;
+    int i;
 
     new = calloc(1, sizeof(renderer));
     
@@ -21,6 +76,12 @@ renderer *renderer_new(level *lvl, color_map *map, renderer_funcs *funcs, chunk_
         new->funcs = funcs;
         new->map = map;
         new->cache = cache;
+
+        // Which blocks can be seen through only depends on the colors, so
+        // it's worked out once
+        for (i = 0; i < 256; i++)
+            new->alpha[i] = map != NULL ? color_map_get(map, i)[COLOR_ALPHA_OFFSET] : 255;
+
 #ifdef DO_BLOCK_COUNT
         memset(new->block_count, 0, 256);
 #endif
@@ -31,12 +92,8 @@ renderer *renderer_new(level *lvl, color_map *map, renderer_funcs *funcs, chunk_
 
 int renderer_perform(renderer *r, int32_t tile_x, int32_t tile_z, char *output_path)
 {
-    int err;
-    FILE *file = NULL;
-    png_structp png_ptr = NULL;
-    png_infop   png_info = NULL;
-    uint32_t width, height, row_number;
-    png_bytep png_row = NULL;
+    int err, width, height;
+    png_bytep image;
 
     // Ensure the data is sane
     if (renderer_sanity_check(r))
@@ -45,12 +102,149 @@ int renderer_perform(renderer *r, int32_t tile_x, int32_t tile_z, char *output_p
     r->tile_x = tile_x;
     r->tile_z = tile_z;
 
+    if (r->funcs->dimensions(&width, &height))
+        return RENDER_ERR_DIM;
+
+    // The whole tile is drawn before any of it is encoded, so a renderer
+    // can go about it in whatever order suits it. 4 bytes per pixel.
+    image = malloc(4 * width * height * sizeof(png_byte));
+    if (image == NULL)
+        return RENDER_MEM_IMAGE;
+
+    if (r->funcs->draw_tile != NULL)
+        r->funcs->draw_tile(r, image);
+    else
+        renderer_draw_rows(r, image);
+
+    err = renderer_write(r, output_path, image);
+
+    free(image);
+    return err;
+}
+
+void renderer_draw_rows(void *_r, png_bytep image)
+{
+    renderer *r = (renderer*)_r;
+    int width, height, row_number;
+
+    if (r->funcs->dimensions(&width, &height))
+        return;
+
+    for (row_number = 0; row_number < height; row_number++)
+        r->funcs->draw_row(r, image + 4 * width * row_number, row_number);
+}
+
+int renderer_perform_bands(renderer *r, int32_t tile_x, int32_t tile_z, char *output_path, int threads)
+{
+    renderer_bands bands;
+    renderer_band_worker *workers = NULL;
+    long processors;
+    int err, w;
+
+    if (renderer_sanity_check(r))
+        return RENDER_ERR_SANITY;
+
+    if (r->funcs->dimensions(&bands.width, &bands.height))
+        return RENDER_ERR_DIM;
+
+    if (threads <= 0)
+    {
+        processors = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = processors > 0 ? processors : 1;
+    }
+    if (threads > RENDERER_MAX_THREADS)
+        threads = RENDERER_MAX_THREADS;
+
+    // Only a renderer that says where its bands are, and can draw them a row
+    // at a time, can be split into them
+    bands.band_height = r->funcs->band_height;
+    if (bands.band_height <= 0 || bands.height % bands.band_height != 0 ||
+        r->funcs->draw_row == NULL || r->funcs->new_cache == NULL)
+        return renderer_perform(r, tile_x, tile_z, output_path);
+
+    bands.count = bands.height / bands.band_height;
+    if (threads > bands.count)
+        threads = bands.count;
+    if (threads <= 1)
+        return renderer_perform(r, tile_x, tile_z, output_path);
+
+    bands.image = malloc(4 * bands.width * bands.height * sizeof(png_byte));
+    if (bands.image == NULL)
+        return RENDER_MEM_IMAGE;
+
+    workers = calloc(threads, sizeof(renderer_band_worker));
+    if (workers == NULL)
+    {
+        free(bands.image);
+        return RENDER_MEM_IMAGE;
+    }
+
+    r->tile_x = tile_x;
+    r->tile_z = tile_z;
+    bands.next = 0;
+    pthread_mutex_init(&bands.lock, NULL);
+
+    // As with a batch, the calling thread draws with r and the others with
+    // copies of it. A band nobody else gets to is drawn by whoever's left.
+    for (w = 0; w < threads; w++)
+        workers[w].bands = &bands;
+
+    workers[0].r = r;
+    for (w = 1; w < threads; w++)
+    {
+        workers[w].r = malloc(sizeof(renderer));
+        if (workers[w].r == NULL)
+            continue;
+
+        memcpy(workers[w].r, r, sizeof(renderer));
+        workers[w].r->cache = r->funcs->new_cache();
+        if (workers[w].r->cache == NULL ||
+            pthread_create(&workers[w].thread, NULL, renderer_band_run, workers + w))
+        {
+            if (workers[w].r->cache != NULL)
+                cache_free(workers[w].r->cache);
+            free(workers[w].r);
+            workers[w].r = NULL;
+        }
+    }
+
+    renderer_band_run(workers);
+
+    for (w = 1; w < threads; w++)
+    {
+        if (workers[w].r == NULL)
+            continue;
+
+        pthread_join(workers[w].thread, NULL);
+        cache_free(workers[w].r->cache);
+        free(workers[w].r);
+    }
+    pthread_mutex_destroy(&bands.lock);
+    free(workers);
+
+    // Every band is drawn, so the rows can go out in order
+    err = renderer_write(r, output_path, bands.image);
+
+    free(bands.image);
+    return err;
+}
+
+/* Writes a tile drawn by r as a PNG, row by row from image, four bytes a
+ * pixel */
+static int renderer_write(renderer *r, char *output_path, png_bytep image)
+{
+    int err;
+    FILE *file = NULL;
+    png_structp png_ptr = NULL;
+    png_infop   png_info = NULL;
+    uint32_t width, height, row_number;
+
     // Open the output file
     file = fopen(output_path, "wb");
     if (file == NULL)
     {
         err = RENDER_ERR_FILE;
-        goto renderer_perform_cleanup;
+        goto renderer_write_cleanup;
     }
 
     // Initialize the PNG image
@@ -58,7 +252,7 @@ int renderer_perform(renderer *r, int32_t tile_x, int32_t tile_z, char *output_p
     if (png_ptr == NULL)
     {
         err = RENDER_MEM_PNGWRITE;
-        goto renderer_perform_cleanup;
+        goto renderer_write_cleanup;
     }
 
     // Init the PNG info struct
@@ -66,14 +260,14 @@ int renderer_perform(renderer *r, int32_t tile_x, int32_t tile_z, char *output_p
     if (png_info == NULL)
     {
         err = RENDER_MEM_PNGINFO;
-        goto renderer_perform_cleanup;
+        goto renderer_write_cleanup;
     }
 
     // If libPNG has an error, it will jump here to exit
     if (setjmp(png_jmpbuf(png_ptr)))
     {
         err = RENDER_ERR_PNG;
-        goto renderer_perform_cleanup;
+        goto renderer_write_cleanup;
     }
 
     // Show libPNG where to write the tile image
@@ -83,7 +277,7 @@ int renderer_perform(renderer *r, int32_t tile_x, int32_t tile_z, char *output_p
     if (r->funcs->dimensions(&width, &height))
     {
         err = RENDER_ERR_DIM;
-        goto renderer_perform_cleanup;
+        goto renderer_write_cleanup;
     }
 
     // Set the PNG metadata
@@ -100,47 +294,330 @@ int renderer_perform(renderer *r, int32_t tile_x, int32_t tile_z, char *output_p
 
     // TODO: Set text if desired (probably not for tiles)
 
-    // Allocate one row of image data and reuse the crap out of it
-    // We need 4 bytes per pixel (8 bits each for red, green, blue, and alpha)
-    png_row = malloc(4 * width * sizeof(png_byte));
-    if (png_row == NULL)
-    {
-        err = RENDER_MEM_ROW;
-        goto renderer_perform_cleanup;
-    }
-
-    // Render the image a row at a time
     for (row_number = 0; row_number < height; row_number++)
-    {
-        r->funcs->draw_row(r, png_row, row_number);
-        png_write_row(png_ptr, png_row);
-    }
+        png_write_row(png_ptr, image + 4 * width * row_number);
 
     // Close the PNG image and clean up
     png_write_end(png_ptr, NULL);
 
     err = RENDER_OK;
 
-renderer_perform_cleanup:
+renderer_write_cleanup:
     if (file != NULL)
         fclose(file);
     if (png_info != NULL)
         png_free_data(png_ptr, png_info, PNG_FREE_ALL, -1);
     if (png_ptr != NULL)
         png_destroy_write_struct(&png_ptr, &png_info);
-    if (png_row != NULL)
-        free(png_row);
 
     return err;
 }
 
+int renderer_list_tiles(level *lvl, const int32_t *rect, renderer_tile **tiles, uint64_t *count)
+{
+    level_scan *scan;
+    renderer_tile *list = NULL, *tile;
+    int32_t tile_x, tile_z;
+    uint64_t i, used = 0, capacity = 0;
+
+    *tiles = NULL;
+    *count = 0;
+
+    scan = level_get_chunks(lvl);
+    if (scan == NULL)
+        return -1;
+
+    // The chunks are sorted by X then Z, so the chunks of a tile come in
+    // bunches, but a tile's bunches are interleaved with its neighbours'
+    // along Z. Collect them all, then sort and merge.
+    for (i = 0; i < scan->count; i++)
+    {
+        tile_x = RENDERER_TILE_OF(scan->coords[i].coord_x);
+        tile_z = RENDERER_TILE_OF(scan->coords[i].coord_z);
+
+        if (rect != NULL &&
+            (tile_x < rect[0] || tile_z < rect[1] || tile_x > rect[2] || tile_z > rect[3]))
+            continue;
+
+        if (used > 0 && list[used - 1].tile_x == tile_x && list[used - 1].tile_z == tile_z)
+        {
+            list[used - 1].chunks++;
+            continue;
+        }
+
+        if (used == capacity)
+        {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            tile = realloc(list, capacity * sizeof(renderer_tile));
+            if (tile == NULL)
+            {
+                free(list);
+                level_scan_free(scan);
+                return -1;
+            }
+            list = tile;
+        }
+
+        list[used].tile_x = tile_x;
+        list[used].tile_z = tile_z;
+        list[used].chunks = 1;
+        used++;
+    }
+    level_scan_free(scan);
+
+    if (used > 0)
+        qsort(list, used, sizeof(renderer_tile), renderer_compare_tiles);
+
+    // Merge the bunches of each tile
+    for (i = 1, tile = list; i < used; i++)
+    {
+        if (list[i].tile_x == tile->tile_x && list[i].tile_z == tile->tile_z)
+            tile->chunks += list[i].chunks;
+        else
+            *++tile = list[i];
+    }
+
+    *tiles = list;
+    *count = used > 0 ? tile - list + 1 : 0;
+
+    return 0;
+}
+
+uint64_t renderer_perform_all(renderer *r, const renderer_tile *tiles, uint64_t count, const char *output_dir)
+{
+    uint64_t i, failed = 0;
+
+    for (i = 0; i < count; i++)
+        if (renderer_perform_tile(r, tiles + i, output_dir))
+            failed++;
+
+    return failed;
+}
+
+uint64_t renderer_perform_parallel(renderer *r, const renderer_tile *tiles, uint64_t count, const char *output_dir, int threads)
+{
+    renderer_batch batch;
+    renderer_worker *workers;
+    uint64_t total = 0, share = 0, i, failed = 0;
+    long processors;
+    int w, started;
+
+    if (threads <= 0)
+    {
+        processors = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = processors > 0 ? processors : 1;
+    }
+    if (threads > RENDERER_MAX_THREADS)
+        threads = RENDERER_MAX_THREADS;
+    if (threads > count)
+        threads = count;
+
+    if (threads <= 1 || r->funcs == NULL || r->funcs->new_cache == NULL)
+        return renderer_perform_all(r, tiles, count, output_dir);
+
+    workers = calloc(threads, sizeof(renderer_worker));
+    if (workers == NULL)
+        return renderer_perform_all(r, tiles, count, output_dir);
+
+    batch.tiles = tiles;
+    batch.output_dir = output_dir;
+    batch.workers = workers;
+    batch.count = threads;
+
+    // Hand out runs of neighbouring tiles with about as many chunks each,
+    // since that's most of what a tile costs
+    for (i = 0; i < count; i++)
+        total += tiles[i].chunks;
+
+    for (w = 0, i = 0; w < threads; w++)
+    {
+        workers[w].batch = &batch;
+        workers[w].head = i;
+        while (i < count && (w == threads - 1 || share * threads < total * (w + 1)))
+            share += tiles[i++].chunks;
+        workers[w].tail = i;
+        pthread_mutex_init(&workers[w].lock, NULL);
+    }
+
+    // The calling thread is the first worker and uses r itself. The others
+    // get a copy with a cache of their own; one that can't be made or
+    // started just leaves its tiles to be stolen.
+    workers[0].r = r;
+    for (w = 1, started = 1; w < threads; w++)
+    {
+        workers[w].r = malloc(sizeof(renderer));
+        if (workers[w].r == NULL)
+            continue;
+
+        memcpy(workers[w].r, r, sizeof(renderer));
+        workers[w].r->cache = r->funcs->new_cache();
+        if (workers[w].r->cache == NULL ||
+            pthread_create(&workers[w].thread, NULL, renderer_worker_run, workers + w))
+        {
+            if (workers[w].r->cache != NULL)
+                cache_free(workers[w].r->cache);
+            free(workers[w].r);
+            workers[w].r = NULL;
+            continue;
+        }
+        started++;
+    }
+
+    renderer_worker_run(workers);
+
+    for (w = 1; w < threads; w++)
+    {
+        if (workers[w].r == NULL)
+            continue;
+
+        pthread_join(workers[w].thread, NULL);
+        cache_free(workers[w].r->cache);
+        free(workers[w].r);
+    }
+
+    for (w = 0; w < threads; w++)
+    {
+        failed += workers[w].failed;
+        pthread_mutex_destroy(&workers[w].lock);
+    }
+
+    free(workers);
+    return failed;
+}
+
+/* Draws bands of a tile until there are none left */
+static void *renderer_band_run(void *data)
+{
+    renderer_band_worker *worker = data;
+    renderer_bands *bands = worker->bands;
+    int band, row_number;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&bands->lock);
+        band = bands->next++;
+        pthread_mutex_unlock(&bands->lock);
+
+        if (band >= bands->count)
+            break;
+
+        for (row_number = band * bands->band_height; row_number < (band + 1) * bands->band_height; row_number++)
+            worker->r->funcs->draw_row(worker->r, bands->image + 4 * bands->width * row_number, row_number);
+    }
+
+    return NULL;
+}
+
+/* Renders a tile into a directory, reporting why if it fails */
+static int renderer_perform_tile(renderer *r, const renderer_tile *tile, const char *output_dir)
+{
+    char path[RENDERER_PATH_SIZE];
+    int err;
+
+    if (snprintf(path, RENDERER_PATH_SIZE, "%s/tile_%i_%i.png", output_dir, tile->tile_x, tile->tile_z) >= RENDERER_PATH_SIZE)
+        err = RENDER_ERR_FILE;
+    else
+        err = renderer_perform(r, tile->tile_x, tile->tile_z, path);
+
+    if (err)
+        fprintf(stderr, "Rendering tile %i, %i failed: %i\n", tile->tile_x, tile->tile_z, err);
+
+    return err;
+}
+
+/* Renders a worker's own tiles from the front, then steals until there are
+ * none left anywhere */
+static void *renderer_worker_run(void *data)
+{
+    renderer_worker *worker = data;
+    uint64_t tile;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&worker->lock);
+        if (worker->head < worker->tail)
+        {
+            tile = worker->head++;
+            pthread_mutex_unlock(&worker->lock);
+
+            if (renderer_perform_tile(worker->r, worker->batch->tiles + tile, worker->batch->output_dir))
+                worker->failed++;
+            continue;
+        }
+        pthread_mutex_unlock(&worker->lock);
+
+        if (!renderer_worker_steal(worker))
+            break;
+    }
+
+    return NULL;
+}
+
+/* Takes the back half of the tiles of whichever worker has the most left.
+ * Returns 0 once there's nothing left to take. Only one lock is ever held
+ * at a time, so thieves can't deadlock each other. */
+static int renderer_worker_steal(renderer_worker *thief)
+{
+    renderer_batch *batch = thief->batch;
+    renderer_worker *victim;
+    uint64_t left, most, head, tail;
+    int w, chosen;
+
+    for (;;)
+    {
+        // Pick a victim; its count is checked again once it's locked for
+        // the steal, since it may have changed in between
+        chosen = -1;
+        most = 0;
+        for (w = 0; w < batch->count; w++)
+        {
+            victim = batch->workers + w;
+            pthread_mutex_lock(&victim->lock);
+            left = victim->tail - victim->head;
+            pthread_mutex_unlock(&victim->lock);
+
+            if (left > most)
+            {
+                most = left;
+                chosen = w;
+            }
+        }
+
+        if (chosen < 0)
+            return 0;
+
+        victim = batch->workers + chosen;
+        pthread_mutex_lock(&victim->lock);
+        left = victim->tail - victim->head;
+        if (left == 0)
+        {
+            // Someone else got there first
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+
+        tail = victim->tail;
+        head = tail - (left + 1) / 2;
+        victim->tail = head;
+        pthread_mutex_unlock(&victim->lock);
+
+        pthread_mutex_lock(&thief->lock);
+        thief->head = head;
+        thief->tail = tail;
+        pthread_mutex_unlock(&thief->lock);
+
+        return 1;
+    }
+}
+
 int renderer_sanity_check(renderer *r)
 {
     if (r->funcs != NULL)
     {
         if (
             r->funcs->dimensions  == NULL ||
-            r->funcs->draw_row    == NULL 
+            (r->funcs->draw_row   == NULL &&
+             r->funcs->draw_tile  == NULL)
            )
             return -1;
     }
@@ -196,11 +673,9 @@ void renderer_blend_color(png_bytep pixel1, png_bytep pixel2, float gamma)
 
 float renderer_calc_gamma(chunk *c, int16_t coord_x, int16_t coord_y, int16_t coord_z, float sky_percent, float block_percent)
 {
-    float sky, block;
-    float gamma;
-    uint32_t offset;
+    int sky, block;
 
-    if (c == NULL || c->skylight == NULL || c->blocklight == NULL)
+    if (c == NULL)
         return 1.0;
 
     if ( coord_x < 0 || coord_x > 15 ||
@@ -212,17 +687,29 @@ float renderer_calc_gamma(chunk *c, int16_t coord_x, int16_t coord_y, int16_t co
         block_percent < 0 || block_percent > 1.0)
         return 1.0;
 
-    offset = chunk_generate_4bit_offset(c, coord_x, coord_y, coord_z, CHUNK_SIZE_AREA * c->height / 2);
-    if ((coord_y % 2) == 0)
-    {
-        sky = (float)(*(c->skylight + offset) & 0x0F);
-        block = (float)(*(c->blocklight + offset) & 0x0F);
-    }
-    else
-    {
-        sky = (float)((*(c->skylight + offset) & 0xF0) >> 4);
-        block = (float)((*(c->blocklight + offset) & 0xF0) >> 4);
-    }
+    // Either array may be packed, so let the chunk find the values
+    sky = chunk_get_value(c, CHUNK_ARRAY_SKYLIGHT, coord_x, coord_y, coord_z);
+    block = chunk_get_value(c, CHUNK_ARRAY_BLOCKLIGHT, coord_x, coord_y, coord_z);
+    if (sky < 0 || block < 0)
+        return 1.0;
+
+    return renderer_light_gamma(c, coord_y, sky << 4 | block, sky_percent, block_percent);
+}
+
+float renderer_light_gamma(chunk *c, int16_t coord_y, uint8_t light, float sky_percent, float block_percent)
+{
+    float sky, block;
+    float gamma;
+
+    if (c == NULL || coord_y < 0 || coord_y >= c->height)
+        return 1.0;
+
+    if (sky_percent < 0 || sky_percent > 1.0 ||
+        block_percent < 0 || block_percent > 1.0)
+        return 1.0;
+
+    sky = (float)(light >> 4);
+    block = (float)(light & 0x0F);
 
     sky = sky_percent * sky / 15;
     block = block_percent * block / 15;
@@ -233,3 +720,17 @@ float renderer_calc_gamma(chunk *c, int16_t coord_x, int16_t coord_y, int16_t co
     return gamma;
 
 }
+
+/* Orders tiles by X then Z */
+static int renderer_compare_tiles(const void *a, const void *b)
+{
+    const renderer_tile *left = a, *right = b;
+
+    if (left->tile_x != right->tile_x)
+        return left->tile_x < right->tile_x ? -1 : 1;
+
+    if (left->tile_z != right->tile_z)
+        return left->tile_z < right->tile_z ? -1 : 1;
+
+    return 0;
+}
@@ -5,10 +5,13 @@
 #include "level.h"
 #include "renderer.h"
 #include "renderers/flat.h"
+#include "caches/slab.h"
 #include "chunk.h"
 #include "colors.h"
 #include "nbt.h"
 
+static void renderer_flat_draw_block(renderer *r, chunk *current, chunk_surface *surface, int chunk_coord_x, int chunk_coord_z, png_bytep out);
+
 renderer *renderer_flat_new(level *lvl, color_map *map)
 {
     renderer_funcs *funcs = NULL;
@@ -18,7 +21,7 @@ renderer *renderer_flat_new(level *lvl, color_map *map)
     if (funcs == NULL)
         return NULL;
 
-    cache = (chunk_cache*)cache_slab_new(RENDERER_FLAT_CACHE_SIZE);
+    cache = cache_slab_new(RENDERER_FLAT_CACHE_SIZE);
     if (cache == NULL)
     {
         free(funcs);
@@ -27,10 +30,18 @@ renderer *renderer_flat_new(level *lvl, color_map *map)
 
     funcs->dimensions = renderer_flat_dimensions;
     funcs->draw_row = renderer_flat_draw_row;
+    funcs->draw_tile = renderer_flat_draw_tile;
+    funcs->new_cache = renderer_flat_new_cache;
+    funcs->band_height = RENDERER_FLAT_BAND_HEIGHT;
 
     return renderer_new(lvl, map, funcs, cache);
 }
 
+chunk_cache *renderer_flat_new_cache(void)
+{
+    return cache_slab_new(RENDERER_FLAT_CACHE_SIZE);
+}
+
 int renderer_flat_dimensions(int *width, int *height)
 {
     *width = RENDERER_FLAT_IMAGE_WIDTH;
@@ -40,21 +51,13 @@ int renderer_flat_dimensions(int *width, int *height)
 }
 void renderer_flat_draw_row(void *_r, png_bytep buffer, int row_number)
 {
-    int column, coord_y;
-    uint8_t highest_block, chunk_coord_x, chunk_coord_z;
-    uint8_t *slice;
-    uint16_t block_type, blocks_length;
-    uint32_t slice_offset;
-    extern int chunk_errno;
-    float gamma;
+    int column;
+    uint8_t chunk_coord_x, chunk_coord_z;
+    chunk_surface *surface = NULL;
 
-    nbt_tag *chunk_tag, *blocks_tag;
     renderer *r = (renderer*)_r;
     chunk *current = NULL;
 
-    png_byte pixel_to_write[4];
-    png_bytep pixel;
-
     if (r == NULL || r->map == NULL)
     {
         return;
@@ -73,9 +76,6 @@ void renderer_flat_draw_row(void *_r, png_bytep buffer, int row_number)
     {
         chunk_coord_x = column % 16;
 
-        // Use the "air" block as the default pixel to write (transparent)
-        color_map_write(r->map, pixel_to_write, 0);
-
         // Every 16 columns we need to switch to a new chunk
         // This block will also cleverly get called on the very first time
         // this loop iterates, initializing the necessary variables. :)
@@ -83,86 +83,108 @@ void renderer_flat_draw_row(void *_r, png_bytep buffer, int row_number)
         {
             current = renderer_flat_get_chunk(r, floor(column / 16), floor(row_number / 16) );
 
-            if (current != NULL)
-            {
-                chunk_tag = current->data;
-
-                if (chunk_tag != NULL)
-                {
-                    //current->blockdata = nbt_payload(nbt_hash_search(chunk_tag, L"Data"), TAG_Byte_Array);
-                    /*
-                    current->skylight = nbt_payload(nbt_hash_search(chunk_tag, L"SkyLight"), TAG_Byte_Array);
-                    current->heightmap = nbt_payload(nbt_hash_search(chunk_tag, L"HeightMap"), TAG_Byte_Array);
-                    current->blocklight = nbt_payload(nbt_hash_search(chunk_tag, L"BlockLight"), TAG_Byte_Array);
-                    blocks_tag = nbt_hash_search(chunk_tag, L"Blocks");
-                    current->blocks = nbt_payload(blocks_tag, TAG_Byte_Array);
-                    if (current->blocks != NULL)
-                        blocks_length = blocks_tag->meta->length;
-                        */
-                }
-            }
             // If this chunk is NULL, there's no point in looping 16 more times
             // so write out 16 blank pixels and continue.
-            else
+            if (current == NULL)
             {
-                memset(buffer + column * r->map->color_depth, 0, 16 * r->map->color_depth);
+                memset(buffer + column * 4, 0, 16 * 4);
                 column += 15; 
                 continue;
             }
+
+            surface = chunk_get_surface(current, r->alpha);
         }
 
-        if (!(current == NULL    || 
-            current->heightmap == NULL    ||
-            current->blocks == NULL       ||
-            current->blocklight == NULL   ||
-            current->skylight == NULL     
-            //current->data == NULL         ||
-           ))
+        renderer_flat_draw_block(r, current, surface, chunk_coord_x, chunk_coord_z, buffer + column * 4);
+    }
+}
+
+void renderer_flat_draw_tile(void *_r, png_bytep image)
+{
+    int chunk_x, chunk_z, coord_x, coord_z;
+    size_t stride;
+    chunk_surface *surface;
+    png_bytep origin;
+
+    renderer *r = (renderer*)_r;
+    chunk *current;
+
+    if (r == NULL || r->map == NULL)
+    {
+        return;
+    }
+
+    // The image is four bytes a pixel whatever the color map's depth, as
+    // renderer_write() expects
+    stride = 4 * RENDERER_FLAT_IMAGE_WIDTH;
+
+    for (chunk_z = 0; chunk_z < RENDERER_TILE_SIZE; chunk_z++)
+    {
+        // Each row of chunks is done with before the next, as with rows
+        cache_empty(r->cache);
+
+        for (chunk_x = 0; chunk_x < RENDERER_TILE_SIZE; chunk_x++)
         {
-            slice_offset = chunk_generate_8bit_offset(current, chunk_coord_x, 0, chunk_coord_z, CHUNK_SIZE_AREA * current->height);
-            highest_block = *(current->heightmap + (chunk_coord_z * 16 + chunk_coord_x));
+            origin = image + chunk_z * CHUNK_SIZE_Z * stride + chunk_x * CHUNK_SIZE_X * 4;
+            current = renderer_flat_get_chunk(r, chunk_x, chunk_z);
 
-            if (slice_offset != -1)
+            if (current == NULL)
             {
-                slice = current->blocks + slice_offset;
-
-                // Drill down into the column until we hit a block with no 
-                // transparency.
-                for (coord_y = highest_block; coord_y > 0; coord_y--)
-                {
-                    block_type = *(slice + coord_y);
-                    pixel = color_map_get(r->map, block_type);
-
-                    // Array subscript 3 is the alpha value, and 255 is 100% 
-                    // opacity
-                    if (pixel[3] == 255)
-                        break;
-                }
-
-                gamma = renderer_calc_gamma(current, chunk_coord_x, coord_y + 1, chunk_coord_z, RENDERER_FLAT_SKY_PERCENT, RENDERER_FLAT_BLOCK_PERCENT);
-                memcpy(pixel_to_write, pixel, 4);
-                renderer_blend_color(pixel_to_write, NULL, gamma);
-                coord_y++;
-
-                // Now go back up, blending each pixel found with blocks we 
-                // find above.
-                for (; coord_y <= highest_block; coord_y++)
-                {
-                    block_type = *(slice + coord_y);
-                    pixel = color_map_get(r->map, block_type);
-                    gamma = renderer_calc_gamma(current, chunk_coord_x, coord_y + 1, chunk_coord_z, RENDERER_FLAT_SKY_PERCENT, RENDERER_FLAT_BLOCK_PERCENT);
-                    if (pixel[3] > 0)
-                    {
-                        renderer_blend_color(pixel_to_write, pixel, gamma);
-                    }
-                }
+                for (coord_z = 0; coord_z < CHUNK_SIZE_Z; coord_z++)
+                    memset(origin + coord_z * stride, 0, CHUNK_SIZE_X * 4);
+                continue;
             }
+
+            // The whole chunk is drawn while its surface is at hand
+            surface = chunk_get_surface(current, r->alpha);
+            for (coord_z = 0; coord_z < CHUNK_SIZE_Z; coord_z++)
+                for (coord_x = 0; coord_x < CHUNK_SIZE_X; coord_x++)
+                    renderer_flat_draw_block(r, current, surface, coord_x, coord_z,
+                                             origin + coord_z * stride + coord_x * 4);
         }
+    }
+}
 
-        // Write the blended color to the image.
-        //color_map_write(r->map, buffer + (column * r->map->color_depth), block_type);
-        memcpy(buffer + column * r->map->color_depth, pixel_to_write, r->map->color_depth);
+/* Works out the color of one column of a chunk, seen from above. Rows and
+ * whole tiles are both drawn with this, so they come out the same. */
+static void renderer_flat_draw_block(renderer *r, chunk *current, chunk_surface *surface, int chunk_coord_x, int chunk_coord_z, png_bytep out)
+{
+    int i;
+    chunk_surface_column *column_surface;
+    chunk_surface_layer *layer;
+    float gamma;
+
+    png_byte pixel_to_write[4] = {0, 0, 0, 0};
+    png_bytep pixel;
+
+    // Use the "air" block as the default pixel to write (transparent)
+    color_map_write(r->map, pixel_to_write, 0);
+
+    if (surface != NULL)
+    {
+        column_surface = surface->columns + chunk_coord_z * CHUNK_SIZE_X + chunk_coord_x;
+
+        // The column was drilled down to its first opaque block when the
+        // surface was built, so start there, lit from above
+        pixel = color_map_get(r->map, column_surface->top.block);
+        gamma = renderer_light_gamma(current, column_surface->top.y + 1, column_surface->top.light, RENDERER_FLAT_SKY_PERCENT, RENDERER_FLAT_BLOCK_PERCENT);
+        memcpy(pixel_to_write, pixel, 4);
+        renderer_blend_color(pixel_to_write, NULL, gamma);
+
+        // Now go back up, blending each pixel found with blocks we 
+        // find above.
+        layer = surface->layers + column_surface->first;
+        for (i = 0; i < column_surface->count; i++, layer++)
+        {
+            pixel = color_map_get(r->map, layer->block);
+            gamma = renderer_light_gamma(current, layer->y + 1, layer->light, RENDERER_FLAT_SKY_PERCENT, RENDERER_FLAT_BLOCK_PERCENT);
+            renderer_blend_color(pixel_to_write, pixel, gamma);
+        }
     }
+
+    // Write the blended color to the image. It's a whole pixel, whatever the
+    // color map's depth, so none of the image is left unwritten.
+    memcpy(out, pixel_to_write, 4);
 }
 
 chunk *renderer_flat_get_chunk(renderer *r, int32_t coord_x, int32_t coord_z)
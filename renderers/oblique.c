@@ -8,6 +8,7 @@
 #include "colors.h"
 #include "renderer.h"
 #include "renderers/oblique.h"
+#include "caches/slab.h"
 
 renderer *renderer_oblique_new(level *lvl, color_map *map, char *output_path)
 {
@@ -21,7 +22,7 @@ renderer *renderer_oblique_new(level *lvl, color_map *map, char *output_path)
     if (funcs == NULL)
         return NULL;
 
-    cache = (chunk_cache*)cache_slab_new(RENDERER_OBLIQUE_CACHE_SIZE);
+    cache = cache_slab_new(RENDERER_OBLIQUE_CACHE_SIZE);
     if (cache == NULL)
     {
         free(funcs);
@@ -30,10 +31,16 @@ renderer *renderer_oblique_new(level *lvl, color_map *map, char *output_path)
 
     funcs->dimensions = renderer_oblique_dimensions;
     funcs->draw_row = renderer_oblique_draw_row;
+    funcs->new_cache = renderer_oblique_new_cache;
 
     return renderer_new(lvl, map, funcs, cache);
 }
 
+chunk_cache *renderer_oblique_new_cache(void)
+{
+    return cache_slab_new(RENDERER_OBLIQUE_CACHE_SIZE);
+}
+
 int renderer_oblique_dimensions(int *width, int *height)
 {
     *width = RENDERER_OBLIQUE_IMAGE_WIDTH;
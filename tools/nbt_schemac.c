@@ -0,0 +1,511 @@
+/* Compiles a description of an NBT file's layout into a C decoder.
+ *
+ *     tools/nbt_schemac schemas/chunk.schema chunk_schema.c
+ *
+ * A schema names the tags a reader wants and where each one should be
+ * stored. Every line is a directive; '#' starts a comment:
+ *
+ *     include <header>             Included by the decoder, for the struct
+ *     decoder <function> <struct>  int function(nbt_buffer *, struct *)
+ *     root                         The root TAG_Compound, whatever its name
+ *     compound <name>              A TAG_Compound inside the current one
+ *     end                          Closes root or a compound
+ *     byte|short|int <name> <field> [required]
+ *     byte_array <name> <field> <length field> [required]
+ *
+ * Fields are lvalues relative to the struct, so "arrays[2]" stores to
+ * out->arrays[2]. A byte_array is stored as a pointer into the buffer.
+ *
+ * The decoder walks a complete buffer with raw pointers. Each wanted tag is
+ * recognised by comparing its whole header (type, name length and name)
+ * against a constant, and anything else is stepped over. It gives up with -1
+ * on anything it doesn't expect: a truncated file, a wanted tag seen twice,
+ * or a required tag that never shows up. The caller is then expected to
+ * fall back to a generic reader, which has the final say.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/** \brief The most directives a schema may have */
+#define SCHEMA_MAX_NODES 64
+
+/** \brief The most tags a schema may store; each gets a bit of a uint32_t */
+#define SCHEMA_MAX_LEAVES 32
+
+/** \brief The longest line, name or field a schema may have */
+#define SCHEMA_MAX_LINE 256
+
+enum schema_kinds
+{
+    SCHEMA_ROOT,
+    SCHEMA_COMPOUND,
+    SCHEMA_BYTE,
+    SCHEMA_SHORT,
+    SCHEMA_INT,
+    SCHEMA_BYTE_ARRAY,
+};
+
+typedef struct
+{
+    int kind;
+    int parent;                     // Index of the enclosing compound
+    int bit;                        // Which bit of seen marks a stored tag
+    int required;
+    char name[SCHEMA_MAX_LINE];
+    char field[SCHEMA_MAX_LINE];
+    char length_field[SCHEMA_MAX_LINE];
+} schema_node;
+
+typedef struct
+{
+    schema_node nodes[SCHEMA_MAX_NODES];
+    int count;
+    int leaves;
+    char includes[8][SCHEMA_MAX_LINE];
+    int include_count;
+    char function[SCHEMA_MAX_LINE];
+    char type[SCHEMA_MAX_LINE];
+} schema;
+
+static const char *schema_path;
+static int schema_line;
+
+static void schema_fail(const char *message, const char *detail)
+{
+    fprintf(stderr, "%s:%d: %s%s%s\n", schema_path, schema_line, message,
+            detail == NULL ? "" : ": ", detail == NULL ? "" : detail);
+    exit(EXIT_FAILURE);
+}
+
+static void schema_copy(char *dest, const char *src)
+{
+    if (src == NULL)
+        schema_fail("missing argument", NULL);
+
+    if (strlen(src) >= SCHEMA_MAX_LINE)
+        schema_fail("too long", src);
+
+    strcpy(dest, src);
+}
+
+static int schema_kind(const char *word)
+{
+    if (strcmp(word, "byte") == 0)
+        return SCHEMA_BYTE;
+    if (strcmp(word, "short") == 0)
+        return SCHEMA_SHORT;
+    if (strcmp(word, "int") == 0)
+        return SCHEMA_INT;
+    if (strcmp(word, "byte_array") == 0)
+        return SCHEMA_BYTE_ARRAY;
+
+    return (-1);
+}
+
+/* The NBT tag type each kind is stored as */
+static int schema_tag_type(int kind)
+{
+    switch (kind)
+    {
+        case SCHEMA_ROOT:
+        case SCHEMA_COMPOUND:
+            return 10;
+        case SCHEMA_BYTE:
+            return 1;
+        case SCHEMA_SHORT:
+            return 2;
+        case SCHEMA_INT:
+            return 3;
+        case SCHEMA_BYTE_ARRAY:
+            return 7;
+    }
+
+    return 0;
+}
+
+/* How many bytes a fixed-size payload takes, or 0 if it varies */
+static int schema_payload_size(int kind)
+{
+    switch (kind)
+    {
+        case SCHEMA_BYTE:
+            return 1;
+        case SCHEMA_SHORT:
+            return 2;
+        case SCHEMA_INT:
+            return 4;
+    }
+
+    return 0;
+}
+
+/* Names are compared as raw bytes, so two siblings may not share one */
+static void schema_check_unique(const schema *s, const schema_node *node)
+{
+    int i;
+
+    for (i = 0; i < s->count; i++)
+        if (s->nodes[i].kind != SCHEMA_ROOT && s->nodes[i].parent == node->parent &&
+            strcmp(s->nodes[i].name, node->name) == 0)
+            schema_fail("duplicate name", node->name);
+}
+
+static void schema_parse(schema *s, FILE *in)
+{
+    char line[SCHEMA_MAX_LINE * 4], *word, *comment;
+    int current = -1, kind;
+    schema_node *node;
+
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        schema_line++;
+
+        if ((comment = strchr(line, '#')) != NULL)
+            *comment = '\0';
+
+        if ((word = strtok(line, " \t\r\n")) == NULL)
+            continue;
+
+        if (strcmp(word, "include") == 0)
+        {
+            if (s->include_count == 8)
+                schema_fail("too many includes", NULL);
+            schema_copy(s->includes[s->include_count++], strtok(NULL, " \t\r\n"));
+        }
+        else if (strcmp(word, "decoder") == 0)
+        {
+            schema_copy(s->function, strtok(NULL, " \t\r\n"));
+            schema_copy(s->type, strtok(NULL, " \t\r\n"));
+        }
+        else if (strcmp(word, "end") == 0)
+        {
+            if (current < 0)
+                schema_fail("end without root or compound", NULL);
+            current = s->nodes[current].parent;
+        }
+        else
+        {
+            if (s->count == SCHEMA_MAX_NODES)
+                schema_fail("too many tags", NULL);
+
+            node = s->nodes + s->count;
+            memset(node, 0, sizeof(*node));
+            node->parent = current;
+            node->bit = -1;
+
+            if (strcmp(word, "root") == 0)
+            {
+                if (s->count != 0)
+                    schema_fail("root must come first, and only once", NULL);
+                node->kind = SCHEMA_ROOT;
+                current = s->count++;
+                continue;
+            }
+
+            if (current < 0)
+                schema_fail("tag outside of root", word);
+
+            if (strcmp(word, "compound") == 0)
+            {
+                node->kind = SCHEMA_COMPOUND;
+                schema_copy(node->name, strtok(NULL, " \t\r\n"));
+                schema_check_unique(s, node);
+                current = s->count++;
+                continue;
+            }
+
+            if ((kind = schema_kind(word)) < 0)
+                schema_fail("unknown directive", word);
+
+            node->kind = kind;
+            schema_copy(node->name, strtok(NULL, " \t\r\n"));
+            schema_check_unique(s, node);
+            schema_copy(node->field, strtok(NULL, " \t\r\n"));
+            if (kind == SCHEMA_BYTE_ARRAY)
+                schema_copy(node->length_field, strtok(NULL, " \t\r\n"));
+
+            if ((word = strtok(NULL, " \t\r\n")) != NULL)
+            {
+                if (strcmp(word, "required") != 0)
+                    schema_fail("unknown option", word);
+                node->required = 1;
+            }
+
+            if (s->leaves == SCHEMA_MAX_LEAVES)
+                schema_fail("too many tags to store", NULL);
+            node->bit = s->leaves++;
+            s->count++;
+        }
+    }
+
+    schema_line++;
+    if (s->count == 0 || s->function[0] == '\0' || s->type[0] == '\0')
+        schema_fail("a schema needs a decoder and a root", NULL);
+    if (current >= 0)
+        schema_fail("root or compound left open", NULL);
+    if (s->leaves == 0)
+        schema_fail("nothing to store", NULL);
+}
+
+/* Writes a tag's header, exactly as it appears in the file, as a C string */
+static void schema_emit_header(FILE *out, const schema_node *node)
+{
+    size_t length = strlen(node->name), i;
+
+    fprintf(out, "\"\\%03o\\%03o\\%03o", schema_tag_type(node->kind),
+            (unsigned)(length >> 8) & 0xff, (unsigned)length & 0xff);
+
+    for (i = 0; i < length; i++)
+    {
+        if (isalnum((unsigned char)node->name[i]) || node->name[i] == '_')
+            fputc(node->name[i], out);
+        else
+            fprintf(out, "\\%03o", (unsigned char)node->name[i]);
+    }
+
+    fputc('"', out);
+}
+
+/* The bits of every stored tag, or of just the required ones */
+static unsigned long schema_mask(const schema *s, int required)
+{
+    unsigned long mask = 0;
+    int i;
+
+    for (i = 0; i < s->count; i++)
+        if (s->nodes[i].bit >= 0 && (!required || s->nodes[i].required))
+            mask |= 1ul << s->nodes[i].bit;
+
+    return mask;
+}
+
+static void schema_emit_leaf(FILE *out, const schema *s, const schema_node *node, size_t header)
+{
+    const char *fn = s->function;
+    unsigned long all = schema_mask(s, 0);
+
+    fprintf(out, "                    if (*seen & 0x%lxu)\n", 1ul << node->bit);
+    fprintf(out, "                        return (-1);\n");
+    fprintf(out, "                    p += %lu;\n\n", (unsigned long)header);
+
+    if (node->kind == SCHEMA_BYTE_ARRAY)
+    {
+        fprintf(out, "                    if (end - p < 4)\n");
+        fprintf(out, "                        return (-1);\n");
+        fprintf(out, "                    length = %s_be32(p);\n", fn);
+        fprintf(out, "                    p += 4;\n");
+        fprintf(out, "                    if (length < 0 || end - p < length)\n");
+        fprintf(out, "                        return (-1);\n\n");
+        fprintf(out, "                    out->%s = (uint8_t*)p;\n", node->field);
+        fprintf(out, "                    out->%s = length;\n", node->length_field);
+        fprintf(out, "                    p += length;\n");
+    }
+    else
+    {
+        fprintf(out, "                    if (end - p < %d)\n", schema_payload_size(node->kind));
+        fprintf(out, "                        return (-1);\n");
+        if (node->kind == SCHEMA_BYTE)
+            fprintf(out, "                    out->%s = (int8_t)*p;\n", node->field);
+        else if (node->kind == SCHEMA_SHORT)
+            fprintf(out, "                    out->%s = (int16_t)%s_be16(p);\n", node->field, fn);
+        else
+            fprintf(out, "                    out->%s = %s_be32(p);\n", node->field, fn);
+        fprintf(out, "                    p += %d;\n", schema_payload_size(node->kind));
+    }
+
+    fprintf(out, "\n                    *seen |= 0x%lxu;\n", 1ul << node->bit);
+    fprintf(out, "                    if (*seen == 0x%lxu)\n", all);
+    fprintf(out, "                    {\n");
+    fprintf(out, "                        *cursor = p;\n");
+    fprintf(out, "                        return 1;\n");
+    fprintf(out, "                    }\n");
+    fprintf(out, "                    continue;\n");
+}
+
+/* Writes the function that reads the children of one compound */
+static void schema_emit_compound(FILE *out, const schema *s, int index)
+{
+    const char *fn = s->function;
+    size_t length, longest = 0, header;
+    int i, any_array = 0, any_compound = 0;
+
+    for (i = 0; i < s->count; i++)
+        if (s->nodes[i].parent == index)
+        {
+            if (strlen(s->nodes[i].name) > longest)
+                longest = strlen(s->nodes[i].name);
+            if (s->nodes[i].kind == SCHEMA_BYTE_ARRAY)
+                any_array = 1;
+            if (s->nodes[i].kind == SCHEMA_COMPOUND)
+                any_compound = 1;
+        }
+
+    fprintf(out, "/* %s */\n", index == 0 ? "The root compound" : s->nodes[index].name);
+    fprintf(out, "static int %s_%d(nbt_buffer *buf, const uint8_t **cursor, %s *out, uint32_t *seen)\n", fn, index, s->type);
+    fprintf(out, "{\n");
+    fprintf(out, "    const uint8_t *p = *cursor, *end = buf->data + buf->length;\n");
+    fprintf(out, "    size_t name_length;\n");
+    if (any_array)
+        fprintf(out, "    int32_t length;\n");
+    if (any_compound)
+        fprintf(out, "    int result;\n");
+    fprintf(out, "\n");
+    fprintf(out, "    for (;;)\n");
+    fprintf(out, "    {\n");
+    fprintf(out, "        if (p == end)\n");
+    fprintf(out, "            return (-1);\n\n");
+    fprintf(out, "        if (*p == TAG_End)\n");
+    fprintf(out, "        {\n");
+    fprintf(out, "            *cursor = p + 1;\n");
+    fprintf(out, "            return 0;\n");
+    fprintf(out, "        }\n\n");
+    fprintf(out, "        if (end - p < 3)\n");
+    fprintf(out, "            return (-1);\n\n");
+    fprintf(out, "        name_length = %s_be16(p + 1);\n", fn);
+    fprintf(out, "        if ((size_t)(end - p) < 3 + name_length)\n");
+    fprintf(out, "            return (-1);\n\n");
+    fprintf(out, "        switch (name_length)\n");
+    fprintf(out, "        {\n");
+
+    for (length = 0; length <= longest; length++)
+    {
+        header = 0;
+        for (i = 0; i < s->count; i++)
+        {
+            if (s->nodes[i].parent != index || strlen(s->nodes[i].name) != length)
+                continue;
+
+            if (header == 0)
+                fprintf(out, "            case %lu:\n", (unsigned long)length);
+
+            header = 3 + length;
+            fprintf(out, "                if (memcmp(p, ");
+            schema_emit_header(out, s->nodes + i);
+            fprintf(out, ", %lu) == 0)\n", (unsigned long)header);
+            fprintf(out, "                {\n");
+
+            if (s->nodes[i].kind == SCHEMA_COMPOUND)
+            {
+                fprintf(out, "                    p += %lu;\n", (unsigned long)header);
+                fprintf(out, "                    result = %s_%d(buf, &p, out, seen);\n", fn, i);
+                fprintf(out, "                    if (result != 0)\n");
+                fprintf(out, "                    {\n");
+                fprintf(out, "                        *cursor = p;\n");
+                fprintf(out, "                        return result;\n");
+                fprintf(out, "                    }\n");
+                fprintf(out, "                    continue;\n");
+            }
+            else
+                schema_emit_leaf(out, s, s->nodes + i, header);
+
+            fprintf(out, "                }\n");
+        }
+
+        if (header != 0)
+            fprintf(out, "                break;\n");
+    }
+
+    fprintf(out, "        }\n\n");
+    fprintf(out, "        // Anything else is stepped over\n");
+    fprintf(out, "        buf->position = p + 3 + name_length - buf->data;\n");
+    fprintf(out, "        if (nbt_buffer_skip_payload(buf, *p))\n");
+    fprintf(out, "            return (-1);\n");
+    fprintf(out, "        p = buf->data + buf->position;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "}\n\n");
+}
+
+static void schema_emit(FILE *out, const schema *s)
+{
+    const char *fn = s->function;
+    int i;
+
+    fprintf(out, "/* Generated from %s by tools/nbt_schemac. Do not edit. */\n", schema_path);
+    fprintf(out, "#include <stdint.h>\n");
+    fprintf(out, "#include <string.h>\n\n");
+    fprintf(out, "#include \"nbt.h\"\n");
+    fprintf(out, "#include \"nbt_buffer.h\"\n");
+    for (i = 0; i < s->include_count; i++)
+        fprintf(out, "#include \"%s\"\n", s->includes[i]);
+    fprintf(out, "\n");
+
+    fprintf(out, "static uint16_t %s_be16(const uint8_t *p)\n", fn);
+    fprintf(out, "{\n");
+    fprintf(out, "    return (uint16_t)(p[0] << 8 | p[1]);\n");
+    fprintf(out, "}\n\n");
+    fprintf(out, "static int32_t %s_be32(const uint8_t *p)\n", fn);
+    fprintf(out, "{\n");
+    fprintf(out, "    return (int32_t)((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3]);\n");
+    fprintf(out, "}\n\n");
+
+    for (i = 0; i < s->count; i++)
+        if (s->nodes[i].kind == SCHEMA_ROOT || s->nodes[i].kind == SCHEMA_COMPOUND)
+            fprintf(out, "static int %s_%d(nbt_buffer *buf, const uint8_t **cursor, %s *out, uint32_t *seen);\n", fn, i, s->type);
+    fprintf(out, "\n");
+
+    for (i = 0; i < s->count; i++)
+        if (s->nodes[i].kind == SCHEMA_ROOT || s->nodes[i].kind == SCHEMA_COMPOUND)
+            schema_emit_compound(out, s, i);
+
+    fprintf(out, "int %s(nbt_buffer *buf, %s *out)\n", fn, s->type);
+    fprintf(out, "{\n");
+    fprintf(out, "    const uint8_t *p, *end;\n");
+    fprintf(out, "    uint32_t seen = 0;\n\n");
+    fprintf(out, "    // Only a complete buffer can be walked with plain pointers\n");
+    fprintf(out, "    if (buf == NULL || out == NULL || buf->source != NULL)\n");
+    fprintf(out, "        return (-1);\n\n");
+    fprintf(out, "    memset(out, 0, sizeof(*out));\n\n");
+    fprintf(out, "    p = buf->data + buf->position;\n");
+    fprintf(out, "    end = buf->data + buf->length;\n");
+    fprintf(out, "    if (end - p < 3 || *p != TAG_Compound ||\n");
+    fprintf(out, "        (size_t)(end - p) < 3 + (size_t)%s_be16(p + 1))\n", fn);
+    fprintf(out, "        return (-1);\n\n");
+    fprintf(out, "    p += 3 + %s_be16(p + 1);\n", fn);
+    fprintf(out, "    if (%s_0(buf, &p, out, &seen) < 0 || (seen & 0x%lxu) != 0x%lxu)\n",
+            fn, schema_mask(s, 1), schema_mask(s, 1));
+    fprintf(out, "        return (-1);\n\n");
+    fprintf(out, "    buf->position = p - buf->data;\n");
+    fprintf(out, "    return 0;\n");
+    fprintf(out, "}\n");
+}
+
+int main(int argc, char **argv)
+{
+    static schema s;
+    FILE *in, *out;
+
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s schema output.c\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    schema_path = argv[1];
+    if ((in = fopen(argv[1], "r")) == NULL)
+    {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    schema_parse(&s, in);
+    fclose(in);
+
+    if ((out = fopen(argv[2], "w")) == NULL)
+    {
+        perror(argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    schema_emit(out, &s);
+
+    if (fclose(out) != 0)
+    {
+        perror(argv[2]);
+        remove(argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
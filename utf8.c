@@ -15,8 +15,15 @@
  */
 #include <sys/types.h>
 
+#include <stdint.h>
+#include <string.h>
 #include <wchar.h>
 
+#if defined(__SSE2__) && WCHAR_MAX > 0xffff
+#include <emmintrin.h>
+#define UTF8_ASCII_SSE2
+#endif
+
 #include "utf8.h"
 
 #define _NXT	0x80
@@ -30,6 +37,7 @@
 
 static int __wchar_forbitten(wchar_t sym);
 static int __utf8_forbitten(u_char octet);
+static size_t __utf8_ascii_prefix(const u_char *p, size_t len, wchar_t *out);
 
 static int
 __wchar_forbitten(wchar_t sym)
@@ -57,6 +65,61 @@ __utf8_forbitten(u_char octet)
 	return (0);
 }
 
+/*
+ * Widens the run of ASCII at the start of p, at most len bytes long, into out
+ * unless it is NULL. Whole blocks are checked for a high bit and widened at
+ * once; only the block a run ends in is looked at one octet at a time.
+ * Returns the length of the run.
+ */
+static size_t
+__utf8_ascii_prefix(const u_char *p, size_t len, wchar_t *out)
+{
+	size_t i = 0;
+#ifdef UTF8_ASCII_SSE2
+	__m128i block, half, zero;
+
+	zero = _mm_setzero_si128();
+	for (; i + 16 <= len; i += 16) {
+		block = _mm_loadu_si128((const __m128i *)(p + i));
+		if (_mm_movemask_epi8(block) != 0)
+			break;
+
+		if (out == NULL)
+			continue;
+
+		half = _mm_unpacklo_epi8(block, zero);
+		_mm_storeu_si128((__m128i *)(out + i),
+		    _mm_unpacklo_epi16(half, zero));
+		_mm_storeu_si128((__m128i *)(out + i + 4),
+		    _mm_unpackhi_epi16(half, zero));
+		half = _mm_unpackhi_epi8(block, zero);
+		_mm_storeu_si128((__m128i *)(out + i + 8),
+		    _mm_unpacklo_epi16(half, zero));
+		_mm_storeu_si128((__m128i *)(out + i + 12),
+		    _mm_unpackhi_epi16(half, zero));
+	}
+#else
+	uint64_t word;
+	size_t j;
+
+	for (; i + 8 <= len; i += 8) {
+		memcpy(&word, p + i, sizeof(word));
+		if ((word & 0x8080808080808080ULL) != 0)
+			break;
+
+		if (out != NULL)
+			for (j = 0; j < 8; j++)
+				out[i + j] = (wchar_t)p[i + j];
+	}
+#endif
+
+	for (; i < len && (p[i] & 0x80) == 0; i++)
+		if (out != NULL)
+			out[i] = (wchar_t)p[i];
+
+	return (i);
+}
+
 /*
  * DESCRIPTION
  *	This function translates UTF-8 string into UCS-4 string (all symbols
@@ -100,6 +163,26 @@ utf8_to_wchar(const char *in, size_t insize, wchar_t *out, size_t outsize,
 	wlim = out + outsize;
 
 	for (; p < lim; p += n) {
+		/*
+		 * ASCII needs no decoding or validation, and it is nearly
+		 * all there is, so widen as much of it as possible at once.
+		 */
+		if ((*p & 0x80) == 0 && (flags & UTF8_SCALAR) == 0) {
+			n = lim - p;
+			if (out != NULL) {
+				if (out >= wlim)
+					return (0);	/* no space left */
+				if ((size_t)(wlim - out) < n)
+					n = wlim - out;
+			}
+
+			n = __utf8_ascii_prefix(p, n, out);
+			total += n;
+			if (out != NULL)
+				out += n;
+			continue;
+		}
+
 		if (__utf8_forbitten(*p) != 0 &&
 		    (flags & UTF8_IGNORE_ERROR) == 0)
 			return (0);